@@ -0,0 +1,333 @@
+/**
+ * CPU affinity and NUMA placement for the benchmark threads.
+ *
+ * Without pinning, results vary run to run depending on where the scheduler puts
+ * the threads.  A ThreadPlacement is the set of CPUs a thread may run on and the NUMA
+ * node its memory (message buffers, chunk pools) should come from.  A Placement holds
+ * the placements of the sending threads (pushers, requestor) and the receiving threads
+ * (pullers, replier);  they are used round robin.
+ *
+ * CPU specs are a CPU number (3), a range (0-3) or a NUMA node (node1).  Lists of specs,
+ * one per thread, are comma separated.
+ *
+ * Placements can also be named layouts built from the machine topology (sysfs):
+ *    same-core    - every thread on the SMT siblings of one core.
+ *    same-socket  - each thread on its own core of one socket.
+ *    cross-socket - senders on one socket, receivers on another.
+ *
+ * Memory placement uses set_mempolicy(MPOL_PREFERRED) on the thread so everything it
+ * allocates after that (including nn_allocmsg chunks) prefers the node.  Only our threads
+ * are placed;  nanomsg's own worker threads are left to the scheduler.
+ */
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include "options.h"
+
+struct CpuInfo {
+    int cpu;
+    int core;       // core_id (unique within a package).
+    int package;    // physical_package_id (socket).
+    int node;       // NUMA node.
+};
+
+/**
+ * Topology
+ *    The online CPUs and where they are, read once from sysfs.
+ */
+class Topology {
+public:
+    std::vector<CpuInfo> cpus;
+
+    static const Topology& get() {
+        static Topology topology = make();
+        return topology;
+    }
+    // Parse a sysfs cpu list e.g. 0-3,8-11.
+
+    static std::vector<int> parseList(const std::string& list) {
+        std::vector<int> result;
+        std::stringstream s(list);
+        std::string item;
+        while (std::getline(s, item, ',')) {
+            if (item.empty()) continue;
+            auto dash = item.find('-');
+            int lo = atoi(item.c_str());
+            int hi = dash == std::string::npos ? lo : atoi(item.substr(dash+1).c_str());
+            for (int c = lo; c <= hi; c++) result.push_back(c);
+        }
+        return result;
+    }
+    std::vector<int> cpusOfNode(int node) const {
+        std::vector<int> result;
+        for (auto& c : cpus) if (c.node == node) result.push_back(c.cpu);
+        return result;
+    }
+    std::set<int> packages() const {
+        std::set<int> result;
+        for (auto& c : cpus) result.insert(c.package);
+        return result;
+    }
+private:
+    static std::string readLine(const std::string& path) {
+        std::ifstream in(path);
+        std::string line;
+        std::getline(in, line);
+        return line;
+    }
+    static Topology make() {
+        Topology t;
+        std::string online = readLine("/sys/devices/system/cpu/online");
+        std::vector<int> cpuList = parseList(online);
+        if (cpuList.empty()) {                          // No sysfs - assume a flat machine.
+            for (int c = 0; c < sysconf(_SC_NPROCESSORS_ONLN); c++) cpuList.push_back(c);
+        }
+        for (int c : cpuList) {
+            std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(c) + "/topology/";
+            std::string core = readLine(base + "core_id");
+            std::string pkg  = readLine(base + "physical_package_id");
+            t.cpus.push_back(CpuInfo{
+                c, core.empty() ? c : atoi(core.c_str()), pkg.empty() ? 0 : atoi(pkg.c_str()), 0
+            });
+        }
+        std::vector<int> nodes = parseList(readLine("/sys/devices/system/node/online"));
+        for (int n : nodes) {
+            std::string list = readLine(
+                "/sys/devices/system/node/node" + std::to_string(n) + "/cpulist"
+            );
+            for (int c : parseList(list)) {
+                for (auto& info : t.cpus) if (info.cpu == c) info.node = n;
+            }
+        }
+        return t;
+    }
+};
+
+/**
+ * ThreadPlacement
+ *    Where one thread runs and allocates.  Empty cpus/memNode < 0 mean don't care.
+ */
+struct ThreadPlacement {
+    std::vector<int> cpus;
+    int              memNode = -1;
+
+    bool empty() const { return cpus.empty() && memNode < 0; }
+
+    // Parse one CPU spec: n, a-b or nodeN.
+
+    static ThreadPlacement parse(const std::string& spec) {
+        ThreadPlacement result;
+        if (spec.substr(0, 4) == "node") {
+            int node = atoi(spec.c_str() + 4);
+            result.cpus = Topology::get().cpusOfNode(node);
+            result.memNode = node;
+            if (result.cpus.empty()) {
+                std::cerr << "NUMA node " << node << " has no CPUs\n";
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            result.cpus = Topology::parseList(spec);
+        }
+        return result;
+    }
+
+    // Apply to the calling thread.
+
+    void apply() const {
+        if (!cpus.empty()) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (int c : cpus) CPU_SET(c, &set);
+            int stat = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            if (stat != 0) {
+                std::cerr << "Unable to set the CPU affinity: " << strerror(stat) << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (memNode >= 0) {
+            unsigned long mask = 1UL << memNode;
+            if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask)*8) < 0) {
+                perror("Unable to set the NUMA memory policy");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+};
+
+/**
+ * PlacementScope
+ *    Apply a placement to the calling thread (e.g. main running the pusher) and
+ * put things back when destroyed.
+ */
+class PlacementScope {
+    cpu_set_t m_saved;
+    bool      m_restoreMem;
+public:
+    PlacementScope(const ThreadPlacement& placement) : m_restoreMem(placement.memNode >= 0) {
+        pthread_getaffinity_np(pthread_self(), sizeof(m_saved), &m_saved);
+        placement.apply();
+    }
+    ~PlacementScope() {
+        pthread_setaffinity_np(pthread_self(), sizeof(m_saved), &m_saved);
+        if (m_restoreMem) {
+            syscall(SYS_set_mempolicy, MPOL_DEFAULT, nullptr, 0);
+        }
+    }
+};
+
+/**
+ * Placement
+ *    Placements of the sending and receiving threads of a benchmark.
+ */
+struct Placement {
+    std::string                  name;        // Layout name or "custom", empty if none.
+    std::vector<ThreadPlacement> senders;
+    std::vector<ThreadPlacement> receivers;
+
+    const ThreadPlacement& sender(size_t i) const {
+        return senders.empty() ? none() : senders[i % senders.size()];
+    }
+    const ThreadPlacement& receiver(size_t i) const {
+        return receivers.empty() ? none() : receivers[i % receivers.size()];
+    }
+    // Names of the layouts this machine can do.
+
+    static std::vector<std::string> layouts() {
+        std::vector<std::string> result = {"same-core", "same-socket"};
+        if (Topology::get().packages().size() > 1) result.push_back("cross-socket");
+        return result;
+    }
+
+    /**
+     * layout
+     *    Build a named layout.  The first CPU's core/socket is the home.
+     * @param name - same-core, same-socket or cross-socket.
+     * @param nsenders, nreceivers - Thread counts.
+     */
+    static Placement layout(const std::string& name, size_t nsenders, size_t nreceivers) {
+        const Topology& t = Topology::get();
+        const CpuInfo& home = t.cpus[0];
+        Placement result;
+        result.name = name;
+        std::vector<int> sendCpus, recvCpus;
+        if (name == "same-core") {
+            for (auto& c : t.cpus) {
+                if (c.package == home.package && c.core == home.core) sendCpus.push_back(c.cpu);
+            }
+            recvCpus = sendCpus;
+            std::rotate(recvCpus.begin(), recvCpus.begin() + (recvCpus.size() > 1 ? 1 : 0), recvCpus.end());
+        } else if (name == "same-socket" || name == "cross-socket") {
+            int recvPackage = home.package;
+            if (name == "cross-socket") {
+                for (int p : t.packages()) if (p != home.package) { recvPackage = p; break; }
+                if (recvPackage == home.package) {
+                    std::cerr << "cross-socket placement needs more than one socket\n";
+                    exit(EXIT_FAILURE);
+                }
+            }
+            std::vector<int> homeCores = firstCpuOfCores(home.package);
+            std::vector<int> otherCores = firstCpuOfCores(recvPackage);
+            sendCpus = homeCores;
+            if (recvPackage == home.package) {
+                // Receivers take the cores after the senders'.
+
+                std::rotate(otherCores.begin(), otherCores.begin() + (nsenders % otherCores.size()), otherCores.end());
+            }
+            recvCpus = otherCores;
+        } else {
+            std::cerr << "Unknown placement " << name
+                      << " must be same-core, same-socket or cross-socket\n";
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < nsenders; i++) {
+            result.senders.push_back(ThreadPlacement{{sendCpus[i % sendCpus.size()]}, -1});
+        }
+        for (size_t i = 0; i < nreceivers; i++) {
+            result.receivers.push_back(ThreadPlacement{{recvCpus[i % recvCpus.size()]}, -1});
+        }
+        return result;
+    }
+
+    /**
+     * fromOptions
+     *    --placement=layout, --<sender>-cpus=spec,... --<receiver>-cpus=spec,... and
+     * --buffer-node=n.  The explicit CPU lists override the layout.
+     *
+     * @param layoutName - layout to use (e.g. one of several from --placement=all) or empty.
+     */
+    static Placement fromOptions(
+        const Options& options, const std::string& layoutName,
+        const char* senderName, const char* receiverName, size_t nsenders, size_t nreceivers
+    ) {
+        Placement result;
+        if (!layoutName.empty()) {
+            result = layout(layoutName, nsenders, nreceivers);
+        }
+        std::string sendSpec = options.value(std::string(senderName) + "-cpus");
+        std::string recvSpec = options.value(std::string(receiverName) + "-cpus");
+        if (!sendSpec.empty()) result.senders = parseSpecs(sendSpec);
+        if (!recvSpec.empty()) result.receivers = parseSpecs(recvSpec);
+        if ((!sendSpec.empty() || !recvSpec.empty()) && result.name.empty()) {
+            result.name = "custom";
+        }
+        std::string node = options.value("buffer-node");
+        if (!node.empty()) {
+            int n = atoi(node.c_str());
+            if (result.senders.empty())   result.senders.resize(1);
+            if (result.receivers.empty()) result.receivers.resize(1);
+            for (auto& p : result.senders)   p.memNode = n;
+            for (auto& p : result.receivers) p.memNode = n;
+            if (result.name.empty()) result.name = "custom";
+            result.name += "-mem" + node;
+        }
+        return result;
+    }
+    // The layouts --placement asks for:  one, all of them or none.
+
+    static std::vector<std::string> requested(const Options& options) {
+        std::string name = options.value("placement");
+        if (name == "all") return layouts();
+        return std::vector<std::string>(1, name);
+    }
+private:
+    static const ThreadPlacement& none() {
+        static ThreadPlacement empty;
+        return empty;
+    }
+    static std::vector<ThreadPlacement> parseSpecs(const std::string& list) {
+        std::vector<ThreadPlacement> result;
+        std::stringstream s(list);
+        std::string item;
+        while (std::getline(s, item, ',')) {
+            if (!item.empty()) result.push_back(ThreadPlacement::parse(item));
+        }
+        return result;
+    }
+    // One CPU (the lowest numbered SMT sibling) of each core in a package.
+
+    static std::vector<int> firstCpuOfCores(int package) {
+        std::vector<int> result;
+        std::set<int> seen;
+        for (auto& c : Topology::get().cpus) {
+            if (c.package == package && seen.insert(c.core).second) result.push_back(c.cpu);
+        }
+        return result;
+    }
+};
+
+#endif
@@ -0,0 +1,65 @@
+/**
+ * Allocator call counting - see allocount.h.  This relies on glibc exporting its
+ * allocator as __libc_malloc etc.
+ */
+#include <stdlib.h>
+#include <stddef.h>
+#include <atomic>
+#include "allocount.h"
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void  __libc_free(void* p);
+}
+
+static const unsigned STRIPES = 64;
+
+struct alignas(64) Stripe {
+    std::atomic<uint64_t> calls;
+};
+static Stripe stripes[STRIPES];
+static std::atomic<unsigned> nextStripe(0);
+
+// No constructor or destructor so using it can't allocate.
+
+static thread_local unsigned myStripe = 0;
+
+static inline void
+count() {
+    if (!myStripe) myStripe = nextStripe.fetch_add(1, std::memory_order_relaxed) % STRIPES + 1;
+    stripes[myStripe - 1].calls.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t
+allocatorCalls() {
+    uint64_t result(0);
+    for (auto& s : stripes) result += s.calls.load(std::memory_order_relaxed);
+    return result;
+}
+
+extern "C" {
+
+void*
+malloc(size_t size) {
+    count();
+    return __libc_malloc(size);
+}
+void*
+calloc(size_t n, size_t size) {
+    count();
+    return __libc_calloc(n, size);
+}
+void*
+realloc(void* p, size_t size) {
+    count();
+    return __libc_realloc(p, size);
+}
+void
+free(void* p) {
+    if (p) count();
+    __libc_free(p);
+}
+
+}
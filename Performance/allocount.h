@@ -0,0 +1,20 @@
+/**
+ * Count calls to the C allocator.
+ *
+ * allocount.cpp replaces malloc, calloc, realloc and free in a program it's linked into
+ * with versions that count the call and then pass it on to glibc's allocator.  Because
+ * the program's definitions come first in symbol lookup, the calls made inside libnanomsg
+ * (its message chunks, nn_allocmsg, nn_freemsg) and by operator new/delete are counted as
+ * well as our own.  The count is kept in per thread stripes so counting doesn't make the
+ * threads contend any more than the allocator itself does.
+ */
+#ifndef ALLOCOUNT_H
+#define ALLOCOUNT_H
+
+#include <stdint.h>
+
+// malloc + calloc + realloc + free calls so far, all threads.
+
+uint64_t allocatorCalls();
+
+#endif
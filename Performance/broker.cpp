@@ -0,0 +1,265 @@
+/**
+ * This program times a request/reply server built the way we'd deploy it:
+ * many clients talking to a pool of workers through a broker.
+ *
+ *    clients (NN_REQ) -> [raw NN_REP  nn_device  raw NN_REQ] -> workers (NN_REP)
+ *
+ * The broker is nn_device running on its own thread between a raw REP front end
+ * that the clients connect to and a raw REQ back end that the workers connect to.
+ * The raw REQ socket load balances requests among the workers and the SP headers
+ * route the replies back to the right client.
+ *
+ * Usage:
+ *    broker frontend-uri backend-uri nreq reqsize repsize nclients nworkers [--format=text|csv|json]
+ * Where:
+ *    * frontend-uri - URI the broker listens on for clients.
+ *    * backend-uri  - URI the broker listens on for workers.
+ *    * nreq  - number of requests each client makes.
+ *    * reqsize - size of each request.
+ *    * repsize - size of each reply.
+ *    * nclients - number of client (requestor) threads (M).
+ *    * nworkers - number of worker (replier) threads (K).
+ *    * --format - text (default) or one csv/json record for the run (see record.h).
+ *
+ * Output is the aggregate time, msg/sec and KB/sec (request + reply bytes),
+ * latency percentiles over all clients, and then msg/sec and latency percentiles for each
+ * client as well as the number of requests each worker handled.
+ *
+ * brokertimings.sh runs this over a range of nclients and nworkers.
+ */
+#include <thread>
+#include <nanomsg/nn.h>
+#include <nanomsg/reqrep.h>
+#include <stdlib.h>
+#include <iostream>
+#include <iomanip>
+#include <unistd.h>
+#include <string>
+#include <string.h>
+#include <latch>
+#include <chrono>
+#include <vector>
+#include "histogram.h"
+#include "options.h"
+#include "record.h"
+#include "../nnpp.h"
+
+// What a client measures:
+
+struct ClientStats {
+    double           seconds;
+    LatencyHistogram latencies;
+};
+
+/**
+ * client thread:
+ *
+ * @param uri - broker front end URI.
+ * @param nreq - Number of requests to make.
+ * @param size - request size.
+ * @param ready - Latch we count down when connected.
+ * @param go    - Latch we wait on before starting.
+ * @param stats - Where our timings go.
+ */
+static void
+client(
+    std::string uri, size_t nreq, size_t size, std::latch* ready, std::latch* go,
+    ClientStats* stats
+) {
+    char* request = new char[size];
+    Socket clientSocket(AF_SP, NN_REQ, "Client failed to open socket");
+    Endpoint endpoint = clientSocket.connect(uri, "Client failed to connect to the broker");
+    int socket = clientSocket.fd();
+    ready->count_down();
+    go->wait();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < nreq; i++) {
+        auto sent = std::chrono::steady_clock::now();
+        checkstat(
+            nn_send(socket, request, size, 0),
+            "Client failed to send a request"
+        );
+        char* reply(nullptr);
+        checkstat(
+            nn_recv(socket, &reply, NN_MSG, 0),
+            "Client failed to receive a reply"
+        );
+        auto received = std::chrono::steady_clock::now();
+        nn_freemsg(reply);
+        stats->latencies.record(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(received - sent).count()
+        );
+    }
+    auto end = std::chrono::steady_clock::now();
+    stats->seconds = std::chrono::duration<double>(end - start).count();
+
+    delete []request;
+    endpoint.shutdown("Client failed shutdown");
+    clientSocket.close("Client failed close");
+}
+
+/**
+ * worker thread:
+ *    Replies to requests until nn_term is called (ETERM).
+ *
+ * @param uri - broker back end URI.
+ * @param size - reply size.
+ * @param ready - Latch we count down when connected.
+ * @param handled - Receives the number of requests we handled.
+ */
+static void
+worker(std::string uri, size_t size, std::latch* ready, size_t* handled) {
+    char* reply = new char[size];
+    Socket workerSocket(AF_SP, NN_REP, "Worker failed to open socket");
+    Endpoint endpoint = workerSocket.connect(uri, "Worker failed to connect to the broker");
+    int socket = workerSocket.fd();
+    ready->count_down();
+
+    size_t n(0);
+    while (true) {
+        char* request(nullptr);
+        int stat = nn_recv(socket, &request, NN_MSG, 0);
+        if (stat < 0 && nn_errno() == ETERM) break;
+        checkstat(stat, "Worker failed to receive a request");
+        nn_freemsg(request);
+
+        stat = nn_send(socket, reply, size, 0);
+        if (stat < 0 && nn_errno() == ETERM) break;
+        checkstat(stat, "Worker failed to send a reply");
+        n++;
+    }
+    *handled = n;
+    delete []reply;
+    // The socket closes on the way out, after nn_term so errors don't matter.
+}
+
+// The broker - nn_device only returns when the library is terminated.
+
+static void
+broker(int front, int back) {
+    int stat = nn_device(front, back);
+    if (stat < 0 && nn_errno() != ETERM) {
+        checkstat(stat, "nn_device failed");
+    }
+}
+
+// entry point
+
+int main(int argc, char** argv) {
+    // Get the parameters, not production code:
+
+    Options options(argc, argv);
+    std::string frontUri(options[0]);
+    std::string backUri(options[1]);
+    size_t nreq     = atoi(options[2].c_str());
+    size_t reqsize  = atoi(options[3].c_str());
+    size_t repsize  = atoi(options[4].c_str());
+    size_t nclients = atoi(options[5].c_str());
+    size_t nworkers = atoi(options[6].c_str());
+    OutputFormat format = parseFormat(options.value("format"));
+
+    // Set up the broker:
+
+    Socket front(AF_SP_RAW, NN_REP, "Failed to open the raw front end socket");
+    Endpoint frontEndpoint = front.bind(frontUri, "Failed to bind the front end");
+    Socket back(AF_SP_RAW, NN_REQ, "Failed to open the raw back end socket");
+    Endpoint backEndpoint = back.bind(backUri, "Failed to bind the back end");
+    std::thread device(broker, front.fd(), back.fd());
+
+    // Workers then clients:
+
+    std::latch workersReady(nworkers);
+    std::latch clientsReady(nclients);
+    std::latch go(1);
+    std::vector<size_t> handled(nworkers, 0);
+    std::vector<ClientStats*> stats;
+    std::vector<std::thread*> workers;
+    std::vector<std::thread*> clients;
+
+    for (int i = 0; i < nworkers; i++) {
+        workers.push_back(new std::thread(worker, backUri, repsize, &workersReady, &handled[i]));
+    }
+    workersReady.wait();
+    for (int i = 0; i < nclients; i++) {
+        stats.push_back(new ClientStats);
+        clients.push_back(new std::thread(
+            client, frontUri, nreq, reqsize, &clientsReady, &go, stats.back()
+        ));
+    }
+    clientsReady.wait();
+
+    ///////////////////////////////////// timed
+    auto start = std::chrono::steady_clock::now();
+    double cpuStart = cpuSeconds();
+    go.count_down();
+    for (auto p : clients) {
+        p->join();
+    }
+    auto end = std::chrono::steady_clock::now();
+    double cpu = cpuSeconds() - cpuStart;
+    ////////////////////////////////////// timed
+
+    // Tear down:  nn_term makes the device and the workers return.
+
+    nn_term();
+    device.join();
+    for (auto p : workers) {
+        p->join();
+        delete p;
+    }
+    for (auto p : clients) {
+        delete p;
+    }
+    // front and back close when we return (after nn_term errors don't matter).
+
+    // Report:
+
+    double timing = std::chrono::duration<double>(end - start).count();
+    size_t nmsg   = nreq * nclients;
+    LatencyHistogram all;
+    for (auto s : stats) {
+        all.add(s->latencies);
+    }
+
+    if (format != OutputFormat::TEXT) {
+        RunRecord record;
+        record.benchmark  = "broker";
+        record.mode       = "copy";
+        record.uri        = frontUri;
+        record.msgsize    = reqsize;
+        record.senders    = nclients;
+        record.receivers  = nworkers;
+        record.messages   = nmsg;
+        record.bytes      = (uint64_t)nmsg * (reqsize + repsize);
+        record.durationNs = timing * 1.0e9;
+        record.cpuSec     = cpu;
+        record.p50us      = all.valueAtPercentile(50.0)/1000.0;
+        record.p99us      = all.valueAtPercentile(99.0)/1000.0;
+        record.p999us     = all.valueAtPercentile(99.9)/1000.0;
+        RecordWriter writer(std::cout, format);
+        writer.write(record);
+        for (auto s : stats) {
+            delete s;
+        }
+        return EXIT_SUCCESS;
+    }
+    std::cout << "Clients  : " << nclients << " Workers : " << nworkers << std::endl;
+    std::cout << "Time     : " << timing << std::endl;
+    std::cout << "Mesg/sec : " << (double)nmsg/timing << std::endl;
+    std::cout << "KB/sec   : " << (double)(nmsg * (reqsize + repsize))/(timing * 1024.0) << std::endl;
+    all.printPercentiles(std::cout);
+    for (int i = 0; i < nclients; i++) {
+        std::cout << "client " << std::setw(4) << i << " msg/sec : "
+            << std::setw(12) << (double)nreq/stats[i]->seconds << " ";
+        stats[i]->latencies.printPercentiles(std::cout);
+    }
+    for (int i = 0; i < nworkers; i++) {
+        std::cout << "worker " << std::setw(4) << i << " handled : " << handled[i] << std::endl;
+    }
+    for (auto s : stats) {
+        delete s;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,22 @@
+#!/bin/bash
+
+echo "" >brokertimings.log    # new file.
+for uri in tcp://127.0.0.1:3000 ipc:///tmp/broker inproc:///broker
+do
+    echo "---- $uri timings ----" >> brokertimings.log
+    case $uri in
+        tcp*) backend=tcp://127.0.0.1:3001 ;;
+        *)    backend=${uri}_backend ;;
+    esac
+    for size in 1024 65536
+    do
+        for clients in 1 2 4 8 16
+        do
+            for workers in 1 2 4 8
+            do
+                echo =====  size $size clients $clients workers $workers >> brokertimings.log
+                ./broker $uri $backend 10000 $size $size $clients $workers >> brokertimings.log
+            done
+        done
+    done
+done
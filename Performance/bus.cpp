@@ -0,0 +1,591 @@
+/**
+ * This program times the nanomsg bus and checks how reliable its delivery is.
+ *
+ * The bus example (../bus.cpp) notes that bus delivery may not be reliable.  Here every
+ * member of an N member bus publishes nmsg sequence numbered messages and counts what it
+ * gets from every other member, so we can see how big a bus can get before messages
+ * start to drop.  The bus is built with the same helpers as the example (../bus.h).
+ *
+ * Usage:
+ *    bus uri-template nmembers nmsg msgsize [--rate=msg/sec] [--topology=name,...|all]
+ *        [--reactor[=nthreads]] [--epoll] [--format=text|csv|json]
+ * Where:
+ *    * uri-template - URI with a %d that's replaced by the member position.
+ *    * nmembers - Number of bus members, or a comma separated list (e.g. 2,4,8,16) to time
+ *      each bus size in turn.
+ *    * nmsg - Number of messages each member publishes.
+ *    * msgsize - Size of each message (at least the header, see BusHeader).
+ *    * --rate - Messages per second each member publishes, default 0 which is as fast
+ *      as it can.
+ *    * --topology - How the bus is wired (see BusTopology in ../bus.h):  mesh (default,
+ *      everyone connected to everyone), ring, star (through a hub) or tree[:k] (k-ary
+ *      tree, default binary).  A comma separated list or all times each in turn.  In the
+ *      star the hub listens on the template's URI for position nmembers.
+ *    * --reactor - Also time each bus with the members served by nthreads (default 4)
+ *      reactor threads rather than a thread each.  Each reactor publishes for its share
+ *      of the members as they fall due and in between nn_polls their sockets, draining
+ *      every readable one with NN_DONTWAIT up to 64 messages at a time.
+ *    * --epoll - Also time the reactors waiting with an epoll EventLoop (../eventloop.h) on
+ *      the sockets' NN_RCVFD descriptors instead of nn_poll.  Implies --reactor.
+ *    * --format - text (default) or one csv/json record per bus size (see record.h).
+ *
+ * Each member both publishes and receives, by default on a thread of its own that waits
+ * in nn_poll for traffic or its next publish.  After the members have bound and connected
+ * (a thread each), the bus handshake (busHandshake in ../bus.h) makes sure every
+ * connection is live before anyone publishes.  When a member has published everything it
+ * sends DONE;  a member is finished when it has a DONE from every other member or nothing
+ * has arrived for a while.
+ *
+ * Output for each topology and bus size:
+ *    * The number of connections and how much the process grew (resident KB) setting
+ *      the bus up (with reactors, once the set up threads have gone).
+ *    * The aggregate delivered msg/sec (messages received by all members over the time
+ *      from the first publish to the last receipt).
+ *    * Fan out latency percentiles - time from publish to receipt by each member.
+ *    * Broadcast latency percentiles - time from publish until the message has reached
+ *      every other member.
+ *    * For each member the number sent, delivered (unique messages from the others),
+ *      lost (expected (nmembers-1)*nmsg less delivered) and duplicated.
+ */
+#include <thread>
+#include <nanomsg/nn.h>
+#include <nanomsg/bus.h>
+#include <stdlib.h>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <string.h>
+#include <latch>
+#include <chrono>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <stdint.h>
+#include "../bus.h"
+#include "../eventloop.h"
+#include "histogram.h"
+#include "options.h"
+#include "record.h"
+
+// Every message, other than the handshake's (see ../bus.h), starts with this.
+// The hop count must come first for the relaying topologies.
+
+enum BusMessageType : uint32_t {
+    BUS_DATA  = 3,
+    BUS_DONE  = 4            // I've published everything.
+};
+struct BusHeader {
+    uint32_t hops;           // Relays so far + 1.
+    uint32_t type;
+    uint32_t member;         // Sender's position.
+    uint32_t unused;
+    uint64_t seq;            // Data sequence number.
+    uint64_t sentNs;         // steady_clock at publish (same process so comparable).
+};
+
+static const int doneInterval      = 10;     // ms between DONE repeats.
+static const int quietTimeout      = 1000;   // ms with no traffic before we give up.
+
+static uint64_t
+nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+// What a member measures:
+
+struct MemberStats {
+    size_t           sent;
+    size_t           delivered;    // Unique data messages from others.
+    size_t           duplicates;
+    uint64_t         startNs;      // First publish.
+    uint64_t         endNs;        // Last data receipt (or last publish).
+    LatencyHistogram latencies;    // Fan out latency (ns).
+    LatencyHistogram broadcast;    // Publish to the last member reached (ns), for the
+                                   // messages this member was last to get.
+};
+
+// How the members' sockets are served:
+
+enum class BusWaits {
+    THREAD,                  // A thread per member waiting in nn_poll on its socket.
+    POLL,                    // Reactor threads, each nn_polling its share of the sockets.
+    EPOLL                    // Reactor threads, each with an EventLoop (../eventloop.h).
+};
+
+static const size_t drainBatch   = 64;      // Most messages a reactor takes from one socket
+                                            // before looking at the others.
+
+// One timed bus, shared by its members:
+
+struct BusRun {
+    std::string        uriTemplate;
+    int                size;
+    size_t             nmsg;
+    size_t             msgsize;
+    double             rate;
+    const BusTopology* topology;
+    BusWaits           waits;
+    size_t             reactors;     // Threads serving the members unless waits is THREAD.
+    std::latch         bound;        // Everyone binds before anyone connects.
+    std::latch         connected;    // Handshakes done (main measures the memory).
+    std::latch         go;           // Main is done measuring.
+    std::latch         finished;     // Relayers keep relaying until everyone is done.
+    std::vector<std::atomic<uint32_t>> reached;   // Members each message got to.
+
+    BusRun(
+        const std::string& uri, int members, size_t n, size_t bytes, double msgRate,
+        const BusTopology* wiring, BusWaits howWaits, size_t nreactors
+    ) :
+        uriTemplate(uri), size(members), nmsg(n), msgsize(bytes), rate(msgRate),
+        topology(wiring), waits(howWaits), reactors(nreactors), bound(members),
+        connected(members), go(1), finished(members), reached((size_t)members * n) {}
+};
+
+/**
+ * BusMember
+ *    One member's socket and what it has seen.  A member never blocks once the bus is
+ * set up:  whoever serves it (its own thread or a reactor) calls publish when it's due,
+ * drain when its socket is readable and waits for at most waitMs in between.
+ */
+class BusMember {
+    BusRun*      m_run;
+    int          m_position;
+    MemberStats* m_stats;
+    Socket       m_socket;
+    std::vector<Endpoint>   m_endpoints;
+    std::vector<BusMessage> m_early;       // Arrived during the handshake.
+    std::vector<std::vector<bool>> m_seen; // Per sender bitmap of the sequence numbers.
+    std::set<uint32_t> m_done;             // Members we have a DONE from.
+    std::vector<char>  m_msg;
+    uint64_t     m_interval;               // ns between publishes, 0 is flat out.
+    uint64_t     m_nextSend;
+    uint64_t     m_lastTraffic;
+    uint64_t     m_lastDone;
+    bool         m_finished;
+
+    // Relay (if the topology needs it) and, unless we're finished, account for a
+    // received message:
+
+    void take(BusMessage& m, uint64_t received) {
+        busRelay(m_socket.fd(), m, *m_run->topology, m_run->size);
+        BusHeader* in = static_cast<BusHeader*>(m.msg);
+        size_t nmsg = m_run->nmsg;
+        if (!m_finished && m.size >= sizeof(BusHeader) && !isBusControl(in, m.size) &&
+            in->member < m_run->size) {
+            if (in->type == BUS_DATA && in->seq < nmsg) {
+                if (m_seen[in->member][in->seq]) {
+                    m_stats->duplicates++;
+                } else {
+                    m_seen[in->member][in->seq] = true;
+                    m_stats->delivered++;
+                    m_stats->latencies.record(received - in->sentNs);
+                    m_stats->endNs = received;
+                    if (++m_run->reached[in->member*nmsg + in->seq] == m_run->size - 1) {
+                        m_stats->broadcast.record(received - in->sentNs);
+                    }
+                }
+            } else if (in->type == BUS_DONE) {
+                m_done.insert(in->member);
+            }
+        }
+        freeBusMessage(m);
+    }
+public:
+    BusMember(BusRun* run, int position, MemberStats* stats) :
+        m_run(run), m_position(position), m_stats(stats), m_interval(0), m_nextSend(0),
+        m_lastTraffic(0), m_lastDone(0), m_finished(false) {}
+
+    int fd() const { return m_socket.fd(); }
+    bool finished() const { return m_finished; }
+
+    // Bind, connect and handshake.  This blocks until our neighbours are ready so each
+    // member is set up on a thread of its own.
+
+    void setUp() {
+        const BusTopology& topology(*m_run->topology);
+        auto busUris = generateUris(
+            m_run->uriTemplate, m_run->size + (topology.hasHub() ? 1 : 0)
+        );
+        auto socketAndEndpoint = createBusSocket(busUris, m_position, topology);
+        m_socket = std::move(socketAndEndpoint.first);
+        m_run->bound.arrive_and_wait();
+        m_endpoints = connectToBus(m_socket, busUris, m_position, topology);
+        m_endpoints.push_back(std::move(socketAndEndpoint.second));
+        m_early = busHandshake(
+            m_socket.fd(), topology.neighbours(m_position, m_run->size), m_position
+        );
+    }
+
+    // Start the clock and take what arrived during the handshake.
+
+    void start() {
+        size_t nmsg = m_run->nmsg;
+        m_seen.assign(m_run->size, std::vector<bool>(nmsg, false));
+        m_msg.assign(m_run->msgsize, 0);
+        BusHeader* hdr = reinterpret_cast<BusHeader*>(m_msg.data());
+        hdr->hops   = 1;
+        hdr->type   = BUS_DATA;
+        hdr->member = m_position;
+        hdr->unused = 0;
+        m_stats->sent = m_stats->delivered = m_stats->duplicates = 0;
+        m_stats->startNs = m_stats->endNs = nowNs();
+        m_interval    = m_run->rate > 0 ? (uint64_t)(1.0e9/m_run->rate) : 0;
+        m_nextSend    = m_stats->startNs;
+        m_lastTraffic = m_stats->startNs;
+        for (auto& m : m_early) {           // Sent by members that finished the handshake first.
+            take(m, m_stats->startNs);
+        }
+        m_early.clear();
+    }
+
+    // Publish if it's time, once everything is published repeat our DONE now and then.
+
+    void publish(uint64_t now) {
+        if (m_stats->sent < m_run->nmsg && now >= m_nextSend) {
+            BusHeader* hdr = reinterpret_cast<BusHeader*>(m_msg.data());
+            hdr->seq    = m_stats->sent;
+            hdr->sentNs = now;
+            int stat = nn_send(m_socket.fd(), m_msg.data(), m_msg.size(), NN_DONTWAIT);
+            if (stat < 0 && nn_errno() != EAGAIN) checkstat(stat, "Bus member failed to publish");
+            m_stats->sent++;                  // Dropped on send counts as lost.
+            m_nextSend += m_interval;
+        } else if (m_stats->sent == m_run->nmsg && now - m_lastDone > doneInterval*1000000UL) {
+            BusHeader d = {1, BUS_DONE, (uint32_t)m_position, 0, m_run->nmsg, now};
+            nn_send(m_socket.fd(), &d, sizeof(d), NN_DONTWAIT);
+            m_lastDone = now;
+        }
+    }
+
+    /**
+     * drain
+     *    Take up to batch messages without waiting.
+     * @param batch - The most to take.
+     * @return the number taken;  batch means there may be more.
+     */
+    size_t drain(size_t batch) {
+        size_t taken(0);
+        while (taken < batch) {
+            BusMessage in;
+            int n = busReceive(m_socket.fd(), in, NN_DONTWAIT);
+            if (n < 0) {
+                if (nn_errno() == EAGAIN) break;
+                checkstat(n, "Bus member failed to receive");
+            }
+            taken++;
+            m_lastTraffic = nowNs();
+            take(in, m_lastTraffic);
+        }
+        return taken;
+    }
+
+    // How long we can wait for traffic (ms) before publish is due.  The timeout is in
+    // ms so it's rounded up;  sends that fall due meanwhile go out in turn.
+
+    int waitMs(uint64_t now) const {
+        uint64_t due = m_stats->sent < m_run->nmsg ? m_nextSend :
+            m_lastDone + doneInterval*1000000UL;
+        if (m_finished) return doneInterval;
+        if (due <= now) return 0;
+        return std::min<uint64_t>(doneInterval, (due - now + 999999)/1000000);
+    }
+
+    // We're done when we have a DONE from every other member or, once we've published
+    // everything, nothing has arrived for a while (the rest are lost).
+
+    bool done(uint64_t now) const {
+        return m_done.size() == (size_t)(m_run->size - 1) ||
+            (m_stats->sent == m_run->nmsg && now - m_lastTraffic > quietTimeout*1000000UL);
+    }
+
+    // Send a last DONE so the others get it before we stop.  From here on we only relay.
+
+    void finish() {
+        BusHeader d = {1, BUS_DONE, (uint32_t)m_position, 0, m_run->nmsg, nowNs()};
+        nn_send(m_socket.fd(), &d, sizeof(d), NN_DONTWAIT);
+        m_finished = true;
+        m_run->finished.count_down();
+    }
+
+    void close() {
+        for (auto& ept : m_endpoints) {
+            ept.shutdown("Failed to shutdown an endpoint.");
+        }
+        m_socket.close("Failed to close the socket");
+    }
+};
+
+/**
+ * memberThread
+ *    Set up a member and, for BusWaits::THREAD, serve it:  publish, drain its socket
+ * and wait in nn_poll for traffic or until the next publish is due.  With reactors the
+ * thread ends once the member is set up.
+ *
+ * @param run - The bus being timed.
+ * @param member - Our member.
+ */
+static void
+memberThread(BusRun* run, BusMember* member) {
+    member->setUp();
+    run->connected.count_down();
+    if (run->waits != BusWaits::THREAD) return;
+    run->go.wait();
+
+    member->start();
+    nn_pollfd poller = {member->fd(), NN_POLLIN, 0};
+    while (!member->done(nowNs())) {
+        member->publish(nowNs());
+        if (member->drain(SIZE_MAX) == 0) {
+            nn_poll(&poller, 1, member->waitMs(nowNs()));
+        }
+    }
+    member->finish();
+    while (run->topology->relays() && !run->finished.try_wait()) {
+        nn_poll(&poller, 1, doneInterval);
+        member->drain(SIZE_MAX);
+    }
+}
+
+/**
+ * reactorThread
+ *    Serve a share of the members for the whole run (BusWaits::POLL or EPOLL).  Each
+ * pass publishes for the members that are due, then waits for any of their sockets
+ * until the earliest is next due and drains the readable ones, up to drainBatch
+ * messages at a time.  With an EventLoop each socket's handler drains its own socket
+ * and asks to be called again if it stopped at the batch (edge triggered).
+ *
+ * @param run - The bus, its members are set up.
+ * @param members - Ours.
+ */
+static void
+reactorThread(BusRun* run, std::vector<BusMember*> members) {
+    EventLoop loop;
+    std::vector<nn_pollfd> pollers;
+    for (auto member : members) {
+        member->start();
+        if (run->waits == BusWaits::EPOLL) {
+            loop.onReadable(member->fd(), [member](int) {
+                return member->drain(drainBatch) == drainBatch;
+            });
+        } else {
+            pollers.push_back(nn_pollfd{member->fd(), NN_POLLIN, 0});
+        }
+    }
+
+    // Relayers keep relaying once they are finished until everyone is.
+
+    size_t active = members.size();
+    bool relays = run->topology->relays();
+    while (active > 0 || (relays && !run->finished.try_wait())) {
+        int timeout = doneInterval;
+        for (auto member : members) {
+            if (member->finished()) continue;
+            if (member->done(nowNs())) {
+                member->finish();
+                active--;
+                continue;
+            }
+            member->publish(nowNs());
+            timeout = std::min(timeout, member->waitMs(nowNs()));
+        }
+        if (run->waits == BusWaits::EPOLL) {
+            loop.runOnce(timeout);
+        } else {
+            int nfds = nn_poll(pollers.data(), pollers.size(), timeout);
+            if (nfds < 0) {
+                if (nn_errno() == EINTR) continue;
+                checkstat(nfds, "Reactor failed to poll");
+            }
+            for (size_t i = 0; nfds > 0 && i < pollers.size(); i++) {
+                if (pollers[i].revents & NN_POLLIN) members[i]->drain(drainBatch);
+            }
+        }
+    }
+}
+
+/**
+ * timeBus
+ *    Run one bus (and its hub if it has one).
+ * @param run - The bus.
+ * @param memoryKb - Returns how much the process grew setting it up.
+ * @return the per member stats (caller deletes).
+ */
+static std::vector<MemberStats*>
+timeBus(BusRun& run, long& memoryKb) {
+    long before = residentKb();
+    std::vector<MemberStats*> stats;
+    std::vector<BusMember*> members;
+    std::vector<std::thread*> threads;
+    for (int i = 0; i < run.size; i++) {
+        stats.push_back(new MemberStats);
+        members.push_back(new BusMember(&run, i, stats[i]));
+    }
+    std::pair<Socket, Endpoint> hub;
+    std::atomic<bool> stopHub(false);
+    std::thread* hubThread(nullptr);
+    if (run.topology->hasHub()) {
+        hub = createBusHub(generateUris(run.uriTemplate, run.size + 1)[run.size]);
+        hubThread = new std::thread(busHub, hub.first.fd(), &stopHub);
+    }
+    for (int i = 0; i < run.size; i++) {
+        threads.push_back(new std::thread(memberThread, &run, members[i]));
+    }
+    run.connected.wait();
+    if (run.waits != BusWaits::THREAD) {      // The set up threads are done;  the members
+        for (auto p : threads) {              // are shared round robin by the reactors.
+            p->join();
+            delete p;
+        }
+        threads.clear();
+    }
+    memoryKb = residentKb() - before;
+    if (run.waits != BusWaits::THREAD) {
+        size_t reactors = std::max(size_t(1), std::min(run.reactors, (size_t)run.size));
+        for (size_t t = 0; t < reactors; t++) {
+            std::vector<BusMember*> ours;
+            for (size_t i = t; i < members.size(); i += reactors) {
+                ours.push_back(members[i]);
+            }
+            threads.push_back(new std::thread(reactorThread, &run, ours));
+        }
+    }
+    run.go.count_down();
+
+    for (auto p : threads) {
+        p->join();
+        delete p;
+    }
+    for (auto m : members) {                  // No one is using the sockets now.
+        m->close();
+        delete m;
+    }
+    if (hubThread) {
+        stopHub = true;
+        hubThread->join();
+        delete hubThread;
+        hub.second.shutdown("Failed to shutdown the hub endpoint.");
+        hub.first.close("Failed to close the hub socket");
+    }
+    return stats;
+}
+
+// entry point
+
+int main(int argc, char** argv) {
+    // Get the parameters, not production code:
+
+    Options options(argc, argv);
+    std::string uriTemplate(options[0]);
+    std::vector<int> sizes;
+    std::stringstream sizeList(options[1]);
+    std::string item;
+    while (std::getline(sizeList, item, ',')) {
+        if (!item.empty()) sizes.push_back(atoi(item.c_str()));
+    }
+    size_t nmsg    = atoi(options[2].c_str());
+    size_t msgsize = atoi(options[3].c_str());
+    double rate    = atof(options.value("rate", "0").c_str());
+    OutputFormat format = parseFormat(options.value("format"));
+    if (msgsize < sizeof(BusHeader)) {
+        std::cerr << "Messages must be at least " << sizeof(BusHeader) << " bytes\n";
+        exit(EXIT_FAILURE);
+    }
+    RecordWriter* writer = format == OutputFormat::TEXT ? nullptr : new RecordWriter(std::cout, format);
+
+    std::vector<std::string> topologies;
+    std::string topologyList = options.value("topology", "mesh");
+    if (topologyList == "all") topologyList = "mesh,ring,star,tree";
+    std::stringstream topologyNames(topologyList);
+    while (std::getline(topologyNames, item, ',')) {
+        if (!item.empty()) topologies.push_back(item);
+    }
+
+    std::vector<BusWaits> waits = {BusWaits::THREAD};
+    if (options.flag("reactor") || options.flag("epoll")) {    // --epoll implies --reactor.
+        waits.push_back(BusWaits::POLL);
+    }
+    if (options.flag("epoll")) waits.push_back(BusWaits::EPOLL);
+    size_t reactors = options.number("reactor", 4);
+
+    for (auto& name : topologies) {
+        BusTopology* topology = makeTopology(name);
+        for (int size : sizes) {
+            for (BusWaits wait : waits) {
+                BusRun run(uriTemplate, size, nmsg, msgsize, rate, topology, wait, reactors);
+                long memoryKb(0);
+                double cpuStart = cpuSeconds();
+                auto stats = timeBus(run, memoryKb);
+                double cpu = cpuSeconds() - cpuStart;
+
+                LatencyHistogram all, broadcast;
+                size_t delivered(0), duplicates(0);
+                uint64_t start(stats[0]->startNs), end(stats[0]->endNs);
+                for (auto s : stats) {
+                    all.add(s->latencies);
+                    broadcast.add(s->broadcast);
+                    delivered  += s->delivered;
+                    duplicates += s->duplicates;
+                    start = std::min(start, s->startNs);
+                    end   = std::max(end, s->endNs);
+                }
+                double seconds  = (end - start)/1.0e9;
+                std::string served = wait == BusWaits::THREAD ? std::string() :
+                    std::string(wait == BusWaits::EPOLL ? "epoll" : "reactor") +
+                    std::to_string(std::max(size_t(1), std::min(reactors, (size_t)size)));
+                size_t expected = (size_t)size * (size - 1) * nmsg;
+
+                if (writer) {
+                    RunRecord record;
+                    record.benchmark  = "bus";
+                    record.mode       = topology->name() + "/" +
+                        (rate > 0 ? "rate" + std::to_string((long)rate) : std::string("flat-out")) +
+                        (served.empty() ? "" : "/" + served);
+                    record.uri        = uriTemplate;
+                    record.msgsize    = msgsize;
+                    record.senders    = size;
+                    record.receivers  = size;
+                    record.messages   = delivered;
+                    record.bytes      = (uint64_t)delivered * msgsize;
+                    record.durationNs = seconds * 1.0e9;
+                    record.cpuSec     = cpu;
+                    record.p50us      = all.valueAtPercentile(50.0)/1000.0;
+                    record.p99us      = all.valueAtPercentile(99.0)/1000.0;
+                    record.p999us     = all.valueAtPercentile(99.9)/1000.0;
+                    record.memoryKb   = memoryKb;
+                    writer->write(record);
+                } else {
+                    std::cout << "Topology  : " << topology->name()
+                              << " Connections : " << topology->connectionCount(size)
+                              << " Memory (KB) : " << memoryKb << std::endl;
+                    std::cout << "Members   : " << size << " Published/member : " << nmsg
+                              << " Served by : " << (served.empty() ? "a thread each" : served)
+                              << std::endl;
+                    std::cout << "Time      : " << seconds << " CPU : " << cpu << std::endl;
+                    std::cout << "Mesg/sec  : " << delivered/seconds << " (delivered)\n";
+                    std::cout << "Expected  : " << expected << " Delivered : " << delivered
+                              << " Lost : " << expected - delivered << " Duplicated : " << duplicates << std::endl;
+                    std::cout << "Fan out latency:\n";
+                    all.printPercentiles(std::cout);
+                    std::cout << "Broadcast latency (" << broadcast.count() << " reached everyone):\n";
+                    broadcast.printPercentiles(std::cout);
+                    for (int i = 0; i < size; i++) {
+                        size_t want = (size - 1) * nmsg;
+                        std::cout << "member " << std::setw(4) << i
+                                  << " sent : " << std::setw(10) << stats[i]->sent
+                                  << " delivered : " << std::setw(10) << stats[i]->delivered
+                                  << " lost : " << std::setw(10) << want - stats[i]->delivered
+                                  << " dup : " << std::setw(6) << stats[i]->duplicates << std::endl;
+                    }
+                }
+                for (auto s : stats) delete s;
+            }
+        }
+        delete topology;
+    }
+    delete writer;
+    return EXIT_SUCCESS;
+}
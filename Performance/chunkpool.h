@@ -0,0 +1,83 @@
+/**
+ * Pool of nanomsg message chunks for zero copy sends.
+ *
+ * A zero copy send is done by building the message in a chunk from nn_allocmsg
+ * and passing a pointer to that pointer to nn_send with a length of NN_MSG.
+ * Nanomsg takes ownership of the chunk on a successful send and frees it once it's
+ * delivered.  So what this pool does is:
+ *
+ * *  Preallocate depth chunks so that, in the steady state, the allocations
+ *    happen in batches rather than one malloc per send.
+ * *  Take back chunks whose sends did not succeed (e.g. EAGAIN with NN_DONTWAIT)
+ *    so they get reused rather than freed and reallocated.
+ * *  Free whatever is left when destroyed.
+ */
+#ifndef CHUNKPOOL_H
+#define CHUNKPOOL_H
+
+#include <nanomsg/nn.h>
+#include <vector>
+#include <iostream>
+#include <stdlib.h>
+
+class ChunkPool {
+private:
+    size_t             m_chunkSize;
+    size_t             m_depth;
+    std::vector<void*> m_chunks;
+public:
+    /**
+     * @param chunkSize - size of each chunk.
+     * @param depth     - Number of chunks allocated per batch.
+     */
+    ChunkPool(size_t chunkSize, size_t depth) :
+        m_chunkSize(chunkSize), m_depth(depth) {
+        m_chunks.reserve(depth);
+        refill();
+    }
+    ~ChunkPool() {
+        for (auto p : m_chunks) {
+            nn_freemsg(p);
+        }
+    }
+    ChunkPool(const ChunkPool&) = delete;
+    ChunkPool& operator=(const ChunkPool&) = delete;
+
+    // Get a chunk, it's ours until it's successfully sent or put back.
+
+    void* get() {
+        if (m_chunks.empty()) refill();
+        void* result = m_chunks.back();
+        m_chunks.pop_back();
+        return result;
+    }
+    // Return a chunk that nanomsg did not take.
+
+    void putBack(void* chunk) {
+        m_chunks.push_back(chunk);
+    }
+    size_t chunkSize() const { return m_chunkSize; }
+
+    /**
+     * Chunk depth that keeps the pool at about maxBytes of memory.
+     */
+    static size_t depthFor(size_t chunkSize, size_t maxBytes = 64*1024*1024, size_t maxDepth = 256) {
+        size_t depth = maxBytes/chunkSize;
+        if (depth < 1) depth = 1;
+        if (depth > maxDepth) depth = maxDepth;
+        return depth;
+    }
+private:
+    void refill() {
+        while (m_chunks.size() < m_depth) {
+            void* chunk = nn_allocmsg(m_chunkSize, 0);
+            if (!chunk) {
+                std::cerr << "Unable to allocate a message chunk " << nn_strerror(nn_errno()) << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            m_chunks.push_back(chunk);
+        }
+    }
+};
+
+#endif
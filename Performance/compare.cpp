@@ -0,0 +1,402 @@
+/**
+ * Compare two sets of benchmark results and flag regressions.
+ *
+ * Reads a baseline and a candidate result file written by the performance programs
+ * or the sweep driver with --format=csv or --format=json (see record.h).  Records
+ * are grouped by configuration (benchmark, mode, transport, msgsize, senders, receivers).
+ * Each group should hold several trials (sweep --trials=n).  For each group the median
+ * of the metric and a ~95% confidence interval for the median are computed for both
+ * sets and the two samples are compared with a Mann-Whitney U test.
+ *
+ * A group is a regression if the candidate median is worse than the baseline median by more
+ * than the threshold AND the difference is significant (p < alpha).  With a single trial
+ * per side no significance can be computed;  those groups are only flagged if
+ * --allow-single is given.
+ *
+ * The p value is exact for up to exactLimit trials a side without ties and otherwise
+ * uses the normal approximation.  With n1 and n2 trials the smallest two sided p there
+ * can be is 2/C(n1+n2, n1), so at alpha 0.05 each side needs at least 4 trials (3 and 3
+ * can't do better than 0.1).  Groups that can't reach alpha are reported as too few
+ * trials rather than ok.
+ *
+ * Usage:
+ *    compare baseline-file candidate-file [--metric=name] [--threshold=pct] [--alpha=p]
+ *            [--allow-single]
+ * Where:
+ *    * --metric - Column to compare, default msg_per_sec.  Columns ending in _us or _ns
+ *      (latencies, duration), cpu_sec and the cost columns (ctx_switches, alloc_calls,
+ *      memory_kb) are lower-is-better, everything else higher-is-better.
+ *    * --threshold - Percentage change that counts as a regression, default 5.
+ *    * --alpha - significance level, default 0.05.
+ *    * --allow-single - flag single trial groups on the threshold alone.
+ *
+ * Exit status:
+ *    0 - no regressions, 1 - at least one regression, 2 - could not read the input.
+ */
+#include <stdlib.h>
+#include <math.h>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "options.h"
+
+// One record - column name to value (as text).
+
+typedef std::map<std::string, std::string> Row;
+
+// Key columns that identify a configuration:
+
+static const char* keyColumns[] = {
+    "benchmark", "mode", "transport", "msgsize", "senders", "receivers"
+};
+
+/**
+ * splitCsv
+ *    Split a CSV line into fields handling "quoted, fields" with "" escapes.
+ */
+static std::vector<std::string>
+splitCsv(const std::string& line) {
+    std::vector<std::string> result;
+    std::string field;
+    bool quoted(false);
+    for (size_t i = 0; i < line.size(); i++) {
+        char c = line[i];
+        if (quoted) {
+            if (c == '"') {
+                if (i+1 < line.size() && line[i+1] == '"') {
+                    field += '"';
+                    i++;
+                } else {
+                    quoted = false;
+                }
+            } else {
+                field += c;
+            }
+        } else if (c == '"') {
+            quoted = true;
+        } else if (c == ',') {
+            result.push_back(field);
+            field.clear();
+        } else {
+            field += c;
+        }
+    }
+    result.push_back(field);
+    return result;
+}
+
+/**
+ * parseJson
+ *    Parse one of our flat JSON objects: string and number values only.
+ */
+static Row
+parseJson(const std::string& line) {
+    Row row;
+    size_t i = line.find('{');
+    if (i == std::string::npos) return row;
+    i++;
+    auto skipSpace = [&]() { while (i < line.size() && isspace(line[i])) i++; };
+    auto readString = [&]() {
+        std::string s;
+        i++;                                    // opening quote.
+        while (i < line.size() && line[i] != '"') {
+            if (line[i] == '\\' && i+1 < line.size()) {
+                i++;
+                if (line[i] == 'u' && i+4 < line.size()) {
+                    s += (char)strtol(line.substr(i+1, 4).c_str(), nullptr, 16);
+                    i += 4;
+                } else {
+                    s += line[i];
+                }
+            } else {
+                s += line[i];
+            }
+            i++;
+        }
+        i++;                                    // closing quote.
+        return s;
+    };
+    while (i < line.size()) {
+        skipSpace();
+        if (line[i] == '}') break;
+        if (line[i] == ',') { i++; continue; }
+        if (line[i] != '"') break;             // Malformed.
+        std::string key = readString();
+        skipSpace();
+        if (i >= line.size() || line[i] != ':') break;
+        i++;
+        skipSpace();
+        std::string value;
+        if (i < line.size() && line[i] == '"') {
+            value = readString();
+        } else {
+            while (i < line.size() && line[i] != ',' && line[i] != '}' && !isspace(line[i])) {
+                value += line[i++];
+            }
+        }
+        row[key] = value;
+    }
+    return row;
+}
+
+/**
+ * readResults
+ *    Read a result file - JSON lines if the first non blank character is {
+ * otherwise CSV with a header line.
+ */
+static std::vector<Row>
+readResults(const std::string& filename) {
+    std::ifstream in(filename);
+    if (!in) {
+        std::cerr << "Unable to open " << filename << std::endl;
+        exit(2);
+    }
+    std::vector<Row> rows;
+    std::vector<std::string> header;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos) continue;
+        if (line[first] == '{') {
+            rows.push_back(parseJson(line));
+        } else if (header.empty() || line.substr(0, 10) == "benchmark,") {
+            header = splitCsv(line);            // Header (possibly repeated by appending).
+        } else {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            auto fields = splitCsv(line);
+            Row row;
+            for (size_t c = 0; c < header.size() && c < fields.size(); c++) {
+                row[header[c]] = fields[c];
+            }
+            rows.push_back(row);
+        }
+    }
+    return rows;
+}
+
+static std::string
+keyOf(const Row& row) {
+    std::string key;
+    for (auto col : keyColumns) {
+        auto p = row.find(col);
+        if (!key.empty()) key += " ";
+        key += p == row.end() ? std::string("-") : p->second;
+    }
+    return key;
+}
+
+// Group the metric values by configuration key.
+
+static std::map<std::string, std::vector<double>>
+group(const std::vector<Row>& rows, const std::string& metric) {
+    std::map<std::string, std::vector<double>> result;
+    for (auto& row : rows) {
+        auto p = row.find(metric);
+        if (p == row.end() || p->second.empty()) continue;
+        result[keyOf(row)].push_back(atof(p->second.c_str()));
+    }
+    return result;
+}
+
+static double
+median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    size_t n = v.size();
+    return n % 2 ? v[n/2] : (v[n/2 - 1] + v[n/2])/2.0;
+}
+
+/**
+ * medianInterval
+ *    Distribution free ~95% confidence interval for the median from the order
+ * statistics (normal approximation to the binomial).  Small samples just get the range.
+ */
+static std::pair<double, double>
+medianInterval(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    int n = v.size();
+    int lo = (int)floor(n/2.0 - 1.96*sqrt((double)n)/2.0);
+    int hi = (int)ceil(n/2.0 + 1.96*sqrt((double)n)/2.0) - 1;
+    if (lo < 0) lo = 0;
+    if (hi > n-1) hi = n-1;
+    return std::pair<double, double>(v[lo], v[hi]);
+}
+
+static const size_t exactLimit = 20;    // Most trials a side for the exact U distribution.
+
+/**
+ * exactP
+ *    Two sided p value of U from its exact distribution (no ties).  The number of
+ * orderings of n1 + n2 distinct values giving each U comes from the recurrence
+ * N(n1, n2, u) = N(n1-1, n2, u-n2) + N(n1, n2-1, u):  the largest value is from the
+ * first sample (beating all n2 of the second) or from the second.
+ */
+static double
+exactP(int n1, int n2, double u) {
+    // counts[j][u] is N(i, j, u) for the i being built, prev for i-1.
+
+    std::vector<std::vector<double>> prev(n2 + 1, std::vector<double>(1, 1.0));
+    for (int i = 1; i <= n1; i++) {
+        std::vector<std::vector<double>> counts(n2 + 1);
+        counts[0].assign(1, 1.0);
+        for (int j = 1; j <= n2; j++) {
+            counts[j].assign(i*j + 1, 0.0);
+            for (int k = 0; k <= i*j; k++) {
+                if (k >= j && k - j < prev[j].size()) counts[j][k] += prev[j][k - j];
+                if (k < counts[j - 1].size())         counts[j][k] += counts[j - 1][k];
+            }
+        }
+        prev.swap(counts);
+    }
+    auto& dist = prev[n2];
+    double total(0), below(0), above(0);
+    for (int k = 0; k < dist.size(); k++) {
+        total += dist[k];
+        if (k <= u) below += dist[k];
+        if (k >= u) above += dist[k];
+    }
+    return std::min(1.0, 2.0*std::min(below, above)/total);
+}
+
+/**
+ * smallestP
+ *    The smallest two sided p value n1 and n2 trials can give:  2/C(n1+n2, n1).
+ */
+static double
+smallestP(size_t n1, size_t n2) {
+    double orderings(1);
+    for (size_t k = 1; k <= n1; k++) {
+        orderings = orderings*(n2 + k)/k;
+    }
+    return std::min(1.0, 2.0/orderings);
+}
+
+/**
+ * mannWhitney
+ *    Two sided p value for the Mann-Whitney U test:  exact for small samples without
+ * ties, otherwise the normal approximation with tie and continuity correction.
+ */
+static double
+mannWhitney(const std::vector<double>& a, const std::vector<double>& b) {
+    std::vector<std::pair<double, int>> all;
+    for (auto x : a) all.push_back(std::pair<double, int>(x, 0));
+    for (auto x : b) all.push_back(std::pair<double, int>(x, 1));
+    std::sort(all.begin(), all.end());
+
+    // Ranks with ties averaged:
+
+    double n1 = a.size(), n2 = b.size(), n = n1 + n2;
+    double rankSumA(0), tieTerm(0);
+    for (size_t i = 0; i < all.size(); ) {
+        size_t j = i;
+        while (j < all.size() && all[j].first == all[i].first) j++;
+        double rank = (i + 1 + j)/2.0;          // Average of ranks i+1..j
+        double t = j - i;
+        tieTerm += t*t*t - t;
+        for (size_t k = i; k < j; k++) {
+            if (all[k].second == 0) rankSumA += rank;
+        }
+        i = j;
+    }
+    double u     = rankSumA - n1*(n1 + 1)/2.0;
+    if (tieTerm == 0 && a.size() <= exactLimit && b.size() <= exactLimit) {
+        return exactP(a.size(), b.size(), u);
+    }
+    double mean  = n1*n2/2.0;
+    double var   = n1*n2/12.0 * ((n + 1) - tieTerm/(n*(n - 1)));
+    if (var <= 0) return 1.0;
+    double z = (fabs(u - mean) - 0.5)/sqrt(var);   // Continuity correction.
+    if (z < 0) z = 0;
+    return erfc(z/sqrt(2.0));
+}
+
+static bool
+lowerIsBetter(const std::string& metric) {
+    auto endsWith = [&](const char* suffix) {
+        std::string s(suffix);
+        return metric.size() >= s.size() && metric.compare(metric.size() - s.size(), s.size(), s) == 0;
+    };
+    return endsWith("_us") || endsWith("_ns") || metric == "cpu_sec" ||
+        metric == "ctx_switches" || metric == "alloc_calls" || metric == "memory_kb";
+}
+
+// entry point
+
+int main(int argc, char** argv) {
+    Options options(argc, argv);
+    if (options.size() < 2) {
+        std::cerr << "Usage: compare baseline-file candidate-file [--metric=name] [--threshold=pct]"
+                  << " [--alpha=p] [--allow-single]\n";
+        return 2;
+    }
+    std::string metric  = options.value("metric", "msg_per_sec");
+    double threshold    = atof(options.value("threshold", "5").c_str())/100.0;
+    double alpha        = atof(options.value("alpha", "0.05").c_str());
+    bool   allowSingle  = options.flag("allow-single");
+    bool   lowerBetter  = lowerIsBetter(metric);
+
+    auto baseline  = group(readResults(options[0]), metric);
+    auto candidate = group(readResults(options[1]), metric);
+
+    std::cout << "Metric: " << metric << (lowerBetter ? " (lower is better)" : " (higher is better)")
+              << " threshold: " << threshold*100 << "% alpha: " << alpha << std::endl;
+    std::cout << std::left << std::setw(48) << "configuration" << std::right
+              << std::setw(14) << "baseline" << std::setw(26) << "95% CI"
+              << std::setw(14) << "candidate" << std::setw(26) << "95% CI"
+              << std::setw(9) << "change%" << std::setw(10) << "p" << "  verdict\n";
+
+    int regressions(0), compared(0), underpowered(0);
+    for (auto& b : baseline) {
+        auto c = candidate.find(b.first);
+        if (c == candidate.end()) continue;
+        compared++;
+        double bmed = median(b.second);
+        double cmed = median(c->second);
+        auto bci = medianInterval(b.second);
+        auto cci = medianInterval(c->second);
+        double change = bmed != 0 ? (cmed - bmed)/bmed : 0.0;
+        double worse  = lowerBetter ? change : -change;     // > 0 means got worse.
+
+        bool single = b.second.size() < 2 || c->second.size() < 2;
+        double p = single ? 1.0 : mannWhitney(b.second, c->second);
+        bool significant = single ? allowSingle : p < alpha;
+        bool tooFew = !single && smallestP(b.second.size(), c->second.size()) >= alpha;
+        if (tooFew) underpowered++;
+
+        std::string verdict = "ok";
+        if (worse > threshold && significant) {
+            verdict = "REGRESSION";
+            regressions++;
+        } else if (-worse > threshold && significant) {
+            verdict = "improved";
+        } else if (single && !allowSingle) {
+            verdict = "ok (1 trial)";
+        } else if (tooFew) {
+            verdict = "too few trials";
+        }
+
+        std::ostringstream bint, cint;
+        bint << "[" << bci.first << ", " << bci.second << "]";
+        cint << "[" << cci.first << ", " << cci.second << "]";
+        std::cout << std::left << std::setw(48) << b.first << std::right
+                  << std::setw(14) << bmed << std::setw(26) << bint.str()
+                  << std::setw(14) << cmed << std::setw(26) << cint.str()
+                  << std::setw(9) << std::fixed << std::setprecision(1) << change*100
+                  << std::setw(10) << std::setprecision(4) << p << std::defaultfloat
+                  << std::setprecision(6) << "  " << verdict << std::endl;
+    }
+    std::cout << compared << " configurations compared, " << regressions << " regressions\n";
+    if (underpowered) {
+        std::cerr << underpowered << " configurations have too few trials to reach p < " << alpha
+                  << " (at alpha 0.05 use at least 4 a side)\n";
+    }
+    if (compared == 0) {
+        std::cerr << "No configurations in common between the two result sets\n";
+        return 2;
+    }
+    return regressions ? 1 : 0;
+}
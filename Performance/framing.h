@@ -0,0 +1,190 @@
+/**
+ * Send modes and header + payload framing for the pipeline and reqrep timings.
+ *
+ * Besides copying a message from one user buffer (COPY) and sending nn_allocmsg chunks
+ * (ZEROCOPY, see chunkpool.h) there are two modes for the common case of a small header
+ * sent together with a large payload that lives somewhere else:
+ *
+ * *  CONCAT - memcpy the header and payload into one buffer and nn_send that.  The
+ *    receiver nn_recvs into one buffer and copies the header and payload out of it.
+ * *  GATHER - nn_sendmsg with one nn_iovec for the header and one for the payload;
+ *    the receiver nn_recvmsgs straight into a header and a payload iovec.
+ *
+ * Both send and receive exactly the same bytes, so the difference is our copies
+ * (nanomsg still gathers the iovecs into its own chunk).  A FramedMessage is the
+ * header and payload buffers for one end of a connection;  they're allocated once
+ * and reused for every message.
+ *
+ * POOLED sends each message from a buffer taken from a MessagePool (msgpool.h) and
+ * receives it by copying into one (nn_recv with a fixed size) rather than taking
+ * nanomsg's chunk.
+ *
+ * COPY and ZEROCOPY messages are received by taking nanomsg's chunk (NN_MSG) and freeing
+ * it.  The receive mode FIXED instead copies each one into a FixedBuffer:  one buffer of
+ * the largest message size, allocated once and reused, so it stays hot in the cache.
+ */
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include <nanomsg/nn.h>
+#include <errno.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include "options.h"
+
+enum class SendMode {
+    COPY, ZEROCOPY, CONCAT, GATHER, POOLED
+};
+
+inline const char*
+sendModeName(SendMode mode) {
+    switch (mode) {
+        case SendMode::ZEROCOPY: return "zerocopy";
+        case SendMode::CONCAT:   return "concat";
+        case SendMode::GATHER:   return "gather";
+        case SendMode::POOLED:   return "pooled";
+        default:                 return "copy";
+    }
+}
+inline bool
+isFramed(SendMode mode) {
+    return mode == SendMode::CONCAT || mode == SendMode::GATHER;
+}
+
+// The modes a program was asked to time:  always copy, --zerocopy adds zero copy,
+// --gather adds concat and gather so they can be compared and --pool adds pooled.
+
+inline std::vector<SendMode>
+requestedModes(const Options& options) {
+    std::vector<SendMode> result = {SendMode::COPY};
+    if (options.flag("zerocopy")) result.push_back(SendMode::ZEROCOPY);
+    if (options.flag("gather")) {
+        result.push_back(SendMode::CONCAT);
+        result.push_back(SendMode::GATHER);
+    }
+    if (options.flag("pool")) result.push_back(SendMode::POOLED);
+    return result;
+}
+
+enum class RecvMode {
+    CHUNK, FIXED
+};
+
+// Send modes whose receivers take nanomsg's chunk, i.e. those FIXED applies to.
+
+inline bool
+receivesChunks(SendMode mode) {
+    return mode == SendMode::COPY || mode == SendMode::ZEROCOPY;
+}
+// Always chunk, --fixed-recv adds fixed.
+
+inline std::vector<RecvMode>
+requestedRecvModes(const Options& options) {
+    std::vector<RecvMode> result = {RecvMode::CHUNK};
+    if (options.flag("fixed-recv")) result.push_back(RecvMode::FIXED);
+    return result;
+}
+// e.g. copy, copy/fixed.
+
+inline std::string
+sendRecvName(SendMode send, RecvMode recv) {
+    return std::string(sendModeName(send)) + (recv == RecvMode::FIXED ? "/fixed" : "");
+}
+
+/**
+ * FixedBuffer
+ *    The reused buffer of FIXED receives.  nn_recv quietly truncates a message that
+ * doesn't fit and returns its full size;  recv makes that an EMSGSIZE error instead.
+ */
+class FixedBuffer {
+private:
+    std::vector<char> m_buffer;
+public:
+    FixedBuffer(size_t maxSize) : m_buffer(maxSize) {}
+
+    const char* data() const { return m_buffer.data(); }
+    size_t size() const      { return m_buffer.size(); }
+
+    // What nn_recv returned, or -1 with nn_errno() EMSGSIZE if the message was truncated.
+
+    int recv(int socket, int flags = 0) {
+        int n = nn_recv(socket, m_buffer.data(), m_buffer.size(), flags);
+        if (n > 0 && (size_t)n > m_buffer.size()) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        return n;
+    }
+};
+
+// Header part of each framed message.  Messages no bigger than this are all header.
+
+static const size_t FRAME_HEADER_SIZE = 64;
+
+class FramedMessage {
+private:
+    size_t            m_size;
+    bool              m_gather;
+    std::vector<char> m_header;
+    std::vector<char> m_payload;
+    std::vector<char> m_frame;       // CONCAT's contiguous copy.
+    nn_msghdr         m_hdr;
+public:
+    /**
+     * @param size   - Total message size (header + payload).
+     * @param gather - true for GATHER, false for CONCAT.
+     */
+    FramedMessage(size_t size, bool gather) :
+        m_size(size), m_gather(gather),
+        m_header(size < FRAME_HEADER_SIZE ? size : FRAME_HEADER_SIZE),
+        m_payload(size - m_header.size(), 'x'),
+        m_frame(gather ? 0 : size) {}
+
+    char* header()              { return m_header.data(); }
+    size_t size() const         { return m_size; }
+
+    // Both return what the nanomsg call did.
+
+    int send(int socket, int flags = 0) {
+        if (m_gather) {
+            nn_iovec iov[2] = {
+                {m_header.data(), m_header.size()},
+                {m_payload.data(), m_payload.size()}
+            };
+            return nn_sendmsg(socket, msghdr(iov), flags);
+        }
+        memcpy(m_frame.data(), m_header.data(), m_header.size());
+        memcpy(m_frame.data() + m_header.size(), m_payload.data(), m_payload.size());
+        return nn_send(socket, m_frame.data(), m_size, flags);
+    }
+    // A shorter message (e.g. a stop) fills the header first;  a longer one is truncated.
+
+    int recv(int socket, int flags = 0) {
+        if (m_gather) {
+            nn_iovec iov[2] = {
+                {m_header.data(), m_header.size()},
+                {m_payload.data(), m_payload.size()}
+            };
+            return nn_recvmsg(socket, msghdr(iov), flags);
+        }
+        int n = nn_recv(socket, m_frame.data(), m_size, flags);
+        if (n > 0) {
+            size_t got = (size_t)n < m_size ? n : m_size;
+            size_t head = got < m_header.size() ? got : m_header.size();
+            memcpy(m_header.data(), m_frame.data(), head);
+            memcpy(m_payload.data(), m_frame.data() + head, got - head);
+        }
+        return n;
+    }
+private:
+    nn_msghdr* msghdr(nn_iovec* iov) {
+        memset(&m_hdr, 0, sizeof(m_hdr));
+        m_hdr.msg_iov    = iov;
+        m_hdr.msg_iovlen = m_payload.empty() ? 1 : 2;
+        return &m_hdr;
+    }
+};
+
+#endif
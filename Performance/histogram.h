@@ -0,0 +1,151 @@
+/**
+ * Fixed memory latency histogram.
+ *
+ * This is a stripped down take on the HDR histogram idea.  Values (we use
+ * nanoseconds) are put in log2 buckets, each of which is split into
+ * SUB_BUCKETS linear sub-buckets.  That gives us a relative error of
+ * at most 1/SUB_BUCKETS (< 1%) over the whole 64 bit range while the
+ * count storage is a fixed array allocated once by the constructor.
+ * record() does no allocation so it can be called on the timing hot path.
+ *
+ * Indexing:  For a value v with floor(log2(v)) = m, let
+ *    shift = max(0, m - SUB_BITS)
+ * then the bucket index is  shift*SUB_BUCKETS + (v >> shift).
+ * Values below 2*SUB_BUCKETS are therefore counted exactly.
+ */
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <bit>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+class LatencyHistogram {
+public:
+    static const int      SUB_BITS    = 7;
+    static const uint64_t SUB_BUCKETS = 1 << SUB_BITS;
+    static const size_t   NBUCKETS    = (64 - SUB_BITS)*SUB_BUCKETS + SUB_BUCKETS;
+private:
+    std::vector<uint64_t> m_counts;
+    uint64_t              m_total;
+    uint64_t              m_min;
+    uint64_t              m_max;
+    double                m_sum;
+public:
+    LatencyHistogram() :
+        m_counts(NBUCKETS, 0) {
+        reset();
+    }
+
+    // Count a value:
+
+    void record(uint64_t value) {
+        m_counts[index(value)]++;
+        m_total++;
+        m_sum += value;
+        if (value < m_min) m_min = value;
+        if (value > m_max) m_max = value;
+    }
+    // Fold another histogram into this one (e.g. per thread histograms).
+
+    void add(const LatencyHistogram& rhs) {
+        for (size_t i = 0; i < NBUCKETS; i++) {
+            m_counts[i] += rhs.m_counts[i];
+        }
+        m_total += rhs.m_total;
+        m_sum   += rhs.m_sum;
+        m_min = std::min(m_min, rhs.m_min);
+        m_max = std::max(m_max, rhs.m_max);
+    }
+    void reset() {
+        std::fill(m_counts.begin(), m_counts.end(), 0);
+        m_total = 0;
+        m_sum   = 0.0;
+        m_min   = UINT64_MAX;
+        m_max   = 0;
+    }
+
+    uint64_t count() const { return m_total; }
+    uint64_t min()   const { return m_total ? m_min : 0; }
+    uint64_t max()   const { return m_max; }
+    double   mean()  const { return m_total ? m_sum/m_total : 0.0; }
+
+    /**
+     * valueAtPercentile
+     *    @param pct - percentile in the range [0, 100].
+     *    @return the highest value equivalent to the bucket that holds
+     *    the pct'th percentile (clamped to the max value seen).
+     */
+    uint64_t valueAtPercentile(double pct) const {
+        if (m_total == 0) return 0;
+        uint64_t target = (uint64_t)((pct/100.0) * m_total + 0.5);
+        if (target < 1) target = 1;
+        if (target > m_total) target = m_total;
+        uint64_t cumulative(0);
+        for (size_t i = 0; i < NBUCKETS; i++) {
+            cumulative += m_counts[i];
+            if (cumulative >= target) {
+                return std::min(highValue(i), m_max);
+            }
+        }
+        return m_max;
+    }
+
+    /**
+     * printPercentiles
+     *    One line summary of the distribution in microseconds.
+     *    Values recorded are assumed to be in ns.
+     */
+    void printPercentiles(std::ostream& out) const {
+        out << "Latency (us) n: " << count()
+            << " min: "   << min()/1000.0
+            << " mean: "  << mean()/1000.0
+            << " p50: "   << valueAtPercentile(50.0)/1000.0
+            << " p90: "   << valueAtPercentile(90.0)/1000.0
+            << " p99: "   << valueAtPercentile(99.0)/1000.0
+            << " p99.9: " << valueAtPercentile(99.9)/1000.0
+            << " p99.99: " << valueAtPercentile(99.99)/1000.0
+            << " max: "   << max()/1000.0 << std::endl;
+    }
+    /**
+     * printDistribution
+     *    Dumps the non-empty buckets:  low high (us) count cumulative-fraction.
+     */
+    void printDistribution(std::ostream& out) const {
+        out << "       low(us)       high(us)        count   cumulative\n";
+        uint64_t cumulative(0);
+        for (size_t i = 0; i < NBUCKETS; i++) {
+            if (m_counts[i]) {
+                cumulative += m_counts[i];
+                out << std::setw(14) << lowValue(i)/1000.0 << " "
+                    << std::setw(14) << highValue(i)/1000.0 << " "
+                    << std::setw(12) << m_counts[i] << " "
+                    << std::setw(12) << (double)cumulative/m_total << std::endl;
+            }
+        }
+    }
+    // Bucket mapping - public so that the math can be sanity checked.
+
+    static size_t index(uint64_t value) {
+        int magnitude = std::bit_width(value) - 1;   // floor(log2), -1 for 0.
+        int shift = magnitude > SUB_BITS ? magnitude - SUB_BITS : 0;
+        return ((size_t)shift << SUB_BITS) + (value >> shift);
+    }
+    static uint64_t lowValue(size_t idx) {
+        if (idx < SUB_BUCKETS) return idx;
+        int      shift    = (idx >> SUB_BITS) - 1;
+        uint64_t mantissa = idx - ((uint64_t)shift << SUB_BITS);
+        return mantissa << shift;
+    }
+    static uint64_t highValue(size_t idx) {
+        if (idx < SUB_BUCKETS) return idx;
+        int      shift    = (idx >> SUB_BITS) - 1;
+        uint64_t mantissa = idx - ((uint64_t)shift << SUB_BITS);
+        return ((mantissa + 1) << shift) - 1;
+    }
+};
+
+#endif
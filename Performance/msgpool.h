@@ -0,0 +1,138 @@
+/**
+ * Size classed, per thread cached pool of message buffers.
+ *
+ * chunkpool.h can only batch the nn_allocmsg calls of zero copy sends:  nanomsg frees a
+ * chunk once it's sent.  This pool is for the buffers we send from and receive into
+ * ourselves (nn_send of a user buffer, nn_recv with a fixed size):  a buffer is taken
+ * with get(), the message is sent from or received into it and it's given back with
+ * put() so it can be used for the next message.
+ *
+ * Buffers come in power of two size classes from 64 bytes to 16MB;  bigger ones are
+ * allocated and freed each time.  Each thread has a cache of free buffers for each class
+ * so get/put on a warm thread take no lock and make no allocator calls.  A thread whose
+ * cache for a class is empty takes a batch from a shared depot (one lock) and only
+ * allocates if that's empty too;  a thread whose cache is full gives half of it back.
+ * A buffer can be put back on a different thread than the one that got it.  A thread's
+ * cache goes back to the depot when the thread exits.
+ */
+#ifndef MSGPOOL_H
+#define MSGPOOL_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+class MessagePool {
+public:
+    static const int    MIN_SHIFT = 6;                         // 64 bytes.
+    static const int    MAX_SHIFT = 24;                        // 16MB.
+    static const size_t NCLASSES  = MAX_SHIFT - MIN_SHIFT + 1;
+    static const size_t CACHE_BYTES = 4*1024*1024;             // Per class per thread...
+    static const size_t MAX_DEPTH = 64;                        // ...but at most this many.
+private:
+    typedef std::vector<void*> FreeList;
+
+    struct Depot {
+        std::mutex lock;
+        FreeList   free[NCLASSES];
+        ~Depot() {
+            for (auto& list : free) {
+                for (auto p : list) ::free(p);
+            }
+        }
+    };
+    struct Cache {
+        FreeList free[NCLASSES];
+        ~Cache() {
+            Depot& d = depot();
+            std::lock_guard<std::mutex> guard(d.lock);
+            for (size_t c = 0; c < NCLASSES; c++) {
+                d.free[c].insert(d.free[c].end(), free[c].begin(), free[c].end());
+            }
+        }
+    };
+public:
+    // Size of the buffer get(size) returns.
+
+    static size_t capacity(size_t size) {
+        int c = sizeClass(size);
+        return c < 0 ? size : size_t(1) << (c + MIN_SHIFT);
+    }
+
+    // A buffer of at least size bytes (capacity(size)).
+
+    static void* get(size_t size) {
+        int c = sizeClass(size);
+        if (c < 0) return allocate(size);
+        FreeList& list = cache().free[c];
+        if (list.empty()) refill(c, list);
+        void* result = list.back();
+        list.pop_back();
+        return result;
+    }
+    // Give back a buffer that get(size) returned.
+
+    static void put(void* buffer, size_t size) {
+        int c = sizeClass(size);
+        if (c < 0) {
+            ::free(buffer);
+            return;
+        }
+        FreeList& list = cache().free[c];
+        if (list.size() >= depth(c)) spill(c, list);
+        list.push_back(buffer);
+    }
+private:
+    static int sizeClass(size_t size) {
+        int shift = MIN_SHIFT;
+        while ((size_t(1) << shift) < size) shift++;
+        return shift > MAX_SHIFT ? -1 : shift - MIN_SHIFT;
+    }
+    static size_t depth(int c) {
+        size_t n = CACHE_BYTES >> (c + MIN_SHIFT);
+        return n < 2 ? 2 : (n > MAX_DEPTH ? MAX_DEPTH : n);
+    }
+    static void* allocate(size_t size) {
+        void* result = malloc(size);
+        if (!result) {
+            std::cerr << "Unable to allocate a " << size << " byte message buffer\n";
+            exit(EXIT_FAILURE);
+        }
+        return result;
+    }
+    static Depot& depot() {
+        static Depot instance;
+        return instance;
+    }
+    static Cache& cache() {
+        static thread_local Cache instance;
+        return instance;
+    }
+    // Half a cache's worth from the depot, or a new buffer if it's empty.
+
+    static void refill(int c, FreeList& list) {
+        list.reserve(depth(c));
+        {
+            Depot& d = depot();
+            std::lock_guard<std::mutex> guard(d.lock);
+            while (!d.free[c].empty() && list.size() < depth(c)/2) {
+                list.push_back(d.free[c].back());
+                d.free[c].pop_back();
+            }
+        }
+        if (list.empty()) list.push_back(allocate(size_t(1) << (c + MIN_SHIFT)));
+    }
+    // Half of a full cache goes back to the depot.
+
+    static void spill(int c, FreeList& list) {
+        Depot& d = depot();
+        std::lock_guard<std::mutex> guard(d.lock);
+        size_t keep = list.size()/2;
+        d.free[c].insert(d.free[c].end(), list.begin() + keep, list.end());
+        list.resize(keep);
+    }
+};
+
+#endif
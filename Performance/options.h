@@ -0,0 +1,60 @@
+/**
+ * Minimal command line option handling for the performance programs.
+ *
+ * The programs take positional parameters (uri nmsg msgsize ...) as before.
+ * Any parameter of the form  --name  or  --name=value  is pulled out as an
+ * option and can appear anywhere on the line.  Everything else is positional.
+ *
+ * Like the rest of this, not production code:  There's no usage checking
+ * beyond what the programs do themselves.
+ */
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdlib.h>
+
+class Options {
+private:
+    std::vector<std::string>           m_positional;
+    std::map<std::string, std::string> m_options;
+public:
+    Options(int argc, char** argv) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg(argv[i]);
+            if (arg.substr(0, 2) == "--") {
+                auto eq = arg.find('=');
+                if (eq == std::string::npos) {
+                    m_options[arg.substr(2)] = "";
+                } else {
+                    m_options[arg.substr(2, eq - 2)] = arg.substr(eq+1);
+                }
+            } else {
+                m_positional.push_back(arg);
+            }
+        }
+    }
+    // Positional parameters (argv[0] is not included).
+
+    const std::vector<std::string>& positional() const { return m_positional; }
+    const std::string& operator[](size_t i) const { return m_positional.at(i); }
+    size_t size() const { return m_positional.size(); }
+
+    // True if --name or --name=anything was given.
+
+    bool flag(const std::string& name) const {
+        return m_options.count(name) > 0;
+    }
+    std::string value(const std::string& name, const std::string& dflt = "") const {
+        auto p = m_options.find(name);
+        return p == m_options.end() ? dflt : p->second;
+    }
+    long number(const std::string& name, long dflt) const {
+        auto p = m_options.find(name);
+        return (p == m_options.end() || p->second.empty()) ? dflt : atol(p->second.c_str());
+    }
+};
+
+#endif
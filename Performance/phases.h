@@ -0,0 +1,242 @@
+/**
+ * Warmup and measurement phases for the timing loops.
+ *
+ * A run goes through a warmup phase (connection setup, TCP slow start, cold caches)
+ * that's not counted, then a measurement phase that is.  Either phase can be ended by
+ * a message count or by a duration.  The thread that drives a run (the pusher, the
+ * requestor) calls PhaseClock::tick() once per message and stops measuring when it
+ * returns DONE.  All timing is steady_clock with ns resolution.
+ *
+ * The measurement phase can optionally be sampled every interval so that throughput over
+ * time can be plotted.  Samples are (ns since the start of measurement, messages in the
+ * interval).  Process CPU time is also taken at the start and end of measurement.
+ *
+ * Options (see PhaseSpec::fromOptions):
+ *    --warmup=n|time   - warmup by message count or for a time e.g. 2s, 500ms.
+ *    --duration=time   - measure for a time rather than nmsg messages.
+ *    --interval=time   - sample the throughput every time.
+ * Times are a number followed by s, ms, us or ns (no suffix means ms).
+ */
+#ifndef PHASES_H
+#define PHASES_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include "options.h"
+#include "record.h"
+
+struct ThroughputSample {
+    uint64_t ns;         // End of the interval, relative to the measurement start.
+    uint64_t messages;   // Messages in the interval.
+};
+
+struct PhaseSpec {
+    uint64_t warmupMessages  = 0;
+    uint64_t warmupNs        = 0;
+    uint64_t measureMessages = 0;
+    uint64_t measureNs       = 0;   // If nonzero, measure by duration.
+    uint64_t intervalNs      = 0;   // If nonzero, sample throughput.
+
+    // Does the clock need to be read on every tick?
+
+    bool timed() const { return warmupNs || measureNs || intervalNs; }
+
+    // Parse a time like 2s, 500ms, 10us, 100ns (no suffix is ms).  Returns ns.
+
+    static uint64_t parseTime(const std::string& value) {
+        char* end;
+        double number = strtod(value.c_str(), &end);
+        std::string unit(end);
+        if (unit == "s")  return number * 1.0e9;
+        if (unit == "us") return number * 1.0e3;
+        if (unit == "ns") return number;
+        return number * 1.0e6;
+    }
+    static bool isTime(const std::string& value) {
+        return !value.empty() && !isdigit(value.back());
+    }
+
+    // Thread i of n's part of the messages:  the first (messages % n) threads do one more.
+
+    PhaseSpec share(uint64_t i, uint64_t n) const {
+        PhaseSpec result(*this);
+        result.warmupMessages  = warmupMessages/n + (i < warmupMessages % n);
+        result.measureMessages = measureMessages/n + (i < measureMessages % n);
+        return result;
+    }
+
+    // Just measure n messages.
+
+    static PhaseSpec count(uint64_t n) {
+        PhaseSpec spec;
+        spec.measureMessages = n;
+        return spec;
+    }
+
+    /**
+     * fromOptions
+     *    @param options - the command line options.
+     *    @param nmsg    - the number of messages to measure if not --duration.
+     */
+    static PhaseSpec fromOptions(const Options& options, uint64_t nmsg) {
+        PhaseSpec spec;
+        std::string warmup = options.value("warmup");
+        if (isTime(warmup)) {
+            spec.warmupNs = parseTime(warmup);
+        } else if (!warmup.empty()) {
+            spec.warmupMessages = atol(warmup.c_str());
+        }
+        std::string duration = options.value("duration");
+        if (!duration.empty()) {
+            spec.measureNs = parseTime(duration);
+        } else {
+            spec.measureMessages = nmsg;
+        }
+        std::string interval = options.value("interval");
+        if (!interval.empty()) {
+            spec.intervalNs = parseTime(interval);
+        }
+        return spec;
+    }
+};
+
+class PhaseClock {
+public:
+    enum Phase { WARMUP, MEASURE, DONE };
+    typedef std::chrono::steady_clock Clock;
+private:
+    PhaseSpec                     m_spec;
+    Phase                         m_phase;
+    uint64_t                      m_count;         // In the current phase.
+    uint64_t                      m_warmupCount;
+    Clock::time_point             m_warmupStart;
+    Clock::time_point             m_measureStart;
+    Clock::time_point             m_measureEnd;
+    Clock::time_point             m_lastSample;
+    uint64_t                      m_lastSampleCount;
+    double                        m_cpuStart;      // Process CPU at the measurement start/end.
+    double                        m_cpuEnd;
+    std::vector<ThroughputSample> m_samples;
+public:
+    PhaseClock(const PhaseSpec& spec) :
+        m_spec(spec), m_phase(WARMUP), m_count(0), m_warmupCount(0), m_lastSampleCount(0),
+        m_cpuStart(0), m_cpuEnd(0) {
+        if (spec.intervalNs && spec.measureNs) {
+            m_samples.reserve(spec.measureNs/spec.intervalNs + 2);
+        }
+    }
+
+    // Begin the run - goes straight to measuring if there's no warmup.
+
+    void start() {
+        m_warmupStart = Clock::now();
+        m_count = 0;
+        m_phase = WARMUP;
+        if (!m_spec.warmupMessages && !m_spec.warmupNs) {
+            beginMeasuring(m_warmupStart);
+        }
+    }
+    // Count one message, returns the phase we're in after it.
+
+    Phase tick() {
+        if (m_phase == DONE) return DONE;
+        m_count++;
+        Clock::time_point now;
+        if (m_spec.timed()) now = Clock::now();
+        if (m_phase == WARMUP) {
+            if ((m_spec.warmupMessages && m_count >= m_spec.warmupMessages) ||
+                (m_spec.warmupNs && elapsed(m_warmupStart, now) >= m_spec.warmupNs)) {
+                beginMeasuring(m_spec.timed() ? now : Clock::now());
+            }
+        } else {
+            if (m_spec.intervalNs && elapsed(m_lastSample, now) >= m_spec.intervalNs) {
+                sample(now);
+            }
+            if ((m_spec.measureMessages && m_count >= m_spec.measureMessages) ||
+                (m_spec.measureNs && elapsed(m_measureStart, now) >= m_spec.measureNs)) {
+                m_measureEnd = m_spec.timed() ? now : Clock::now();
+                m_cpuEnd     = cpuSeconds();
+                if (m_spec.intervalNs && m_count > m_lastSampleCount) sample(m_measureEnd);
+                m_phase = DONE;
+            }
+        }
+        return m_phase;
+    }
+    Phase phase() const { return m_phase; }
+    bool  measuring() const { return m_phase == MEASURE; }
+
+    // Messages counted in the measurement phase:
+
+    uint64_t measured() const { return m_phase == WARMUP ? 0 : m_count; }
+    uint64_t warmedUp() const { return m_phase == WARMUP ? m_count : m_warmupCount; }
+    Clock::time_point measureStart() const { return m_measureStart; }
+    Clock::time_point measureEnd() const { return m_measureEnd; }
+    double seconds() const {
+        return std::chrono::duration<double>(m_measureEnd - m_measureStart).count();
+    }
+    double cpuStart() const { return m_cpuStart; }
+    double cpuEnd() const { return m_cpuEnd; }
+    const std::vector<ThroughputSample>& samples() const { return m_samples; }
+
+    static uint64_t elapsed(Clock::time_point from, Clock::time_point to) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+    }
+private:
+    void beginMeasuring(Clock::time_point now) {
+        m_phase           = MEASURE;
+        m_warmupCount     = m_count;
+        m_count           = 0;
+        m_measureStart    = now;
+        m_lastSample      = now;
+        m_lastSampleCount = 0;
+        m_cpuStart        = cpuSeconds();
+        if (m_spec.measureMessages == 0 && m_spec.measureNs == 0) {
+            m_measureEnd = now;
+            m_cpuEnd     = m_cpuStart;
+            m_phase      = DONE;
+        }
+    }
+    void sample(Clock::time_point now) {
+        m_samples.push_back(ThroughputSample{
+            elapsed(m_measureStart, now), m_count - m_lastSampleCount
+        });
+        m_lastSample      = now;
+        m_lastSampleCount = m_count;
+    }
+};
+
+/**
+ * mergeSamples
+ *    Add the samples of another clock (e.g. another pusher) interval by interval.
+ */
+inline void
+mergeSamples(std::vector<ThroughputSample>& into, const std::vector<ThroughputSample>& from) {
+    if (into.size() < from.size()) into.resize(from.size(), ThroughputSample{0, 0});
+    for (size_t i = 0; i < from.size(); i++) {
+        into[i].ns        = std::max(into[i].ns, from[i].ns);
+        into[i].messages += from[i].messages;
+    }
+}
+
+/**
+ * printSamples
+ *    Output throughput samples as a table:  end of interval (s) and msg/sec.
+ */
+inline void
+printSamples(std::ostream& out, const std::vector<ThroughputSample>& samples) {
+    if (samples.empty()) return;
+    out << "   t(s)        msg/sec\n";
+    uint64_t last(0);
+    for (auto& s : samples) {
+        double dt = (s.ns - last)/1.0e9;
+        out << s.ns/1.0e9 << "  " << (dt > 0 ? s.messages/dt : 0.0) << std::endl;
+        last = s.ns;
+    }
+}
+
+#endif
@@ -6,183 +6,273 @@
  * 4.  THe number of pullers.
  * 
  * Usage:
- *    pipeline uri nmsg msgsize nreceivers
+ *    pipeline uri nmsg msgsize nreceivers [--zerocopy] [--gather] [--pool] [--fixed-recv]
+ *             [--npushers=n] [--reactor[=nthreads]] [--epoll] [--coroutines] [--batch=n]
+ *             [--exact[=control-uri]] [--warmup=n|time] [--duration=time] [--interval=time]
+ *             [--placement=same-core|same-socket|cross-socket|all] [--pusher-cpus=spec,...]
+ *             [--puller-cpus=spec,...] [--buffer-node=n] [--format=text|csv|json]
  * Where:
  *    * uri - is the uri the pusher listens on and pullers connect to.
- *    * nmsg - is the number of messages sent.
+ *    * nmsg - is the number of messages sent in the measurement phase.
  *    * msgsize - is the size of each message.
  *    * mreceivers - Is the number of receivers.
+ *    * --zerocopy - Time the pipeline twice; once copying from a user buffer and once
+ *      sending nn_allocmsg chunks with NN_MSG (see chunkpool.h).  The two sets of
+ *      timings are output side by side.
+ *    * --gather - Also time sending a small header and a separate payload (see framing.h):
+ *      concat copies them into one buffer for nn_send, gather sends them as two
+ *      nn_iovecs with nn_sendmsg.  The pullers receive into a header and payload buffer,
+ *      concat by nn_recv and copying out, gather by nn_recvmsg into two iovecs.
+ *    * --pool - Also time sending each message from a buffer taken from a size classed,
+ *      per thread cached MessagePool (msgpool.h) and receiving by nn_recv into one.
+ *    * --fixed-recv - Also time the copy and zero copy modes with the pullers receiving into
+ *      one preallocated buffer of msgsize that's reused for every message (see framing.h)
+ *      rather than taking nanomsg's chunk and freeing it.  A message that doesn't fit is
+ *      an error rather than being truncated.  Not for coroutine pullers or --exact.
+ *    * --npushers=n - Fan in/fan out topology.  Each puller binds an NN_PULL collector
+ *      and n pusher threads, each with its own NN_PUSH socket, connect to all of the
+ *      collectors.  If there's more than one receiver the uri must have a %d in it which
+ *      is replaced by the puller number (as in bus.cpp).  Without this option there's one
+ *      bound pusher on the main thread that the pullers connect to.
+ *    * --reactor - Also time the pullers' sockets served by nthreads (default 4) reactor
+ *      threads rather than a thread each.  Each reactor nn_polls its share of the sockets
+ *      and drains every readable one with NN_DONTWAIT, up to --batch (default 64) messages
+ *      at a time, before polling again.  Timed side by side with a thread per socket.
+ *    * --epoll - Also time the reactors waiting with an epoll EventLoop (../eventloop.h) on
+ *      the sockets' NN_RCVFD descriptors instead of nn_poll.  Implies --reactor.
+ *    * --coroutines - Also time a coroutine per puller socket (../nncoro.h), the coroutines
+ *      spread over the reactor threads.  Run with many pullers (e.g. 1000) to compare the
+ *      memory used per puller with a thread each;  the report's Mem KB line is the growth
+ *      in resident memory from starting the pullers.  Coroutines always receive nanomsg's
+ *      chunk (NN_MSG) so they're only timed with the copy and zero copy send modes.
+ * 
+ *    * --exact - Exact count mode.  Exactly nmsg messages (after any warmup) are sent with blocking sends
+ *      and 64 bit sequence numbers.  Termination uses an out of band control channel:
+ *      a surveyor bound on the control-uri (see controlUri for the default) that the
+ *      pullers respond to with the number of messages they've received.  The run is
+ *      timed until everything sent is accounted for.
+ * 
+ *    * --warmup - Send n messages (or send for a time e.g. 2s) before measuring.
+ *    * --duration - Measure for a time rather than for nmsg messages.
+ *    * --interval - Sample the throughput every interval (e.g. 100ms) of the measurement
+ *      phase and output msg/sec over time (see phases.h).
+ * 
+ *    * --placement - Pin the pusher(s) and pullers in a layout built from the machine
+ *      topology (see affinity.h).  all times every layout this machine has in turn.
+ *    * --pusher-cpus, --puller-cpus - Pin each pusher/puller (round robin) to a CPU (3),
+ *      range of CPUs (0-3) or NUMA node (node1).  These override --placement.
+ *    * --buffer-node - Allocate message buffers on this NUMA node.
+ * 
+ *    * --format - text (default) is the human readable output described below.  csv and
+ *      json output one record per timed run (see record.h).
+ * 
+ * Only the measurement phase is timed (ns resolution steady clock).
+ * Aggregate timings are output as well as msg/sec for each pusher and each puller.
  * 
  * Each receiver is a thread.  Because of the way messages are distributed
  * to each puller we can't reliably do the terminate message game.
- * See pullThread.
+ * See pullThread.  This means that, without --exact, the number of messages
+ * counted includes messages that were queued but dropped at shutdown.
+ * --exact also outputs the number sent, delivered, lost and the load balance skew
+ * among the pullers.
 */
-#include <thread>
-#include <nanomsg/nn.h>
-#include <nanomsg/pipeline.h>
 #include <stdlib.h>
 #include <iostream>
-#include <stdlib.h>
-#include <unistd.h>
+#include <iomanip>
 #include <string>
-#include <string.h>
-#include <latch>
-#include <chrono>
 #include <vector>
+#include <algorithm>
+#include "options.h"
+#include "pipelinebench.h"
+#include "record.h"
 
-// Useful error checking method:
-// Returns int since e.g. socket returns the socket on ok.
-static int
-checkstat(int status, const char* msg) {
-    if (status < 0) {
-        std::cerr << msg << nn_strerror(nn_errno()) << std::endl;
-        exit(EXIT_FAILURE);
+// Output the exact mode accounting.
+
+static void
+reportExact(const std::vector<PipelineResult>& results) {
+    std::cout << "Sent      : ";
+    for (auto& r : results) std::cout << std::setw(14) << r.sent << "  ";
+    std::cout << std::endl;
+    std::cout << "Delivered : ";
+    for (auto& r : results) std::cout << std::setw(14) << r.delivered << "  ";
+    std::cout << std::endl;
+    std::cout << "Lost      : ";
+    for (auto& r : results) std::cout << std::setw(14) << (long)(r.sent - r.delivered) << "  ";
+    std::cout << std::endl;
+    std::cout << "Reordered : ";
+    for (auto& r : results) std::cout << std::setw(14) << r.reordered << "  ";
+    std::cout << std::endl;
+
+    // Skew is (max - min)/mean of the per puller counts; 0 is perfectly balanced.
+
+    std::cout << "Skew      : ";
+    for (auto& r : results) {
+        auto mm = std::minmax_element(r.pulled.begin(), r.pulled.end());
+        double mean = (double)r.delivered/r.pulled.size();
+        std::cout << std::setw(14) << (mean > 0 ? (*mm.second - *mm.first)/mean : 0.0) << "  ";
     }
-    return status;
+    std::cout << std::endl;
 }
+// Output one line of per thread rates for each run.
+// The pullers' counts include the warmup so their rates are their share of the measured total.
 
-
+static void
+reportThreads(const char* label, const std::vector<PipelineResult>& results, bool pushers) {
+    size_t n = pushers ? results[0].pushed.size() : results[0].pulled.size();
+    for (int i = 0; i < n; i++) {
+        std::cout << label << std::setw(4) << i << " msg/sec : ";
+        for (auto& r : results) {
+            double count = pushers ? r.pushed[i] : 0.0;
+            if (!pushers) {
+                size_t pulled(0);
+                for (auto n : r.pulled) pulled += n;
+                count = pulled ? (double)r.pulled[i] * r.sent/pulled : 0.0;
+            }
+            std::cout << std::setw(14) << count/r.seconds << "  ";
+        }
+        std::cout << std::endl;
+    }
+}
 /**
- * pull thread:
- * 
- * @param uri - string that containst he URI of the pusher.
- * @param nmsg - The base number of messages - once we see a messages
- *    with a sequence bigger than this we're done.
- * @param ready - pointer to a latch that is decremented by us when we are
- * ready to recieve data.  The pusher waits for all pullers to be ready
- * before actually starting to time and send messages.
- * @param finished - pointer to a latch we arrive at when we're done
- *     getting messages and have shut down our socket.  The pusher
- *     sends messages until wait_for on finished is true.
- * 
+ * report
+ *    Output the text report of a set of runs (copy and any of zerocopy, concat, gather) side by side.
  */
 static void
-pullThread(std::string uri, size_t nmsg, std::latch* ready,  std::latch* finished) {
-    int socket = checkstat(
-        nn_socket(AF_SP, NN_PULL),
-        "Puller failed to open socket"
-    );
-    int endpoint = checkstat(
-        nn_connect(socket, uri.c_str()),
-        "Puller failed to connect to pusher."
-    );
-    
-    uint32_t* msgBuf;
-    bool done(false);
-    ready->count_down();     // This thread is ready...
-
-    // Start receving messages.
-
-    while(!done) {
-        msgBuf = nullptr;
-        checkstat(
-            nn_recv(socket, &msgBuf, NN_MSG, 0),
-            "Failed to  pull a message"
-        );
-        done = msgBuf[0] >= nmsg;
-        nn_freemsg(msgBuf);
+report(const std::vector<PipelineConfig>& configs, const std::vector<PipelineResult>& results) {
+    bool   exact   = configs[0].exact;
+    size_t msgsize = configs[0].msgsize;
+    if (!configs[0].placement.name.empty()) {
+        std::cout << "Placement: " << configs[0].placement.name << std::endl;
+    }
+    if (results.size() > 1) {
+        std::cout << "          ";
+        for (auto& c : configs) std::cout << std::setw(14) << pipelineMode(c) << "  ";
+        std::cout << std::endl;
     }
+    std::cout << "Time    : ";
+    for (auto& r : results) {
+        std::cout << std::setw(14) << r.seconds << "  ";
+    }
+    std::cout << std::endl;
+    // In exact mode the rates are for what was actually delivered after the warmup.
 
-    
-    finished->arrive_and_wait();     // Otherwise pushes hang >sigh<
-    checkstat(nn_shutdown(socket, endpoint), "Puller failed shutdown");
-    checkstat(nn_close(socket), "Puller failed close");
-}
-/// Pushes the messages once all is set up
-// Returns the number of messages sent before everyone was doe.
-static size_t  
-pusher(int socket, size_t msgSize,  std::latch& done) {
-    char* msg = new char[msgSize];     // Use the same message buffer.
-    uint32_t* seq = reinterpret_cast<uint32_t*>(msg);
-    *seq = 0;
-    size_t result(0);
-    while(! done.try_wait()) {
-        int stat =  nn_send(socket, msg, msgSize, NN_DONTWAIT);
-        if (stat > 0) {    
-            *seq += 1;               // Only count what we can send.
-            result++;
-        } else if (nn_errno() != EAGAIN) {
-            checkstat(stat, "Pusher failed to send message");
+    std::cout << "msg/sec : ";
+    for (auto& r : results) {
+        size_t n = exact ? r.delivered - std::min(r.delivered, r.warmup) : r.sent;
+        std::cout << std::setw(14) << (double)n/r.seconds << "  ";
+    }
+    std::cout << std::endl;
+    std::cout << "Kb/sec  : ";
+    for (auto& r : results) {
+        size_t n = exact ? r.delivered - std::min(r.delivered, r.warmup) : r.sent;
+        std::cout << std::setw(14) << (double)(n * msgsize)/(r.seconds * 1024.0) << "  ";   // kb/sec
+    }
+    std::cout << std::endl;
+    if (!exact) {
+        std::cout << "Ctx sw  : ";              // Context switches while pushing.
+        for (auto& r : results) std::cout << std::setw(14) << r.contextSwitches << "  ";
+        std::cout << std::endl;
+        std::cout << "Allocs  : ";              // Allocator calls per message sent.
+        for (auto& r : results) {
+            std::cout << std::setw(14) << (double)r.allocatorCalls/(r.sent + r.warmup) << "  ";
+        }
+        std::cout << std::endl;
+    }
+    std::cout << "Mem KB  : ";                  // Resident growth starting the pullers.
+    for (auto& r : results) std::cout << std::setw(14) << r.memoryKb << "  ";
+    std::cout << std::endl;
+    std::cout << "KB/pull : ";
+    for (auto& r : results) std::cout << std::setw(14) << (double)r.memoryKb/r.pulled.size() << "  ";
+    std::cout << std::endl;
+    if (exact) {
+        reportExact(results);
+    }
+    reportThreads("pusher", results, true);
+    reportThreads("puller", results, false);
+    for (int i = 0; i < results.size(); i++) {
+        if (!results[i].samples.empty()) {
+            std::cout << pipelineMode(configs[i]) << " throughput:\n";
+            printSamples(std::cout, results[i].samples);
         }
-        // else just blocked.
     }
-    delete []msg;
-    return result;
-    
 }
 // entry point
 
 int main(int argc, char** argv) {
     // Get the program parameters.
 
-    std::string uri(argv[1]);
-    size_t nmsg = atoi(argv[2]);
-    size_t msgsize = atoi(argv[3]);
-    size_t nreceivers = atoi(argv[4]);
-
-
-    // Set up the pull side of things.
-
-    int socket = checkstat(
-        nn_socket(AF_SP, NN_PUSH),
-        "Failed to create push sockket"
-    );
-    int endpoint = checkstat(
-        nn_bind(socket, uri.c_str()),
-        "Failed to bind push socket."
-    );
-
-    std::latch allready(nreceivers);    // So we know when all the receivers are ready to go.
-    std::latch alldone(nreceivers);     // So we know when to join.
-    std::vector<std::thread*> receivers;
-
-    for (int i =0; i < nreceivers; i++) {
-        receivers.push_back(new std::thread(pullThread, uri, nmsg, &allready, &alldone));
+    Options options(argc, argv);
+    PipelineConfig config;
+    config.uri        = options[0];
+    config.nmsg       = atoi(options[1].c_str());
+    config.msgsize    = atoi(options[2].c_str());
+    config.nreceivers = atoi(options[3].c_str());
+    config.npushers   = options.number("npushers", 0);
+    config.exact      = options.flag("exact");
+    config.ctlUri     = options.value("exact");
+    config.phases     = PhaseSpec::fromOptions(options, config.nmsg);
+    auto modes        = requestedModes(options);
+    auto recvModes    = requestedRecvModes(options);
+    if (config.exact &&
+        (options.flag("reactor") || options.flag("epoll") || options.flag("coroutines"))) {
+        std::cerr << "The exact count mode has its own pullers;  --reactor, --epoll and "
+                  << "--coroutines can't be used with it\n";
+        exit(EXIT_FAILURE);
     }
-
-    // Wait for the to all startt:
-
-    allready.wait();
-
-    ///////////////////////////////////// timed
-    auto start = std::chrono::high_resolution_clock::now();
-    nmsg = pusher(socket, msgsize, alldone);            // Actual number of messagse.
-    // Join the threads so we know they're done
-
-    for (auto p : receivers) {
-        p->join();
+    if (config.exact && options.flag("fixed-recv")) {
+        std::cerr << "The exact count mode's pullers take nanomsg's chunk;  --fixed-recv can't "
+                  << "be used with it\n";
+        exit(EXIT_FAILURE);
     }
-    auto end = std::chrono::high_resolution_clock::now();
-    ////////////////////////////////////// timed
-
-    // Clean up everything
-
-    for (auto p : receivers) {
-        delete p;
-
+    std::vector<PullerKind> kinds = {PullerKind::THREAD};
+    if (options.flag("reactor") || options.flag("epoll")) {    // --epoll implies --reactor.
+        kinds.push_back(PullerKind::POLL);
     }
-    receivers.clear();
-    checkstat(
-        nn_shutdown(socket, endpoint),
-        "Pusher failed shutdown"
-    );
-    checkstat(
-        nn_close(socket),
-        "Pusher failed socket close"
-    );
-
-    // publish the timings
+    if (options.flag("epoll"))      kinds.push_back(PullerKind::EPOLL);
+    if (options.flag("coroutines")) kinds.push_back(PullerKind::COROUTINE);
+    config.reactors   = options.number("reactor", 4);
+    config.batch      = options.number("batch", 64);
+    OutputFormat format = parseFormat(options.value("format"));
+    RecordWriter* writer = format == OutputFormat::TEXT ? nullptr : new RecordWriter(std::cout, format);
 
-    auto duration = end - start;
-    double timing = (double)std::chrono::duration_cast<std::chrono::milliseconds>(duration).count()/1000.0;
-    double msgTiming =(double)nmsg/timing;
-    double xferRate = (double)(nmsg * msgsize)/(timing * 1024.0);   // kb/sec
+    // Each placement in turn (usually just one).  Always time the copy case;
+    // with --zerocopy and --gather time those modes too.  With --reactor/--epoll/--coroutines
+    // each is timed with a thread per puller socket and then with each kind of reactor.
+    // --fixed-recv adds fixed buffer receives wherever the pullers would take chunks.
 
+    for (auto& layout : Placement::requested(options)) {
+        config.placement = Placement::fromOptions(
+            options, layout, "pusher", "puller",
+            config.npushers ? config.npushers : 1, config.nreceivers
+        );
+        std::vector<PipelineResult> results;
+        std::vector<PipelineConfig> configs;
+        for (auto mode : modes) {
+            for (auto recv : recvModes) {
+                for (auto kind : kinds) {
+                    if (recv == RecvMode::FIXED && !receivesChunks(mode)) continue;
+                    if (kind == PullerKind::COROUTINE &&
+                        (!receivesChunks(mode) || recv == RecvMode::FIXED)) continue;
+                    configs.push_back(config);
+                    configs.back().mode    = mode;
+                    configs.back().recv    = recv;
+                    configs.back().pullers = kind;
+                }
+            }
+        }
+        for (auto& c : configs) {
+            results.push_back(runPipeline(c));
+        }
 
-    std::cout << "Time    : " << timing << std::endl;
-    std::cout << "msg/sec : " << msgTiming << std::endl;
-    std::cout << "Kb/sec  : " << xferRate << std::endl;
-
+        if (writer) {
+            for (int i = 0; i < results.size(); i++) {
+                writer->write(pipelineRecord(configs[i], results[i]));
+            }
+        } else {
+            report(configs, results);
+        }
+    }
+    delete writer;
 
     return EXIT_SUCCESS;
 }
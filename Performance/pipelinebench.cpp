@@ -0,0 +1,1177 @@
+/**
+ * The push/pull timing code.  This is used by the pipeline program and
+ * the sweep driver.  See pipeline.cpp for a description of the topologies and modes.
+ */
+#include <thread>
+#include <nanomsg/nn.h>
+#include <nanomsg/pipeline.h>
+#include <nanomsg/survey.h>
+#include <stdlib.h>
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <string.h>
+#include <latch>
+#include <chrono>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include "pipelinebench.h"
+#include "chunkpool.h"
+#include "framing.h"
+#include "../eventloop.h"
+#include "../nncoro.h"
+#include "record.h"
+#include "msgpool.h"
+#include "allocount.h"
+#include "../nnpp.h"
+
+/**
+ * Generate uris
+ *   Given the uri template and the number of pullers returns a vector of strings that are
+ * the URIs the pullers bind to in the fan in topology.  Element i is for puller i.
+ */
+static std::vector<std::string>
+generateUris(const std::string& base, size_t size) {
+    if (size > 1 && base.find("%d") == std::string::npos) {
+        std::cerr << "The URI must contain a %d when there are several collectors\n";
+        exit(EXIT_FAILURE);
+    }
+    std::vector<std::string> result;
+    const char* format = base.c_str();     // For snprintf.
+    char  uriBuffer[100];                  // sb big enough.
+    for (int i =0; i < size; i++)  {
+        int nchars = snprintf(uriBuffer, sizeof(uriBuffer), format, i);
+        if (nchars >= sizeof(uriBuffer)) {
+            std::cerr << "URI Buffer overflow in generateUris\n";
+            exit(EXIT_FAILURE);
+        }
+        result.push_back(std::string(uriBuffer));
+    }
+
+    return result;
+}
+
+// The pusher sets the sequence to this once it's done measuring.  Each puller
+// stops when it gets one.
+
+static const uint32_t STOP_SEQ = 0xffffffff;
+
+/**
+ * PullBuffers
+ *    What a puller receives into:  its own header/payload buffers (framed modes),
+ * MessagePool buffers (POOLED), one reused FixedBuffer (FIXED receives, see framing.h)
+ * or, with none of those, nanomsg's chunk.
+ */
+struct PullBuffers {
+    FramedMessage* frame;
+    size_t         pooled;         // Message size for pooled receives, 0 for none.
+    FixedBuffer*   fixed;
+
+    PullBuffers(SendMode mode, RecvMode recvMode, size_t msgsize) :
+        frame(isFramed(mode) ? new FramedMessage(msgsize, mode == SendMode::GATHER) : nullptr),
+        pooled(mode == SendMode::POOLED ? msgsize : 0),
+        fixed(recvMode == RecvMode::FIXED && receivesChunks(mode) ? new FixedBuffer(msgsize) : nullptr) {}
+    ~PullBuffers() {
+        delete frame;
+        delete fixed;
+    }
+    PullBuffers(const PullBuffers&) = delete;
+    PullBuffers& operator=(const PullBuffers&) = delete;
+};
+
+/**
+ * pullMessage
+ *    Receive one message into buffers.
+ * 
+ * @param socket - pull socket.
+ * @param buffers - Where it goes.
+ * @param flags  - nn_recv flags e.g. NN_DONTWAIT.
+ * @param[out] stop - Set true if this is a stop message.
+ * @return what nn_recv/nn_recvmsg returned (-1/EMSGSIZE if a fixed receive was truncated).
+ */
+static int
+pullMessage(int socket, PullBuffers& buffers, int flags, bool& stop) {
+    if (buffers.frame) {
+        int n = buffers.frame->recv(socket, flags);
+        if (n >= 0) stop = *reinterpret_cast<uint32_t*>(buffers.frame->header()) == STOP_SEQ;
+        return n;
+    }
+    if (buffers.pooled) {
+        void* buffer = MessagePool::get(buffers.pooled);
+        int n = nn_recv(socket, buffer, MessagePool::capacity(buffers.pooled), flags);
+        if (n >= 0) stop = *static_cast<uint32_t*>(buffer) == STOP_SEQ;
+        MessagePool::put(buffer, buffers.pooled);
+        return n;
+    }
+    if (buffers.fixed) {
+        int n = buffers.fixed->recv(socket, flags);
+        if (n >= 0) stop = *reinterpret_cast<const uint32_t*>(buffers.fixed->data()) == STOP_SEQ;
+        return n;
+    }
+    uint32_t* msgBuf(nullptr);
+    int n = nn_recv(socket, &msgBuf, NN_MSG, flags);
+    if (n >= 0) {
+        stop = msgBuf[0] == STOP_SEQ;
+        nn_freemsg(msgBuf);
+    }
+    return n;
+}
+
+/**
+ * pull thread:
+ * 
+ * @param uri - string that containst he URI of the pusher.
+ * @param ready - pointer to a latch that is decremented by us when we are
+ * ready to recieve data.  The pusher waits for all pullers to be ready
+ * before actually starting to time and send messages.
+ * @param finished - pointer to a latch we arrive at when we're done
+ *     getting messages and have shut down our socket.  The pusher
+ *     sends messages until wait_for on finished is true.
+ * @param received - Receives the number of messages we pulled.
+ * @param bind - if true we are a collector that binds to the uri rather
+ *     than connecting to it.
+ * @param placement - CPUs/NUMA node for this thread.
+ * @param mode - With CONCAT/GATHER, receive into our own header/payload buffers
+ *     (see framing.h) and with POOLED into pool buffers rather than taking nanomsg's chunk.
+ * @param recvMode - With FIXED, copy and zero copy messages are received into one
+ *     reused buffer instead of taking nanomsg's chunk.
+ * @param msgsize - Size of the messages (and so of our buffers).
+ * 
+ */
+static void
+pullThread(
+    std::string uri, std::latch* ready,  std::latch* finished,
+    size_t* received, bool bind, ThreadPlacement placement, SendMode mode, RecvMode recvMode,
+    size_t msgsize
+) {
+    placement.apply();
+    Socket puller(AF_SP, NN_PULL, "Puller failed to open socket");
+    Endpoint endpoint = bind ? puller.bind(uri, "Puller failed to connect to pusher.") :
+                               puller.connect(uri, "Puller failed to connect to pusher.");
+    int socket = puller.fd();
+    size_t nReceived(0);
+    
+    bool done(false);
+    PullBuffers buffers(mode, recvMode, msgsize);
+    ready->count_down();     // This thread is ready...
+
+    // Start receving messages.
+
+    while(!done) {
+        checkstat(
+            pullMessage(socket, buffers, 0, done),
+            "Failed to  pull a message"
+        );
+        nReceived++;
+    }
+    *received = nReceived;
+
+    
+    finished->arrive_and_wait();     // Otherwise pushes hang >sigh<
+    endpoint.shutdown("Puller failed shutdown");
+    puller.close("Puller failed close");
+}
+/**
+ * drainSocket
+ *    Take up to batch messages from a readable socket without waiting.
+ * 
+ * @param socket - pull socket.
+ * @param buffers - What we receive into (see pullMessage).
+ * @param batch  - Most messages to take.
+ * @param[inout] count - Incremented for each message.
+ * @param[out] done - Set true if we got a stop message.
+ * @return true if the batch ran out before the socket did (there may be more).
+ */
+static bool
+drainSocket(
+    int socket, PullBuffers& buffers, size_t batch, size_t& count, bool& done
+) {
+    for (size_t n = 0; n < batch && !done; n++) {
+        int stat = pullMessage(socket, buffers, NN_DONTWAIT, done);
+        if (stat < 0) {
+            if (nn_errno() == EAGAIN) return false;
+            checkstat(stat, "Reactor failed to pull a message");
+        }
+        count++;
+    }
+    return !done;
+}
+
+/**
+ * pullTask
+ *    pullThread as a coroutine (see ../nncoro.h):  receives from socket until the
+ * stop message, suspending rather than blocking when there's nothing to receive.
+ * Always takes nanomsg's chunk.
+ * 
+ * @param executor - Runs us.
+ * @param socket - pull socket.
+ * @param received - Our count.
+ * @param finished - Counted down when we stop.
+ */
+static Task
+pullTask(Executor& executor, int socket, size_t* received, std::latch* finished) {
+    bool done(false);
+    while (!done) {
+        uint32_t* msgBuf(nullptr);
+        checkstat(
+            co_await asyncRecv(executor, socket, &msgBuf, NN_MSG),
+            "Coroutine failed to pull a message"
+        );
+        done = msgBuf[0] == STOP_SEQ;
+        nn_freemsg(msgBuf);
+        (*received)++;
+    }
+    finished->count_down();
+    executor.forget(socket);
+}
+
+/**
+ * reactorThread
+ *    Serves several pull sockets from one thread.  nn_poll (POLL) or an EventLoop
+ * (EPOLL, see ../eventloop.h) waits for any of them to be readable and each readable
+ * socket is drained with NN_DONTWAIT, up to batch messages at a time so one busy socket
+ * can't starve the others, before waiting again.  A socket that gets a stop message
+ * is no longer waited on and counts down finished.  COROUTINE instead runs a pullTask
+ * per socket on an Executor.  As with pullThread the sockets are only shut down once
+ * every puller is done.
+ * 
+ * @param uris - One per socket we serve.
+ * @param received - Where each socket's count goes.
+ * @param ready - Counted down once per socket when they're all set up.
+ * @param finished - Counted down once per socket as it stops;  we then wait for it.
+ * @param bind - Bind rather than connect (fan in collectors).
+ * @param placement - CPUs/NUMA node for this thread.
+ * @param mode, recvMode - As for pullThread (one set of buffers serves all sockets).
+ * @param msgsize - Size of the messages.
+ * @param batch - Most messages taken from one socket per poll.
+ * @param kind - POLL, EPOLL or COROUTINE.
+ */
+static void
+reactorThread(
+    std::vector<std::string> uris, std::vector<size_t*> received, std::latch* ready,
+    std::latch* finished, bool bind, ThreadPlacement placement, SendMode mode, RecvMode recvMode,
+    size_t msgsize, size_t batch, PullerKind kind
+) {
+    placement.apply();
+    std::vector<Socket> sockets;
+    std::vector<Endpoint> endpoints;
+    std::vector<nn_pollfd> pollers;
+    std::vector<size_t> owner;             // pollers[i] is for sockets[owner[i]].
+    for (int i = 0; i < uris.size(); i++) {
+        Socket socket(AF_SP, NN_PULL, "Reactor failed to open socket");
+        endpoints.push_back(bind ? socket.bind(uris[i], "Reactor failed to connect to pusher.") :
+                                   socket.connect(uris[i], "Reactor failed to connect to pusher."));
+        pollers.push_back(nn_pollfd{socket.fd(), NN_POLLIN, 0});
+        sockets.push_back(std::move(socket));
+        owner.push_back(i);
+        *received[i] = 0;
+    }
+    PullBuffers buffers(mode, recvMode, msgsize);
+    ready->count_down(sockets.size());
+
+    if (kind == PullerKind::COROUTINE) {
+        Executor executor;
+        for (int i = 0; i < sockets.size(); i++) {
+            executor.spawn(pullTask(executor, sockets[i].fd(), received[i], finished));
+        }
+        executor.run();                    // Until every task has its stop message.
+    } else if (kind == PullerKind::EPOLL) {
+        EventLoop loop;
+        for (int i = 0; i < sockets.size(); i++) {
+            loop.onReadable(sockets[i].fd(), [&, i](int socket) {
+                bool done(false);
+                bool more = drainSocket(socket, buffers, batch, *received[i], done);
+                if (done) {
+                    finished->count_down();
+                    loop.remove(socket);
+                }
+                return more;
+            });
+        }
+        loop.run();                        // Until every socket is removed.
+    } else {
+        while (!pollers.empty()) {
+            int nfds = nn_poll(pollers.data(), pollers.size(), -1);
+            if (nfds < 0) {
+                if (nn_errno() == EINTR) continue;
+                checkstat(nfds, "Reactor failed to poll");
+            }
+            for (size_t i = 0; i < pollers.size(); ) {
+                bool done(false);
+                if (pollers[i].revents & NN_POLLIN) {
+                    drainSocket(pollers[i].fd, buffers, batch, *received[owner[i]], done);
+                }
+                if (done) {                    // Swap in the last one and look at it next.
+                    finished->count_down();
+                    pollers[i] = pollers.back();
+                    owner[i]   = owner.back();
+                    pollers.pop_back();
+                    owner.pop_back();
+                } else {
+                    i++;
+                }
+            }
+        }
+    }
+
+    finished->wait();
+    for (int i = 0; i < sockets.size(); i++) {
+        endpoints[i].shutdown("Reactor failed shutdown");
+        sockets[i].close("Reactor failed close");
+    }
+}
+
+/**
+ * startPullers
+ *    Start the pullers for uris (one socket per uri) - a pullThread per socket or
+ * reactors reactorThreads sharing the sockets round robin.
+ * 
+ * @param uris - URI of each socket.
+ * @param bind - Pullers bind rather than connect.
+ * @param kind - How the sockets are served.
+ * @param reactors - Reactor threads (unless kind is THREAD).
+ * @param batch - Reactor drain batch.
+ * @param ready, finished - The pullers' latches, nreceivers each.
+ * @param[out] pulled - Per socket counts, must be sized to uris.
+ * @param placement - Receiver i is puller thread i.
+ * @param mode, recvMode, msgsize - How messages are sent/received.
+ * @return the threads.
+ */
+static std::vector<std::thread*>
+startPullers(
+    const std::vector<std::string>& uris, bool bind, PullerKind kind, size_t reactors, size_t batch,
+    std::latch* ready, std::latch* finished, std::vector<size_t>& pulled,
+    const Placement& placement, SendMode mode, RecvMode recvMode, size_t msgsize
+) {
+    std::vector<std::thread*> result;
+    if (kind == PullerKind::THREAD) {
+        for (int i = 0; i < uris.size(); i++) {
+            result.push_back(new std::thread(
+                pullThread, uris[i], ready, finished, &pulled[i], bind, placement.receiver(i),
+                mode, recvMode, msgsize
+            ));
+        }
+        return result;
+    }
+    reactors = std::max(size_t(1), std::min(reactors, uris.size()));
+    for (int t = 0; t < reactors; t++) {
+        std::vector<std::string> ours;
+        std::vector<size_t*> counts;
+        for (int i = t; i < uris.size(); i += reactors) {
+            ours.push_back(uris[i]);
+            counts.push_back(&pulled[i]);
+        }
+        result.push_back(new std::thread(
+            reactorThread, ours, counts, ready, finished, bind, placement.receiver(t),
+            mode, recvMode, msgsize, batch, kind
+        ));
+    }
+    return result;
+}
+
+/// Pushes the messages once all is set up
+// The clock decides when warmup and measurement are over - after that we send
+// STOP_SEQ until all the pullers are done.
+static void
+pusher(int socket, size_t msgSize, std::latch& done, PhaseClock& clock) {
+    char* msg = new char[msgSize];     // Use the same message buffer.
+    uint32_t* seq = reinterpret_cast<uint32_t*>(msg);
+    *seq = 0;
+    clock.start();
+    while(! done.try_wait()) {
+        int stat =  nn_send(socket, msg, msgSize, NN_DONTWAIT);
+        if (stat > 0) {              // Only count what we can send.
+            if (*seq != STOP_SEQ) {
+                *seq = clock.tick() == PhaseClock::DONE ? STOP_SEQ : *seq + 1;
+            }
+        } else if (nn_errno() != EAGAIN) {
+            checkstat(stat, "Pusher failed to send message");
+        }
+        // else just blocked.
+    }
+    delete []msg;
+}
+/// Zero copy version of the pusher.
+// Each message is a chunk from the pool that nanomsg takes ownership of.
+static void
+zeroCopyPusher(int socket, size_t msgSize, std::latch& done, PhaseClock& clock) {
+    ChunkPool pool(msgSize, ChunkPool::depthFor(msgSize));
+    uint32_t seq(0);
+    clock.start();
+    while (! done.try_wait()) {
+        void* chunk = pool.get();
+        *reinterpret_cast<uint32_t*>(chunk) = seq;
+        void* msg = chunk;             // nn_send wants a pointer to the pointer.
+        int stat = nn_send(socket, &msg, NN_MSG, NN_DONTWAIT);
+        if (stat > 0) {                // Nanomsg owns the chunk now.
+            if (seq != STOP_SEQ) {
+                seq = clock.tick() == PhaseClock::DONE ? STOP_SEQ : seq + 1;
+            }
+        } else {
+            pool.putBack(chunk);       // Still ours so recycle it.
+            if (nn_errno() != EAGAIN) {
+                checkstat(stat, "Pusher failed to send zero copy message");
+            }
+        }
+    }
+}
+/// Pooled version of the pusher.
+// Each message is built in a buffer from the MessagePool that nn_send copies.
+static void
+pooledPusher(int socket, size_t msgSize, std::latch& done, PhaseClock& clock) {
+    uint32_t seq(0);
+    clock.start();
+    while (! done.try_wait()) {
+        void* msg = MessagePool::get(msgSize);
+        *reinterpret_cast<uint32_t*>(msg) = seq;
+        int stat = nn_send(socket, msg, msgSize, NN_DONTWAIT);
+        MessagePool::put(msg, msgSize);
+        if (stat > 0) {
+            if (seq != STOP_SEQ) {
+                seq = clock.tick() == PhaseClock::DONE ? STOP_SEQ : seq + 1;
+            }
+        } else if (nn_errno() != EAGAIN) {
+            checkstat(stat, "Pusher failed to send pooled message");
+        }
+    }
+}
+/// Header + payload version of the pusher (CONCAT or GATHER, see framing.h).
+// The sequence is at the start of the header.
+static void
+framedPusher(int socket, size_t msgSize, bool gather, std::latch& done, PhaseClock& clock) {
+    FramedMessage msg(msgSize, gather);
+    uint32_t* seq = reinterpret_cast<uint32_t*>(msg.header());
+    *seq = 0;
+    clock.start();
+    while (! done.try_wait()) {
+        int stat = msg.send(socket, NN_DONTWAIT);
+        if (stat > 0) {
+            if (*seq != STOP_SEQ) {
+                *seq = clock.tick() == PhaseClock::DONE ? STOP_SEQ : *seq + 1;
+            }
+        } else if (nn_errno() != EAGAIN) {
+            checkstat(stat, "Pusher failed to send framed message");
+        }
+    }
+}
+// Push with the pusher for a send mode.
+
+static void
+push(int socket, size_t msgSize, SendMode mode, std::latch& done, PhaseClock& clock) {
+    switch (mode) {
+        case SendMode::ZEROCOPY:
+            zeroCopyPusher(socket, msgSize, done, clock);
+            break;
+        case SendMode::CONCAT:
+        case SendMode::GATHER:
+            framedPusher(socket, msgSize, mode == SendMode::GATHER, done, clock);
+            break;
+        case SendMode::POOLED:
+            pooledPusher(socket, msgSize, done, clock);
+            break;
+        default:
+            pusher(socket, msgSize, done, clock);
+    }
+}
+
+/**
+ * timePipeline
+ *    Starts the pullers, pushes messages until they're all done and
+ * times the measurement phase of that.
+ * 
+ * @param socket - bound push socket.
+ * @param uri    - URI the pullers connect to.
+ * @param phases - Warmup and measurement phases.
+ * @param msgsize - size of each message.
+ * @param nreceivers - Number of puller threads.
+ * @param mode - How messages are sent (and, if framed or pooled, received).
+ * @param recvMode - How the pullers receive copy and zero copy messages.
+ * @param placement - Where the pusher (this thread while pushing) and pullers run.
+ * @param pullers - How the puller sockets are served.
+ * @param reactors - Reactor threads serving them (unless pullers is THREAD).
+ * @param batch - Reactor drain batch.
+ * @return PipelineResult
+ */
+static PipelineResult
+timePipeline(
+    int socket, const std::string& uri, const PhaseSpec& phases, size_t msgsize, size_t nreceivers,
+    SendMode mode, RecvMode recvMode, const Placement& placement, PullerKind pullers,
+    size_t reactors, size_t batch
+) {
+    PipelineResult result;
+    result.pulled.resize(nreceivers);
+    std::latch allready(nreceivers);    // So we know when all the receivers are ready to go.
+    std::latch alldone(nreceivers);     // So we know when to join.
+    long memory = residentKb();
+    std::vector<std::thread*> receivers = startPullers(
+        std::vector<std::string>(nreceivers, uri), false, pullers, reactors, batch, &allready,
+        &alldone, result.pulled, placement, mode, recvMode, msgsize
+    );
+
+    // Wait for the to all startt:
+
+    allready.wait();
+    result.memoryKb = residentKb() - memory;
+
+    ///////////////////////////////////// timed (by the clock)
+    long switches = contextSwitches();
+    uint64_t allocs = allocatorCalls();
+    PhaseClock clock(phases);
+    {
+        PlacementScope pin(placement.sender(0));
+        push(socket, msgsize, mode, alldone, clock);
+    }
+    // Join the threads so we know they're done
+
+    for (auto p : receivers) {
+        p->join();
+    }
+    result.contextSwitches = contextSwitches() - switches;
+    result.allocatorCalls  = allocatorCalls() - allocs;
+    ////////////////////////////////////// timed
+
+    // Clean up the threads.
+
+    for (auto p : receivers) {
+        delete p;
+
+    }
+    receivers.clear();
+
+    result.seconds    = clock.seconds();
+    result.cpuSeconds = clock.cpuEnd() - clock.cpuStart();
+    result.sent       = clock.measured();
+    result.warmup     = clock.warmedUp();
+    result.samples    = clock.samples();
+    result.pushed.push_back(result.sent);
+    return result;
+}
+
+/**
+ * pushThread
+ *    A pusher in the fan in topology.  Connects its own push socket to all of
+ * the collectors and pushes until all the pullers are done.
+ * 
+ * @param uris - URIs of the collectors.
+ * @param msgsize - Size of each message.
+ * @param mode - How to send.
+ * @param ready - Latch we count down when connected.
+ * @param go  - Latch we wait on before pushing (so the timing start is common).
+ * @param done - Latch that's open when all pullers are finished.
+ * @param clock - Our phase clock, its share of the messages is set by the caller.
+ * @param placement - CPUs/NUMA node for this thread.
+ */
+static void
+pushThread(
+    std::vector<std::string> uris, size_t msgsize, SendMode mode,
+    std::latch* ready, std::latch* go, std::latch* done, PhaseClock* clock,
+    ThreadPlacement placement
+) {
+    placement.apply();
+    Socket socket(AF_SP, NN_PUSH, "Pusher failed to open socket");
+    std::vector<Endpoint> endpoints;
+    for (auto& uri : uris) {
+        endpoints.push_back(socket.connect(uri, "Pusher failed to connect to a collector"));
+    }
+    ready->count_down();
+    go->wait();
+
+    push(socket.fd(), msgsize, mode, *done, *clock);
+
+    for (auto& ep : endpoints) {
+        ep.shutdown("Pusher failed shutdown");
+    }
+    socket.close("Pusher failed close");
+}
+
+/**
+ * combineClocks
+ *    The measurement of several pushers runs from the first start to the last end.
+ */
+static void
+combineClocks(const std::vector<PhaseClock>& clocks, PipelineResult& result) {
+    auto start    = clocks[0].measureStart();
+    auto end      = clocks[0].measureEnd();
+    double cpuStart = clocks[0].cpuStart();
+    double cpuEnd   = clocks[0].cpuEnd();
+    result.sent   = 0;
+    result.warmup = 0;
+    result.samples.clear();
+    result.pushed.clear();
+    for (auto& c : clocks) {
+        start    = std::min(start, c.measureStart());
+        end      = std::max(end, c.measureEnd());
+        cpuStart = std::min(cpuStart, c.cpuStart());
+        cpuEnd   = std::max(cpuEnd, c.cpuEnd());
+        result.pushed.push_back(c.measured());
+        result.sent += c.measured();
+        result.warmup += c.warmedUp();
+        mergeSamples(result.samples, c.samples());
+    }
+    result.seconds    = std::chrono::duration<double>(end - start).count();
+    result.cpuSeconds = cpuEnd - cpuStart;
+}
+
+/**
+ * timeFanIn
+ *    Times the fan in/fan out topology:  nreceivers bound pullers,
+ * npushers connected pushers.
+ * 
+ * @param uriTemplate - URI, with %d if nreceivers > 1.
+ * @param phases - Warmup and measurement - each pusher's share is 1/npushers of them.
+ * @param msgsize - size of each message.
+ * @param nreceivers - Number of puller threads.
+ * @param npushers  - Number of pusher threads.
+ * @param mode - How to send.
+ * @param recvMode - How the pullers receive copy and zero copy messages.
+ * @param placement - Where the pushers and pullers run.
+ * @param pullers - How the collectors are served.
+ * @param reactors - Reactor threads serving them (unless pullers is THREAD).
+ * @param batch - Reactor drain batch.
+ * @return PipelineResult
+ */
+static PipelineResult
+timeFanIn(
+    const std::string& uriTemplate, const PhaseSpec& phases, size_t msgsize, size_t nreceivers,
+    size_t npushers, SendMode mode, RecvMode recvMode, const Placement& placement,
+    PullerKind pullers, size_t reactors, size_t batch
+) {
+    PipelineResult result;
+    result.pulled.resize(nreceivers);
+    auto uris = generateUris(uriTemplate, nreceivers);
+    std::vector<PhaseClock> clocks;
+    for (size_t i = 0; i < npushers; i++) clocks.emplace_back(phases.share(i, npushers));
+
+    std::latch pullersReady(nreceivers);
+    std::latch alldone(nreceivers);
+    std::latch pushersReady(npushers);
+    std::latch go(1);
+    long memory = residentKb();
+    std::vector<std::thread*> threads = startPullers(
+        uris, true, pullers, reactors, batch, &pullersReady, &alldone, result.pulled, placement,
+        mode, recvMode, msgsize
+    );
+    pullersReady.wait();
+    result.memoryKb = residentKb() - memory;               // All collectors are bound.
+    for (int i = 0; i < npushers; i++) {
+        threads.push_back(new std::thread(
+            pushThread, uris, msgsize, mode, &pushersReady, &go, &alldone, &clocks[i],
+            placement.sender(i)
+        ));
+    }
+    pushersReady.wait();
+
+    ///////////////////////////////////// timed (by the clocks)
+    long switches = contextSwitches();
+    uint64_t allocs = allocatorCalls();
+    go.count_down();
+    for (auto p : threads) {
+        p->join();
+    }
+    result.contextSwitches = contextSwitches() - switches;
+    result.allocatorCalls  = allocatorCalls() - allocs;
+    ////////////////////////////////////// timed
+
+    for (auto p : threads) {
+        delete p;
+    }
+    threads.clear();
+
+    combineClocks(clocks, result);
+    return result;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Exact count mode.
+//
+// Data messages start with a 64 bit sequence number.  The top SEQ_ID_BITS are the
+// number of the pusher so a puller can check that each pusher's messages arrive in order.
+// Control is a survey:  The surveyor sends a ControlCommand and each puller responds
+// with a ControlReply.
+
+static const int      SEQ_ID_BITS = 16;
+static const int      SEQ_SHIFT   = 64 - SEQ_ID_BITS;
+static const uint64_t SEQ_MASK    = (uint64_t(1) << SEQ_SHIFT) - 1;
+
+enum ControlCommand : uint32_t {
+    CTL_COUNT = 1,              // Respond with the counts.
+    CTL_EXIT  = 2               // Respond with the counts and exit.
+};
+struct ControlReply {
+    uint32_t id;                // Puller number.
+    uint32_t unused;
+    uint64_t received;
+    uint64_t reordered;
+};
+static const int surveyDeadline = 500;   // ms.
+
+/**
+ * controlUri
+ *    Default control channel URI derived from the data URI.  For tcp that's the
+ * next port, for others we append _control (ipc path, inproc name).
+ */
+std::string
+controlUri(const std::string& uri) {
+    if (uri.substr(0, 6) == "tcp://") {
+        auto colon = uri.rfind(':');
+        int port = atoi(uri.substr(colon+1).c_str());
+        return uri.substr(0, colon+1) + std::to_string(port+1);
+    }
+    std::string result(uri);
+    auto pct = result.find("%d");
+    if (pct != std::string::npos) {
+        result.erase(pct, 2);        // Only one control channel.
+    }
+    return result + "_control";
+}
+
+/**
+ * exactPullThread
+ *    Puller for the exact count mode.  Polls both the data and control sockets.
+ * Data is drained without waiting and counted.  Control surveys are answered
+ * with our counts (after draining the data we have).
+ * 
+ * @param uri  - Data URI.
+ * @param ctlUri - URI of the control surveyor.
+ * @param id    - Our puller number.
+ * @param bind  - True if we bind the data URI (fan in) rather than connect to it.
+ * @param ready - Latch we count down when the sockets are set up.
+ * @param received - Receives the final count of messages we got.
+ * @param placement - CPUs/NUMA node for this thread.
+ */
+static void
+exactPullThread(
+    std::string uri, std::string ctlUri, int id, bool bind, std::latch* ready, size_t* received,
+    ThreadPlacement placement
+) {
+    placement.apply();
+    Socket puller(AF_SP, NN_PULL, "Puller failed to open socket");
+    Endpoint endpoint = bind ? puller.bind(uri, "Puller failed to connect to pusher.") :
+                               puller.connect(uri, "Puller failed to connect to pusher.");
+    Socket respondent(AF_SP, NN_RESPONDENT, "Puller failed to open control socket");
+    Endpoint ctlEndpoint = respondent.connect(
+        ctlUri, "Puller failed to connect to the control channel"
+    );
+    int socket  = puller.fd();
+    int control = respondent.fd();
+    ready->count_down();
+
+    std::vector<uint64_t> lastSeq;      // Per pusher, +1 so 0 is "none yet".
+    ControlReply reply = {(uint32_t)id, 0, 0, 0};
+    nn_pollfd pollers[2] = {
+        {socket, NN_POLLIN, 0},
+        {control, NN_POLLIN, 0}
+    };
+    bool done(false);
+    while (!done) {
+        int nfds = nn_poll(pollers, 2, -1);
+        if (nfds < 0) {
+            if (nn_errno() == EINTR) continue;
+            checkstat(nfds, "Puller failed to poll");
+        }
+        // Drain the data, either because there is some or because we need
+        // to answer a survey with an up to date count.
+
+        if (pollers[0].revents & NN_POLLIN || pollers[1].revents & NN_POLLIN) {
+            while (true) {
+                uint64_t* msgBuf(nullptr);
+                int stat = nn_recv(socket, &msgBuf, NN_MSG, NN_DONTWAIT);
+                if (stat < 0) {
+                    if (nn_errno() == EAGAIN) break;
+                    checkstat(stat, "Failed to pull a message");
+                }
+                uint64_t pusherId = msgBuf[0] >> SEQ_SHIFT;
+                uint64_t seq      = (msgBuf[0] & SEQ_MASK) + 1;
+                nn_freemsg(msgBuf);
+                if (pusherId >= lastSeq.size()) lastSeq.resize(pusherId+1, 0);
+                if (seq <= lastSeq[pusherId]) reply.reordered++;
+                lastSeq[pusherId] = seq;
+                reply.received++;
+            }
+        }
+        if (pollers[1].revents & NN_POLLIN) {
+            uint32_t* command(nullptr);
+            checkstat(
+                nn_recv(control, &command, NN_MSG, 0),
+                "Puller failed to receive a control command"
+            );
+            done = *command == CTL_EXIT;
+            nn_freemsg(command);
+            checkstat(
+                nn_send(control, &reply, sizeof(reply), 0),
+                "Puller failed to respond to a control command"
+            );
+        }
+    }
+    *received = reply.received;
+
+    ctlEndpoint.shutdown("Puller failed control shutdown");
+    respondent.close("Puller failed control close");
+    endpoint.shutdown("Puller failed shutdown");
+    puller.close("Puller failed close");
+}
+
+/**
+ * exactPusher
+ *    Sends messages with blocking sends until the clock says the measurement
+ * phase is over.
+ * 
+ * @param socket - push socket.
+ * @param msgSize - size of each message (at least a sequence number).
+ * @param clock - Warmup and measurement phases.
+ * @param id    - Pusher number, goes in the top bits of the sequence.
+ * @param mode - How to send (pool chunks with NN_MSG, header + payload, MessagePool
+ *     buffers or a user buffer).
+ * @return number of messages sent (warmup and measured).
+ */
+static size_t
+exactPusher(int socket, size_t msgSize, PhaseClock& clock, uint64_t id, SendMode mode) {
+    ChunkPool* pool = mode == SendMode::ZEROCOPY ? new ChunkPool(msgSize, ChunkPool::depthFor(msgSize)) : nullptr;
+    FramedMessage* frame = isFramed(mode) ? new FramedMessage(msgSize, mode == SendMode::GATHER) : nullptr;
+    char* msg = new char[msgSize];
+    uint64_t seqBase = id << SEQ_SHIFT;
+    uint64_t i(0);
+    clock.start();
+    while (clock.phase() != PhaseClock::DONE) {
+        if (pool) {
+            void* chunk = pool->get();
+            *reinterpret_cast<uint64_t*>(chunk) = seqBase | i;
+            void* p = chunk;
+            int stat = nn_send(socket, &p, NN_MSG, 0);
+            if (stat < 0) pool->putBack(chunk);
+            checkstat(stat, "Pusher failed to send zero copy message");
+        } else if (frame) {
+            *reinterpret_cast<uint64_t*>(frame->header()) = seqBase | i;
+            checkstat(frame->send(socket, 0), "Pusher failed to send framed message");
+        } else if (mode == SendMode::POOLED) {
+            void* buffer = MessagePool::get(msgSize);
+            *reinterpret_cast<uint64_t*>(buffer) = seqBase | i;
+            int stat = nn_send(socket, buffer, msgSize, 0);
+            MessagePool::put(buffer, msgSize);
+            checkstat(stat, "Pusher failed to send pooled message");
+        } else {
+            *reinterpret_cast<uint64_t*>(msg) = seqBase | i;
+            checkstat(nn_send(socket, msg, msgSize, 0), "Pusher failed to send message");
+        }
+        i++;
+        clock.tick();
+    }
+    delete []msg;
+    delete frame;
+    delete pool;
+    return i;
+}
+
+// Exact mode pusher thread for the fan in topology.
+// The socket is held open until the drained latch opens as closing it
+// can drop messages that are still queued.
+
+static void
+exactPushThread(
+    std::vector<std::string> uris, size_t msgsize, PhaseClock* clock, int id, SendMode mode,
+    std::latch* ready, std::latch* go, std::latch* drained, size_t* sent, ThreadPlacement placement
+) {
+    placement.apply();
+    Socket socket(AF_SP, NN_PUSH, "Pusher failed to open socket");
+    std::vector<Endpoint> endpoints;
+    for (auto& uri : uris) {
+        endpoints.push_back(socket.connect(uri, "Pusher failed to connect to a collector"));
+    }
+    ready->count_down();
+    go->wait();
+
+    *sent = exactPusher(socket.fd(), msgsize, *clock, id, mode);
+    drained->arrive_and_wait();
+
+    for (auto& ep : endpoints) {
+        ep.shutdown("Pusher failed shutdown");
+    }
+    socket.close("Pusher failed close");
+}
+
+/**
+ * surveyPullers
+ *    Sends a control command and collects the replies.
+ * 
+ * @param control - surveyor socket.
+ * @param command - What to send.
+ * @param[inout] replies - Replies are stored here by puller id.
+ * @param[inout] replied - ids of the pullers that answered are added to this.
+ */
+static void
+surveyPullers(
+    int control, ControlCommand command, std::vector<ControlReply>& replies, std::set<uint32_t>& replied
+) {
+    uint32_t cmd = command;
+    checkstat(nn_send(control, &cmd, sizeof(cmd), 0), "Failed to send a control survey");
+    while (true) {
+        ControlReply* reply(nullptr);
+        int nRecv = nn_recv(control, &reply, NN_MSG, 0);
+        if (nRecv < 0 && (nn_errno() == ETIMEDOUT || nn_errno() == EFSM)) {
+            break;                                  // Survey is over.
+        }
+        checkstat(nRecv, "Failed to get a control survey response");
+        if (nRecv == sizeof(ControlReply) && reply->id < replies.size()) {
+            replies[reply->id] = *reply;
+            replied.insert(reply->id);
+        }
+        nn_freemsg(reply);
+        if (replied.size() == replies.size()) break;   // No sense waiting out the deadline.
+    }
+}
+
+/**
+ * timeExact
+ *    Time the exact count mode.
+ * 
+ * @param uri - Data URI.  With npushers > 0 this is a template for the collectors.
+ * @param ctlUri - Control channel URI.
+ * @param phases - Warmup and measurement phases (shared among the pushers).
+ * @param msgsize - Size of each message.
+ * @param nreceivers - Number of pullers.
+ * @param npushers - Number of pushers, 0 means the single bound pusher topology.
+ * @param mode - How to send.
+ * @param placement - Where the pushers and pullers run.
+ */
+static PipelineResult
+timeExact(
+    const std::string& uri, const std::string& ctlUri, const PhaseSpec& phases, size_t msgsize,
+    size_t nreceivers, size_t npushers, SendMode mode, const Placement& placement
+) {
+    if (msgsize < sizeof(uint64_t)) {
+        std::cerr << "--exact needs messages of at least " << sizeof(uint64_t) << " bytes\n";
+        exit(EXIT_FAILURE);
+    }
+    bool fanIn = npushers > 0;
+    size_t nthreads = fanIn ? npushers : 1;
+    PipelineResult result;
+    result.pulled.resize(nreceivers);
+    result.pushed.resize(nthreads);
+
+    Socket surveyor(AF_SP, NN_SURVEYOR, "Failed to open the control surveyor");
+    int deadline = surveyDeadline;
+    surveyor.setOption(
+        NN_SURVEYOR, NN_SURVEYOR_DEADLINE, deadline, "Failed to set the control survey deadline"
+    );
+    Endpoint ctlEndpoint = surveyor.bind(ctlUri, "Failed to bind the control surveyor");
+    int control = surveyor.fd();
+
+    // Single pusher case: we own the bound push socket.
+
+    Socket pushSocket;
+    Endpoint endpoint;
+    if (!fanIn) {
+        pushSocket = Socket(AF_SP, NN_PUSH, "Failed to create push sockket");
+        endpoint = pushSocket.bind(uri, "Failed to bind push socket.");
+    }
+    int socket = pushSocket.fd();
+    auto uris = fanIn ? generateUris(uri, nreceivers) : std::vector<std::string>(nreceivers, uri);
+
+    std::latch pullersReady(nreceivers);
+    std::latch pushersReady(fanIn ? npushers : 0);
+    std::latch go(1);
+    std::latch drained(fanIn ? npushers + 1 : 0);
+    std::vector<std::thread*> pullers;
+    std::vector<std::thread*> pushers;
+    for (int i = 0; i < nreceivers; i++) {
+        pullers.push_back(new std::thread(
+            exactPullThread, uris[i], ctlUri, i, fanIn, &pullersReady, &result.pulled[i],
+            placement.receiver(i)
+        ));
+    }
+    pullersReady.wait();
+    std::vector<PhaseClock> clocks;
+    for (size_t i = 0; i < nthreads; i++) clocks.emplace_back(phases.share(i, nthreads));
+    if (fanIn) {
+        for (int i = 0; i < npushers; i++) {
+            pushers.push_back(new std::thread(
+                exactPushThread, uris, msgsize, &clocks[i], i, mode, &pushersReady, &go, &drained,
+                &result.pushed[i], placement.sender(i)
+            ));
+        }
+        pushersReady.wait();
+    }
+
+    ///////////////////////////////////// timed (from the start of measurement)
+    if (fanIn) {
+        go.count_down();
+        drained.arrive_and_wait();      // Pushers are done sending.
+    } else {
+        PlacementScope pin(placement.sender(0));
+        result.pushed[0] = exactPusher(socket, msgsize, clocks[0], 0, mode);
+    }
+    auto start      = clocks[0].measureStart();
+    double cpuStart = clocks[0].cpuStart();
+    result.sent   = 0;
+    result.warmup = 0;
+    for (auto& c : clocks) {
+        start    = std::min(start, c.measureStart());
+        cpuStart = std::min(cpuStart, c.cpuStart());
+        result.warmup += c.warmedUp();
+        mergeSamples(result.samples, c.samples());
+    }
+    for (auto n : result.pushed) result.sent += n;
+
+    // Poll the counts until all is accounted for or there's been no progress for
+    // a while - in which case the remainder is lost.
+
+    std::vector<ControlReply> replies(nreceivers, ControlReply{0, 0, 0, 0});
+    size_t lastTotal(0);
+    auto end = std::chrono::steady_clock::now();
+    auto lastProgress = end;
+    result.cpuSeconds = cpuSeconds() - cpuStart;
+    while (true) {
+        std::set<uint32_t> replied;
+        surveyPullers(control, CTL_COUNT, replies, replied);
+        size_t total(0);
+        for (auto& r : replies) total += r.received;
+        auto now = std::chrono::steady_clock::now();
+        if (total != lastTotal) {
+            lastTotal = total;
+            lastProgress = now;
+            end = now;
+            result.cpuSeconds = cpuSeconds() - cpuStart;
+        }
+        if (total >= result.sent) break;
+        if (now - lastProgress > std::chrono::seconds(2)) break;   // Lost.
+        usleep(1000);
+    }
+    ////////////////////////////////////// timed
+
+    for (auto p : pushers) {
+        p->join();
+        delete p;
+    }
+
+    // Tell everyone to exit - keep at it until every puller has acknowledged or
+    // we've stopped hearing from anyone (an ack can be lost when the puller closes).
+
+    std::set<uint32_t> exited;
+    int quietSurveys(0);
+    while (exited.size() < nreceivers && quietSurveys < 5) {
+        size_t before = exited.size();
+        surveyPullers(control, CTL_EXIT, replies, exited);
+        quietSurveys = exited.size() == before ? quietSurveys + 1 : 0;
+    }
+    for (auto p : pullers) {
+        p->join();
+        delete p;
+    }
+
+    // The pullers' own final counts are authoritative.
+
+    result.delivered = 0;
+    result.reordered = 0;
+    for (int i = 0; i < nreceivers; i++) {
+        result.delivered += result.pulled[i];
+        result.reordered += replies[i].reordered;
+    }
+    result.seconds = std::chrono::duration<double>(end - start).count();
+
+    if (!fanIn) {
+        endpoint.shutdown("Pusher failed shutdown");
+        pushSocket.close("Pusher failed socket close");
+    }
+    ctlEndpoint.shutdown("Failed to shutdown the control surveyor");
+    surveyor.close("Failed to close the control surveyor");
+    return result;
+}
+
+/**
+ * runPipeline
+ *    Time one pipeline run as described by the configuration.  All sockets are
+ * created and destroyed by the run.
+ */
+PipelineResult
+runPipeline(const PipelineConfig& config) {
+    PhaseSpec phases(config.phases);
+    phases.measureMessages = phases.measureNs ? 0 : config.nmsg;
+    if (config.pullers == PullerKind::COROUTINE &&
+        (!receivesChunks(config.mode) || config.recv != RecvMode::CHUNK)) {
+        std::cerr << "Coroutine pullers take nanomsg's chunk;  only the copy and zero copy modes can use them\n";
+        exit(EXIT_FAILURE);
+    }
+    if (config.exact) {
+        if (config.pullers != PullerKind::THREAD) {
+            std::cerr << "The exact count mode has its own pullers;  --reactor can't be used with it\n";
+            exit(EXIT_FAILURE);
+        }
+        if (config.recv != RecvMode::CHUNK) {
+            std::cerr << "The exact count mode's pullers take nanomsg's chunk;  --fixed-recv can't be used with it\n";
+            exit(EXIT_FAILURE);
+        }
+        std::string ctlUri = config.ctlUri.empty() ? controlUri(config.uri) : config.ctlUri;
+        return timeExact(
+            config.uri, ctlUri, phases, config.msgsize, config.nreceivers,
+            config.npushers, config.mode, config.placement
+        );
+    }
+    if (config.npushers > 0) {
+        // Fan in - the pushers and pullers make their own sockets.
+
+        return timeFanIn(
+            config.uri, phases, config.msgsize, config.nreceivers, config.npushers,
+            config.mode, config.recv, config.placement, config.pullers, config.reactors,
+            config.batch
+        );
+    }
+    // Set up the push side of things.
+
+    Socket socket(AF_SP, NN_PUSH, "Failed to create push sockket");
+    Endpoint endpoint = socket.bind(config.uri, "Failed to bind push socket.");
+
+    PipelineResult result = timePipeline(
+        socket.fd(), config.uri, phases, config.msgsize, config.nreceivers, config.mode,
+        config.recv, config.placement, config.pullers, config.reactors, config.batch
+    );
+
+    // Clean up everything
+
+    endpoint.shutdown("Pusher failed shutdown");
+    socket.close("Pusher failed socket close");
+    return result;
+}
+
+/**
+ * pipelineMode
+ *    The send and receive modes and, unless it's a thread per puller, how the pullers
+ * are served e.g. copy, copy/fixed, copy/reactor4, zerocopy/coroutine8.
+ */
+std::string
+pipelineMode(const PipelineConfig& config) {
+    static const char* kinds[] = {"thread", "reactor", "epoll", "coroutine"};
+    std::string result = sendRecvName(config.mode, config.recv);
+    if (config.pullers != PullerKind::THREAD) {
+        result += "/" + std::string(kinds[(int)config.pullers]) + std::to_string(config.reactors);
+    }
+    return result;
+}
+
+/**
+ * pipelineRecord
+ *    Turn the result of a run into a record for csv/json output (see record.h).
+ */
+RunRecord
+pipelineRecord(const PipelineConfig& config, const PipelineResult& r) {
+    RunRecord record;
+    record.benchmark  = config.exact ? "pipeline-exact" :
+        (config.npushers > 0 ? "pipeline-fanin" : "pipeline");
+    record.mode       = pipelineMode(config);
+    if (!config.placement.name.empty()) record.mode += "/" + config.placement.name;
+    record.uri        = config.uri;
+    record.msgsize    = config.msgsize;
+    record.senders    = r.pushed.size();
+    record.receivers  = config.nreceivers;
+    // Exact mode counts what arrived (less the warmup).
+    record.messages   = config.exact ? r.delivered - std::min(r.delivered, r.warmup) : r.sent;
+    record.bytes      = (uint64_t)record.messages * config.msgsize;
+    record.durationNs = r.seconds * 1.0e9;
+    record.cpuSec     = r.cpuSeconds;
+    record.contextSwitches = r.contextSwitches;
+    record.allocatorCalls  = r.allocatorCalls;
+    record.memoryKb        = r.memoryKb;
+    return record;
+}
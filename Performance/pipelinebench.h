@@ -0,0 +1,77 @@
+/**
+ * Push/pull (pipeline) timing interface.
+ *
+ * runPipeline times one run of the nanomsg push/pull pattern as described by a
+ * PipelineConfig.  It's used by the pipeline program and by the sweep driver which
+ * runs many configurations in one process.  See pipeline.cpp for the details of the
+ * topologies and modes.
+ */
+#ifndef PIPELINEBENCH_H
+#define PIPELINEBENCH_H
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "phases.h"
+#include "affinity.h"
+#include "framing.h"
+
+// How the puller sockets are served:  a thread each, or a few threads each serving
+// many sockets with nn_poll, an EventLoop (../eventloop.h) or coroutines (../nncoro.h).
+
+enum class PullerKind {
+    THREAD, POLL, EPOLL, COROUTINE
+};
+
+struct PipelineConfig {
+    std::string uri;                // Data URI (template with %d for fan in with >1 puller).
+    size_t      nmsg       = 0;     // Messages to measure (per run).
+    size_t      msgsize    = 0;
+    size_t      nreceivers = 1;     // Puller sockets.
+    size_t      npushers   = 0;     // 0 - one bound pusher, else fan in pusher threads.
+    PullerKind  pullers    = PullerKind::THREAD;
+    size_t      reactors   = 4;     // Threads serving the puller sockets unless pullers is THREAD.
+    size_t      batch      = 64;    // Most messages a reactor takes from one socket per poll.
+    SendMode    mode       = SendMode::COPY;   // See framing.h.
+    RecvMode    recv       = RecvMode::CHUNK;  // How pullers receive copy/zerocopy messages.
+    bool        exact      = false; // Exact count termination.
+    std::string ctlUri;             // Exact mode control URI, empty for the default.
+    PhaseSpec   phases;             // Warmup/duration/interval, the count is nmsg.
+    Placement   placement;          // Pusher (sender) and puller (receiver) CPUs/NUMA nodes.
+};
+
+// What we know about one timed run:
+
+struct PipelineResult {
+    double              seconds;    // Of the measurement phase.
+    double              cpuSeconds; // Process CPU time during the measurement phase.
+    size_t              sent;       // Measured total over all pushers (exact mode: all sent).
+    size_t              warmup;     // Sent during the warmup phase.
+    std::vector<size_t> pushed;     // Per pusher.
+    std::vector<size_t> pulled;     // Per puller.
+    long                contextSwitches = 0;   // Whole process, while the pushers ran.
+    long                memoryKb = 0;          // Resident growth from starting the pullers.
+    uint64_t            allocatorCalls = 0;    // Whole process, while the pushers ran.
+    // Only meaningful in exact mode:
+    size_t              delivered;  // Total over all pullers.
+    size_t              reordered;  // Sequence numbers that went backwards.
+    std::vector<ThroughputSample> samples;   // With --interval.
+};
+
+PipelineResult runPipeline(const PipelineConfig& config);
+
+// Send mode and puller kind e.g. copy/epoll4 for reports and records.
+
+std::string pipelineMode(const PipelineConfig& config);
+
+// The csv/json record for a run.
+
+struct RunRecord;
+RunRecord pipelineRecord(const PipelineConfig& config, const PipelineResult& result);
+
+// Default exact mode control URI for a data URI.
+
+std::string controlUri(const std::string& uri);
+
+#endif
@@ -0,0 +1,579 @@
+/**
+ * This program times nanomsg pub/sub subscription filtering.
+ *
+ * The pubsub example (../pubsub.cpp) has one subscriber with one subscription.  We
+ * run SUB sockets with thousands of prefix subscriptions;  this times how the cost of
+ * matching topics grows with the number of them.  nanomsg filters on the subscriber
+ * side (in nn_recv) so every subscriber looks at every message that's published.
+ *
+ * Usage:
+ *    pubsub uri nmsg msgsize nsubscribers [--subscriptions=n,...] [--prefix-lengths=spec]
+ *           [--match=fraction] [--sndbuf=bytes] [--rcvbuf=bytes] [--slow=time]
+ *           [--format=text|csv|json]
+ * Where:
+ *    * uri - URI the publisher listens on and the subscribers connect to.
+ *    * nmsg - Number of messages published.
+ *    * msgsize - Size of each message (topic included;  messages are never shorter
+ *      than their topic).
+ *    * nsubscribers - Number of subscriber threads.
+ *    * --subscriptions - Number of subscriptions each subscriber has, default 1000.  A
+ *      comma separated list (e.g. 1,10,100,1000,10000) times each in turn.
+ *    * --prefix-lengths - Distribution of subscription lengths.  Comma separated items
+ *      that are a length (8), a length and weight (8:3) or a range with equal weights
+ *      (4-16, the default).
+ *    * --match - Fraction of the published messages that match a subscription, default 0.1.
+ *    * --sndbuf, --rcvbuf - Publisher NN_SNDBUF and subscriber NN_RCVBUF, default nanomsg's.
+ *    * --slow - Slow subscriber harness:  time each subscription count twice, the second
+ *      time with subscriber 0 spinning for this long (e.g. 50us) after every message.
+ *    * --format - text (default) or one csv/json record per subscription count (see record.h).
+ *
+ * The subscriptions are random strings (letters and digits) drawn from the length
+ * distribution.  Every subscriber has the same set, so each one should get the --match
+ * fraction of what's published.  Matching messages start with a subscription;  the others
+ * start with a near miss (a subscription with its last character changed, checked not to
+ * match any other subscription).  Message topics come round robin from a pool of topicPool
+ * generated before timing starts.
+ *
+ * Before publishing, the publisher repeats a SYNC message until every subscriber has it
+ * (so all are connected) and afterwards it repeats END until every subscriber is done.
+ * A subscriber only gives up on END once the publisher has finished publishing and
+ * nothing has arrived for a second.
+ * Control messages start with '~' which no generated topic does.
+ *
+ * PUB drops messages for subscribers that fall behind without saying so, so the matching
+ * messages carry a sequence number (see trailingSeq) and subscribers count the gaps.
+ *
+ * Output for each subscription count:
+ *    * Publisher msg/sec and send buffer size.
+ *    * For each subscriber the messages received, the matching messages published
+ *      (expected), the number of gaps in the sequence numbers and the largest, the receive
+ *      rate (from the first publish to its last receipt) and the subscriber thread's CPU
+ *      time per published message and its receive buffer size.
+ *    * Filtering cost - the mean over subscribers of the CPU ns per published message.
+ *      Comparing it across subscription counts shows how topic matching scales.
+ *    * With --slow, the other subscribers' mean msg/sec and messages missing without and
+ *      with the slow one.
+ */
+#include <thread>
+#include <nanomsg/nn.h>
+#include <nanomsg/pubsub.h>
+#include <stdlib.h>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <chrono>
+#include <atomic>
+#include <random>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include "options.h"
+#include "phases.h"
+#include "record.h"
+#include "../nnpp.h"
+
+static const char*  SYNC_TOPIC     = "~SYNC";
+static const char*  END_TOPIC      = "~END";     // Followed by the count (see trailingSeq).
+static const char*  CONTROL_PREFIX = "~";
+static const char   FILLER         = '.';      // Never in a topic so never extends a match.
+static const size_t topicPool      = 4096;
+static const int    controlInterval = 10;      // ms between SYNC/END repeats.
+static const int    quietTimeout    = 1000;    // ms a subscriber waits for anything.
+static const char   alphabet[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+static uint64_t
+nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+// CPU time of the calling thread (the SUB socket filters in nn_recv so it's charged here).
+
+static double
+threadCpuSeconds() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec/1.0e9;
+}
+
+/**
+ * parseLengths
+ *    --prefix-lengths spec to a length distribution.
+ * @param lengths - Returns the lengths.
+ * @return distribution of indices into lengths.
+ */
+static std::discrete_distribution<int>
+parseLengths(const std::string& spec, std::vector<int>& lengths) {
+    std::vector<double> weights;
+    std::stringstream items(spec);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        if (item.empty()) continue;
+        auto dash  = item.find('-');
+        auto colon = item.find(':');
+        if (dash != std::string::npos) {
+            int lo = atoi(item.c_str());
+            int hi = atoi(item.c_str() + dash + 1);
+            for (int n = lo; n <= hi; n++) {
+                lengths.push_back(n);
+                weights.push_back(1.0);
+            }
+        } else {
+            lengths.push_back(atoi(item.c_str()));
+            weights.push_back(colon == std::string::npos ? 1.0 : atof(item.c_str() + colon + 1));
+        }
+    }
+    for (int n : lengths) {
+        if (n < 1) {
+            std::cerr << "Prefix lengths must be at least 1\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (lengths.empty()) {
+        std::cerr << "No prefix lengths in " << spec << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return std::discrete_distribution<int>(weights.begin(), weights.end());
+}
+
+// count distinct random subscriptions with lengths from the distribution.
+
+static std::vector<std::string>
+makeSubscriptions(
+    size_t count, const std::vector<int>& lengths, std::discrete_distribution<int>& lengthDist,
+    std::mt19937& rng
+) {
+    std::uniform_int_distribution<int> chars(0, sizeof(alphabet) - 2);
+    std::set<std::string> unique;
+    std::vector<std::string> result;
+    size_t attempts(0);
+    while (result.size() < count) {
+        std::string s(lengths[lengthDist(rng)], ' ');
+        for (auto& c : s) c = alphabet[chars(rng)];
+        if (unique.insert(s).second) {
+            result.push_back(s);
+        } else if (++attempts > count * 100) {
+            std::cerr << "Can't make " << count << " distinct subscriptions with those lengths\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    return result;
+}
+
+// Does any subscription match (is a prefix of) topic?
+
+static bool
+matches(const std::set<std::string>& subscriptions, const std::string& topic) {
+    for (size_t n = 1; n <= topic.size(); n++) {
+        if (subscriptions.count(topic.substr(0, n))) return true;
+    }
+    return false;
+}
+
+// A topic published and whether it matches.
+
+struct Topic {
+    std::string topic;
+    bool        match;
+};
+
+static std::vector<Topic>
+makeTopics(const std::vector<std::string>& subscriptions, double fraction, std::mt19937& rng) {
+    std::set<std::string> subs(subscriptions.begin(), subscriptions.end());
+    std::uniform_int_distribution<size_t> pick(0, subscriptions.size() - 1);
+    std::uniform_int_distribution<int> chars(0, sizeof(alphabet) - 2);
+    std::vector<Topic> result;
+    size_t nmatch = fraction * topicPool + 0.5;
+    for (size_t i = 0; i < topicPool; i++) {
+        bool match = i < nmatch && !subscriptions.empty();
+        std::string topic = subscriptions.empty() ? std::string(1, alphabet[0]) : subscriptions[pick(rng)];
+        if (!match) {
+            // A near miss - or, if we can't find one, a topic nothing matches.
+
+            int tries(0);
+            do {
+                topic = subscriptions.empty() ? topic : subscriptions[pick(rng)];
+                topic.back() = alphabet[chars(rng)];
+            } while (matches(subs, topic) && ++tries < 100);
+            if (matches(subs, topic)) topic = std::string(1, FILLER);
+        }
+        result.push_back(Topic{topic, match});
+    }
+    std::shuffle(result.begin(), result.end(), rng);
+    return result;
+}
+
+// Data messages end with the number of matching messages published before them (so the
+// matching messages, which every subscriber should get, are numbered 0, 1, 2...).  END
+// is followed by the number of matching messages published.  At least one FILLER byte
+// separates the topic from the number so it can't extend a match.
+
+static uint64_t
+trailingSeq(const char* msg, int n) {
+    uint64_t seq;
+    memcpy(&seq, msg + n - sizeof(seq), sizeof(seq));
+    return seq;
+}
+
+// What a subscriber measures:
+
+struct SubscriberStats {
+    size_t   received;
+    size_t   gaps;          // Runs of missing sequence numbers.
+    size_t   missing;       // Messages in them.
+    size_t   largestGap;
+    size_t   outOfOrder;    // Sequence numbers that went backwards.
+    uint64_t lastNs;        // Last data receipt.
+    double   cpuSec;        // Thread CPU from SYNC to END.
+    bool     ended;         // Got END (rather than timing out).
+    int      rcvbuf;        // NN_RCVBUF in effect.
+
+    // Account for sequence number seq arriving when next was expected.
+
+    void sequence(uint64_t seq, uint64_t& next) {
+        if (seq < next) {
+            outOfOrder++;
+            return;
+        }
+        if (seq > next) {
+            gaps++;
+            missing   += seq - next;
+            largestGap = std::max(largestGap, (size_t)(seq - next));
+        }
+        next = seq + 1;
+    }
+};
+
+// Shared by the publisher and subscribers of a run:
+
+struct PubsubRun {
+    std::string                     uri;
+    const std::vector<std::string>* subscriptions;
+    int                             rcvbuf;      // 0 leaves nanomsg's default.
+    uint64_t                        slowNs;      // Subscriber 0 spins this long per message.
+    std::atomic<int>                synced;      // Subscribers that have seen SYNC.
+    std::atomic<int>                finished;    // Subscribers that are done.
+    std::atomic<bool>               published;   // The publisher is on to END.
+};
+
+/**
+ * subscriber thread:
+ *    Subscribe to everything in the run's set (and the control messages), connect
+ * and count what arrives, and what's missing, until END.
+ */
+static void
+subscriber(PubsubRun* run, int index, SubscriberStats* stats) {
+    Socket subSocket(AF_SP, NN_SUB, "Could not open subscriber socket.");
+    for (auto& s : *run->subscriptions) {
+        subSocket.setOption(NN_SUB, NN_SUB_SUBSCRIBE, s, "Could not set subscription string.");
+    }
+    subSocket.setOption(
+        NN_SUB, NN_SUB_SUBSCRIBE, std::string(CONTROL_PREFIX),
+        "Could not subscribe to the control messages."
+    );
+    subSocket.setOption(NN_SOL_SOCKET, NN_RCVTIMEO, quietTimeout, "Could not set the receive timeout.");
+    if (run->rcvbuf) {
+        subSocket.setOption(NN_SOL_SOCKET, NN_RCVBUF, run->rcvbuf, "Could not set the receive buffer size.");
+    }
+    stats->rcvbuf = subSocket.getOption<int>(
+        NN_SOL_SOCKET, NN_RCVBUF, "Could not get the receive buffer size."
+    );
+    Endpoint endpoint = subSocket.connect(run->uri, "Failed to connect to publisher.");
+    int socket = subSocket.fd();
+
+    stats->received = stats->gaps = stats->missing = stats->largestGap = stats->outOfOrder = 0;
+    stats->lastNs   = 0;
+    stats->ended    = false;
+    uint64_t slowNs = index == 0 ? run->slowNs : 0;
+    uint64_t next(0);                        // Sequence number we expect.
+    bool synced(false);
+    double cpuStart(threadCpuSeconds());
+    while (true) {
+        char* msg(nullptr);
+        int n = nn_recv(socket, &msg, NN_MSG, 0);
+        if (n < 0) {
+            // Non-matching messages are filtered inside nn_recv so a subscriber can see
+            // nothing for a long time while the publisher is busy.  Only once it's done
+            // does a quiet spell mean END was lost.
+
+            if (nn_errno() == ETIMEDOUT && synced && run->published) break;
+            if (nn_errno() == ETIMEDOUT || nn_errno() == EINTR) continue;
+            checkstat(n, "Subscriber failed to receive");
+        }
+        if (msg[0] == CONTROL_PREFIX[0]) {
+            if (!synced && n >= strlen(SYNC_TOPIC) && memcmp(msg, SYNC_TOPIC, strlen(SYNC_TOPIC)) == 0) {
+                synced   = true;
+                cpuStart = threadCpuSeconds();
+                run->synced++;
+            } else if (n >= strlen(END_TOPIC) + sizeof(uint64_t) &&
+                       memcmp(msg, END_TOPIC, strlen(END_TOPIC)) == 0) {
+                stats->ended = true;
+                uint64_t total = trailingSeq(msg, n);
+                if (total > next) stats->sequence(total, next);    // Lost off the end.
+                nn_freemsg(msg);
+                break;
+            }
+        } else if (n >= sizeof(uint64_t)) {
+            stats->received++;
+            stats->lastNs = nowNs();
+            stats->sequence(trailingSeq(msg, n), next);
+            if (slowNs) {
+                while (nowNs() - stats->lastNs < slowNs)    // Spin rather than sleep -
+                    ;                                      // sleeps are too coarse.
+            }
+        }
+        nn_freemsg(msg);
+    }
+    stats->cpuSec = threadCpuSeconds() - cpuStart;
+    run->finished++;
+
+    endpoint.shutdown("Failed to shutdown subscriber endpoint");
+    subSocket.close("Failed to close subscriber socket.");
+}
+
+// Repeat a control message until count reaches target.
+
+static void
+repeatUntil(int socket, const std::string& msg, const std::atomic<int>& count, int target) {
+    while (count < target) {
+        checkstat(nn_send(socket, msg.data(), msg.size(), 0), "Failed to publish a control message");
+        std::this_thread::sleep_for(std::chrono::milliseconds(controlInterval));
+    }
+}
+
+// The result of timing one subscription count:
+
+struct PubsubResult {
+    double                       pubSeconds;
+    uint64_t                     startNs;
+    size_t                       expected;     // Matching messages published.
+    int                          sndbuf;       // Publisher's NN_SNDBUF.
+    uint64_t                     slowNs;
+    std::vector<SubscriberStats> subscribers;
+
+    double rate(int i) const {
+        auto& s = subscribers[i];
+        double seconds = s.lastNs > startNs ? (s.lastNs - startNs)/1.0e9 : 0.0;
+        return seconds > 0 ? s.received/seconds : 0.0;
+    }
+};
+
+// Buffer and slow subscriber settings for a run:
+
+struct PubsubSettings {
+    int      sndbuf = 0;      // 0 leaves nanomsg's defaults.
+    int      rcvbuf = 0;
+    uint64_t slowNs = 0;
+};
+
+/**
+ * timeSubscriptions
+ *    Publish nmsg messages from the topic pool to nsubs subscribers with the
+ * subscription set.
+ */
+static PubsubResult
+timeSubscriptions(
+    const std::string& uri, size_t nmsg, size_t msgsize, int nsubs,
+    const std::vector<std::string>& subscriptions, const std::vector<Topic>& topics,
+    const PubsubSettings& settings
+) {
+    PubsubRun run;
+    run.uri           = uri;
+    run.subscriptions = &subscriptions;
+    run.rcvbuf        = settings.rcvbuf;
+    run.slowNs        = settings.slowNs;
+    run.synced        = 0;
+    run.finished      = 0;
+    run.published     = false;
+
+    PubsubResult result;
+    result.slowNs = settings.slowNs;
+    Socket publisher(AF_SP, NN_PUB, "Could not create publisher socket.");
+    if (settings.sndbuf) {
+        publisher.setOption(NN_SOL_SOCKET, NN_SNDBUF, settings.sndbuf, "Could not set the send buffer size.");
+    }
+    result.sndbuf = publisher.getOption<int>(
+        NN_SOL_SOCKET, NN_SNDBUF, "Could not get the send buffer size."
+    );
+    Endpoint endpoint = publisher.bind(uri, "Publisher bind failed.");
+    int socket = publisher.fd();
+
+    result.subscribers.resize(nsubs);
+    std::vector<std::thread*> threads;
+    for (int i = 0; i < nsubs; i++) {
+        threads.push_back(new std::thread(subscriber, &run, i, &result.subscribers[i]));
+    }
+    repeatUntil(socket, SYNC_TOPIC, run.synced, nsubs);
+
+    // Build the messages up front so publishing is just the sequence number and nn_send:
+
+    std::vector<std::string> messages;
+    for (auto& t : topics) {
+        std::string m(t.topic);
+        size_t size = std::max(msgsize, m.size() + 1 + sizeof(uint64_t));
+        m.append(size - m.size(), FILLER);
+        messages.push_back(m);
+    }
+    uint64_t seq(0);
+    result.startNs = nowNs();
+    for (size_t i = 0; i < nmsg; i++) {
+        std::string& m(messages[i % messages.size()]);
+        memcpy(&m[m.size() - sizeof(seq)], &seq, sizeof(seq));
+        checkstat(nn_send(socket, m.data(), m.size(), 0), "Failed to publish a message");
+        if (topics[i % topics.size()].match) seq++;
+    }
+    result.pubSeconds = (nowNs() - result.startNs)/1.0e9;
+    result.expected   = seq;
+    run.published     = true;
+
+    std::string end(END_TOPIC);
+    end.append(reinterpret_cast<const char*>(&seq), sizeof(seq));
+    repeatUntil(socket, end, run.finished, nsubs);
+    for (auto t : threads) {
+        t->join();
+        delete t;
+    }
+    endpoint.shutdown("Failed to shutdown publisher endpoint");
+    publisher.close("Failed to close publisher socket.");
+    return result;
+}
+
+// Text output for one run.
+
+static void
+report(size_t count, double match, size_t nmsg, const PubsubResult& r) {
+    std::cout << "Subscriptions : " << count << " per subscriber  Matching : " << match
+              << " (" << r.expected << " of " << nmsg << " published)\n";
+    if (r.slowNs) {
+        std::cout << "Slowed        : subscriber 0 by " << r.slowNs << " ns per message\n";
+    }
+    std::cout << "Publisher     : " << r.pubSeconds << " sec " << nmsg/r.pubSeconds
+              << " msg/sec  send buffer : " << r.sndbuf << " bytes\n";
+    double nsPerMsg(0);
+    for (int i = 0; i < r.subscribers.size(); i++) {
+        auto& s = r.subscribers[i];
+        nsPerMsg += s.cpuSec * 1.0e9/nmsg/r.subscribers.size();
+        std::cout << "subscriber " << std::setw(4) << i
+                  << " received : " << std::setw(10) << s.received
+                  << " expected : " << std::setw(10) << r.expected
+                  << " gaps : " << std::setw(6) << s.gaps
+                  << " largest : " << std::setw(8) << s.largestGap
+                  << " msg/sec : " << std::setw(12) << r.rate(i)
+                  << " cpu ns/published : " << std::setw(8) << s.cpuSec * 1.0e9/nmsg
+                  << " rcvbuf : " << s.rcvbuf
+                  << (s.outOfOrder ? " out of order : " + std::to_string(s.outOfOrder) : "")
+                  << (s.ended ? "" : " (no END)") << std::endl;
+    }
+    std::cout << "Filtering     : " << nsPerMsg << " cpu ns per published message\n";
+}
+
+// Mean receive rate and total missing of subscribers 1..n-1.
+
+static std::pair<double, size_t>
+others(const PubsubResult& r) {
+    double rate(0);
+    size_t missing(0);
+    for (int i = 1; i < r.subscribers.size(); i++) {
+        rate    += r.rate(i)/(r.subscribers.size() - 1);
+        missing += r.subscribers[i].missing;
+    }
+    return std::pair<double, size_t>(rate, missing);
+}
+
+// entry point
+
+int main(int argc, char** argv) {
+    // Get the parameters, not production code:
+
+    Options options(argc, argv);
+    std::string uri(options[0]);
+    size_t nmsg    = atol(options[1].c_str());
+    size_t msgsize = atol(options[2].c_str());
+    int    nsubs   = atoi(options[3].c_str());
+    double match   = atof(options.value("match", "0.1").c_str());
+    std::vector<size_t> counts;
+    std::stringstream countList(options.value("subscriptions", "1000"));
+    std::string item;
+    while (std::getline(countList, item, ',')) {
+        if (!item.empty()) counts.push_back(atol(item.c_str()));
+    }
+    std::vector<int> lengths;
+    auto lengthDist = parseLengths(options.value("prefix-lengths", "4-16"), lengths);
+    PubsubSettings settings;
+    settings.sndbuf = options.number("sndbuf", 0);
+    settings.rcvbuf = options.number("rcvbuf", 0);
+    std::string slow = options.value("slow");
+    OutputFormat format = parseFormat(options.value("format"));
+    RecordWriter* writer = format == OutputFormat::TEXT ? nullptr : new RecordWriter(std::cout, format);
+
+    // With --slow each count is timed without then with the slow subscriber.
+
+    std::vector<uint64_t> slowNs(1, 0);
+    if (!slow.empty()) slowNs.push_back(PhaseSpec::parseTime(slow));
+
+    std::vector<std::pair<size_t, double>> filtering;     // subscriptions, ns/msg.
+    for (size_t count : counts) {
+        std::mt19937 rng(count);                          // Same sets run to run.
+        auto subscriptions = makeSubscriptions(count, lengths, lengthDist, rng);
+        auto topics        = makeTopics(subscriptions, match, rng);
+
+        std::vector<PubsubResult> results;
+        for (auto ns : slowNs) {
+            settings.slowNs = ns;
+            double cpuStart = cpuSeconds();
+            results.push_back(
+                timeSubscriptions(uri, nmsg, msgsize, nsubs, subscriptions, topics, settings)
+            );
+            double cpu = cpuSeconds() - cpuStart;
+            PubsubResult& r(results.back());
+
+            size_t received(0);
+            double subCpu(0);
+            for (auto& s : r.subscribers) {
+                received += s.received;
+                subCpu   += s.cpuSec;
+            }
+            if (!ns) {
+                filtering.push_back(std::pair<size_t, double>(count, nmsg ? subCpu/nsubs * 1.0e9/nmsg : 0.0));
+            }
+
+            if (writer) {
+                RunRecord record;
+                record.benchmark  = "pubsub";
+                record.mode       = "subs" + std::to_string(count) + (ns ? "/slow" + slow : "");
+                record.uri        = uri;
+                record.msgsize    = msgsize;
+                record.senders    = 1;
+                record.receivers  = nsubs;
+                record.messages   = nmsg;
+                record.bytes      = (uint64_t)nmsg * msgsize;
+                record.durationNs = r.pubSeconds * 1.0e9;
+                record.cpuSec     = cpu;
+                writer->write(record);
+            } else {
+                report(count, match, nmsg, r);
+            }
+        }
+        if (!writer && results.size() > 1 && nsubs > 1) {
+            auto before = others(results[0]);
+            auto after  = others(results[1]);
+            std::cout << "Others        : msg/sec " << before.first << " -> " << after.first
+                      << "  missing " << before.second << " -> " << after.second
+                      << " with subscriber 0 slowed\n";
+        }
+    }
+    if (!writer && filtering.size() > 1) {
+        std::cout << "Subscriptions   cpu ns/published msg\n";
+        for (auto& f : filtering) {
+            std::cout << std::setw(13) << f.first << "   " << f.second << std::endl;
+        }
+    }
+    delete writer;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,241 @@
+/**
+ * Machine readable results for the performance programs.
+ *
+ * Each timed run is described by a RunRecord.  A RecordWriter outputs records as
+ * either CSV (a header line followed by one line per run) or JSON lines (one JSON
+ * object per run, per line).  The same columns are used by every program and by the
+ * sweep driver so result files from different runs, releases and hosts can be compared
+ * (see compare.cpp).
+ *
+ * Columns:
+ *    benchmark, mode, transport, uri, msgsize, senders, receivers, messages, bytes,
+ *    duration_ns, msg_per_sec, bytes_per_sec, cpu_sec, p50_us, p99_us, p999_us,
+ *    ctx_switches, alloc_calls, memory_kb, host, os, machine, ncpu, nanomsg_abi, timestamp
+ *
+ * The latency columns are 0 for benchmarks that don't measure per message latency.
+ * ctx_switches and alloc_calls are process totals over the timed run and memory_kb is
+ * how much the process grew setting the run up;  they're 0 where not measured.
+ */
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <nanomsg/nn.h>
+#include <stdint.h>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <ctime>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include <sys/resource.h>
+
+enum class OutputFormat {
+    TEXT,          // The programs' own human readable output.
+    CSV,
+    JSON
+};
+
+// --format=text|csv|json  (anything else is text).
+
+inline OutputFormat
+parseFormat(const std::string& format) {
+    if (format == "csv")  return OutputFormat::CSV;
+    if (format == "json") return OutputFormat::JSON;
+    return OutputFormat::TEXT;
+}
+
+// Process CPU time (user + system, all threads) in seconds.
+
+inline double
+cpuSeconds() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec/1.0e6 +
+        usage.ru_stime.tv_sec + usage.ru_stime.tv_usec/1.0e6;
+}
+
+// Process context switches so far (voluntary + involuntary, all threads).
+
+inline long
+contextSwitches() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+// Resident set size of the process in KB.
+
+inline long
+residentKb() {
+    std::ifstream statm("/proc/self/statm");
+    long pages(0), resident(0);
+    statm >> pages >> resident;
+    return resident * (sysconf(_SC_PAGESIZE)/1024);
+}
+
+// The scheme part of a URI e.g. tcp.
+
+inline std::string
+transportOf(const std::string& uri) {
+    auto colon = uri.find("://");
+    return colon == std::string::npos ? std::string("") : uri.substr(0, colon);
+}
+
+struct HostInfo {
+    std::string host;
+    std::string os;            // sysname release
+    std::string machine;
+    unsigned    ncpu;
+    std::string nanomsgAbi;    // current.revision.age
+
+    static const HostInfo& get() {
+        static HostInfo info = make();
+        return info;
+    }
+private:
+    static HostInfo make() {
+        HostInfo info;
+        char name[256];
+        if (gethostname(name, sizeof(name)) == 0) {
+            name[sizeof(name)-1] = 0;
+            info.host = name;
+        }
+        utsname u;
+        if (uname(&u) == 0) {
+            info.os      = std::string(u.sysname) + " " + u.release;
+            info.machine = u.machine;
+        }
+        info.ncpu = std::thread::hardware_concurrency();
+        info.nanomsgAbi = std::to_string(NN_VERSION_CURRENT) + "." +
+            std::to_string(NN_VERSION_REVISION) + "." + std::to_string(NN_VERSION_AGE);
+        return info;
+    }
+};
+
+struct RunRecord {
+    std::string benchmark;       // e.g. pipeline, reqrep-bigreply.
+    std::string mode;            // e.g. copy, zerocopy, window8.
+    std::string uri;
+    size_t      msgsize    = 0;
+    size_t      senders    = 0;
+    size_t      receivers  = 0;
+    size_t      messages   = 0;
+    uint64_t    bytes      = 0;  // Payload bytes moved.
+    uint64_t    durationNs = 0;
+    double      cpuSec     = 0.0;
+    double      p50us      = 0.0;
+    double      p99us      = 0.0;
+    double      p999us     = 0.0;
+    long        contextSwitches = 0;
+    uint64_t    allocatorCalls  = 0;
+    long        memoryKb        = 0;
+
+    double msgPerSec() const {
+        return durationNs ? messages * 1.0e9/durationNs : 0.0;
+    }
+    double bytesPerSec() const {
+        return durationNs ? bytes * 1.0e9/durationNs : 0.0;
+    }
+};
+
+class RecordWriter {
+private:
+    std::ostream& m_out;
+    OutputFormat  m_format;
+    bool          m_needHeader;
+public:
+    /**
+     * @param out - where the records go.
+     * @param format - CSV or JSON.
+     * @param header - For CSV, whether to write the header line before the first record.
+     */
+    RecordWriter(std::ostream& out, OutputFormat format, bool header = true) :
+        m_out(out), m_format(format), m_needHeader(header && format == OutputFormat::CSV) {}
+
+    void write(const RunRecord& r) {
+        const HostInfo& h(HostInfo::get());
+        std::string stamp = timestamp();
+        if (m_format == OutputFormat::CSV) {
+            if (m_needHeader) {
+                m_out << "benchmark,mode,transport,uri,msgsize,senders,receivers,messages,bytes,"
+                      << "duration_ns,msg_per_sec,bytes_per_sec,cpu_sec,p50_us,p99_us,p999_us,"
+                      << "ctx_switches,alloc_calls,memory_kb,host,os,machine,ncpu,nanomsg_abi,timestamp\n";
+                m_needHeader = false;
+            }
+            m_out << csv(r.benchmark) << ',' << csv(r.mode) << ',' << csv(transportOf(r.uri)) << ','
+                  << csv(r.uri) << ',' << r.msgsize << ',' << r.senders << ',' << r.receivers << ','
+                  << r.messages << ',' << r.bytes << ',' << r.durationNs << ','
+                  << r.msgPerSec() << ',' << r.bytesPerSec() << ',' << r.cpuSec << ','
+                  << r.p50us << ',' << r.p99us << ',' << r.p999us << ','
+                  << r.contextSwitches << ',' << r.allocatorCalls << ',' << r.memoryKb << ','
+                  << csv(h.host) << ',' << csv(h.os) << ',' << csv(h.machine) << ',' << h.ncpu << ','
+                  << csv(h.nanomsgAbi) << ',' << stamp << std::endl;
+        } else {
+            m_out << "{\"benchmark\":" << json(r.benchmark)
+                  << ",\"mode\":" << json(r.mode)
+                  << ",\"transport\":" << json(transportOf(r.uri))
+                  << ",\"uri\":" << json(r.uri)
+                  << ",\"msgsize\":" << r.msgsize
+                  << ",\"senders\":" << r.senders
+                  << ",\"receivers\":" << r.receivers
+                  << ",\"messages\":" << r.messages
+                  << ",\"bytes\":" << r.bytes
+                  << ",\"duration_ns\":" << r.durationNs
+                  << ",\"msg_per_sec\":" << r.msgPerSec()
+                  << ",\"bytes_per_sec\":" << r.bytesPerSec()
+                  << ",\"cpu_sec\":" << r.cpuSec
+                  << ",\"p50_us\":" << r.p50us
+                  << ",\"p99_us\":" << r.p99us
+                  << ",\"p999_us\":" << r.p999us
+                  << ",\"ctx_switches\":" << r.contextSwitches
+                  << ",\"alloc_calls\":" << r.allocatorCalls
+                  << ",\"memory_kb\":" << r.memoryKb
+                  << ",\"host\":" << json(h.host)
+                  << ",\"os\":" << json(h.os)
+                  << ",\"machine\":" << json(h.machine)
+                  << ",\"ncpu\":" << h.ncpu
+                  << ",\"nanomsg_abi\":" << json(h.nanomsgAbi)
+                  << ",\"timestamp\":" << json(stamp)
+                  << "}" << std::endl;
+        }
+    }
+private:
+    static std::string timestamp() {
+        char buffer[32];
+        time_t now = time(nullptr);
+        tm utc;
+        gmtime_r(&now, &utc);
+        strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", &utc);
+        return buffer;
+    }
+    static std::string csv(const std::string& s) {
+        if (s.find_first_of(",\"\n") == std::string::npos) return s;
+        std::string result("\"");
+        for (auto c : s) {
+            if (c == '"') result += '"';
+            result += c;
+        }
+        return result + "\"";
+    }
+    static std::string json(const std::string& s) {
+        std::string result("\"");
+        for (auto c : s) {
+            if (c == '"' || c == '\\') {
+                result += '\\';
+                result += c;
+            } else if ((unsigned char)c < 0x20) {
+                char esc[8];
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+                result += esc;
+            } else {
+                result += c;
+            }
+        }
+        return result + "\"";
+    }
+};
+
+#endif
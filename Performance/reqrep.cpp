@@ -6,113 +6,194 @@
  * 
  * Usage:
  * 
- *    reqrep uri nmsgs msgsize
+ *    reqrep uri nmsgs msgsize [--zerocopy] [--gather] [--pool] [--fixed-recv]
+ *           [--pipelined[=maxwindow]] [--clients=n [--coroutines[=nthreads]]]
+ *           [--warmup=n|time] [--duration=time] [--interval=time]
+ *           [--placement=same-core|same-socket|cross-socket|all] [--requester-cpus=spec]
+ *           [--replier-cpus=spec] [--buffer-node=n] [--format=text|csv|json]
  * 
  * Where:
  * *   uri is the communications endpoint
- * *   nmsgs is the nummber of req/rep pairs to excxhange.
+ * *   nmsgs is the nummber of req/rep pairs to excxhange (and time).
  * *   msgsize is the size of the large message.
+ * *   --zerocopy  - In addition to copying sends from a user buffer, time sends of
+ *     nn_allocmsg chunks with NN_MSG (see chunkpool.h).  Results are output side by side.
+ * *   --gather - Also time sending each message as a small header and a separate payload
+ *     (see framing.h), concatenated into one buffer (concat) and as two nn_iovecs with
+ *     nn_sendmsg (gather).  Both ends receive into their own header and payload buffers.
+ * *   --pool - Also time sending from and receiving (nn_recv with a fixed size) into buffers
+ *     from a size classed, per thread cached MessagePool (msgpool.h).
+ * *   --fixed-recv - Also time the copy and zero copy modes with both ends receiving into one
+ *     preallocated buffer of the message size that's reused (see framing.h) rather than
+ *     taking nanomsg's chunk.  A message that doesn't fit is an error, not truncated.
+ * *   --pipelined - Instead of lock-step REQ/REP, use AF_SP_RAW sockets to keep a window
+ *     of requests outstanding, matching replies to requests by the request ID in the
+ *     SP header.  The window is doubled from 1 to maxwindow (default 256) and the throughput
+ *     and latency percentiles are output for each window size.
+ * *   --clients - Instead, time n clients, each with its own REQ socket, doing lock-step
+ *     copy exchanges with one replier.  nmsgs is shared among them.  Each client has a
+ *     thread of its own.
+ * *   --coroutines - With --clients, also time the clients as coroutines (../nncoro.h)
+ *     on nthreads (default 4) threads.  The two are output side by side along with the
+ *     growth in resident memory from connecting the clients (Mem KB) and per client.
+ * *   --warmup - Exchange n pairs (or exchange for a time e.g. 2s) before timing.
+ * *   --duration - Time for a duration rather than for nmsgs pairs.
+ * *   --interval - Sample the throughput every interval (e.g. 100ms) and output msg/sec
+ *     over time (see phases.h).
+ * *   --placement - Pin the requestor and replier in a layout built from the machine
+ *     topology (see affinity.h).  all times every layout this machine has in turn.
+ * *   --requester-cpus, --replier-cpus - Pin the requestor/replier to a CPU (3), range of
+ *     CPUs (0-3) or NUMA node (node1).  These override --placement.
+ * *   --buffer-node - Allocate message buffers on this NUMA node.
+ * *   --format - text (default) is the human readable output.  csv and json output
+ *     one record per timed run (see record.h).
  * 
- * Output timings include the Time, msgs/sec and kbytes/sec for both large and small
+ * Only the measurement phase is timed (ns resolution steady clock) and only its round
+ * trips go into the latency histogram.  Output timings include the Time, msgs/sec and kbytes/sec for both large and small
  * REQ.
  * 
+ * In addition each REQ/REP round trip is timed individually by the requestor and
+ * recorded in a LatencyHistogram (see histogram.h).  The latency percentiles
+ * and the distribution of round trip times are output for each case.
+ * 
  */
-#include <thread>
-#include <nanomsg/nn.h>
-#include <nanomsg/reqrep.h>
 #include <stdlib.h>
 #include <iostream>
-#include <stdlib.h>
-#include <unistd.h>
 #include <string>
-#include <string.h>
-#include <latch>
-#include <chrono>
 #include <vector>
-#include <chrono>
-
-// Useful error checking method:
-// Returns int since e.g. socket returns the socket on ok.
-static int
-checkstat(int status, const char* msg) {
-    if (status < 0) {
-        std::cerr << msg << nn_strerror(nn_errno()) << std::endl;
-        exit(EXIT_FAILURE);
-    }
-    return status;
-}
+#include <iomanip>
+#include <algorithm>
+#include "options.h"
+#include "reqrepbench.h"
+#include "record.h"
 
 /**
- *  requestor thread:
- * @param uri  - uri to connect to the replier with.
- * @param nreq - number of requests to make.
- * @param size - Size of the request
+ * report
+ *    Output the timings for one case.  If there's more than one timing
+ * (one per send mode), they are output side by side followed by the latencies for each.
  */
 static void
-requestThread(std::string uri, size_t nreq, size_t size) {
-    char* request = new char[size];    // Recycle the req buffer.
-
-    // set up the requstor
-
-    int socket = checkstat(
-        nn_socket(AF_SP, NN_REQ),
-        "Failed to open the request socket."
-    );
-    int endpoint = checkstat(
-        nn_connect(socket, uri.c_str()),
-        "Failed to connect to the replier."
-    );
-
-    char* reply(nullptr);
-    for (int i = 0;  i < nreq; i++) {
-        checkstat(
-            nn_send(socket, request, size, 0),
-            "Failed to make a request"
-        );
-        reply = nullptr;
-        checkstat(
-            nn_recv(socket, &reply, NN_MSG, 0),
-            "Failed to receive a reply"
-        );
-        nn_freemsg(reply);
+report(
+    const char* title, const std::vector<std::string>& names, const std::vector<Timing*>& timings,
+    size_t msgsize
+) {
+    std::cout << title << std::endl;
+    if (timings.size() > 1) {
+        std::cout << "           ";
+        for (auto& name : names) std::cout << std::setw(14) << name << "  ";
+        std::cout << std::endl;
+    }
+    std::cout << "Time     : ";
+    for (auto t : timings) std::cout << std::setw(14) << t->seconds << "  ";
+    std::cout << std::endl;
+    std::cout << "Mesg/sec : ";
+    for (auto t : timings) std::cout << std::setw(14) << (double)t->messages/t->seconds << "  ";
+    std::cout << std::endl;
+    std::cout << "KB/sec   : ";
+    for (auto t : timings) std::cout << std::setw(14) << (double)(t->messages*msgsize)/(t->seconds * 1024.0) << "  ";
+    std::cout << std::endl;
+    std::cout << "Allocs   : ";                 // Allocator calls per round trip.
+    for (auto t : timings) std::cout << std::setw(14) << t->allocsPerTrip << "  ";
+    std::cout << std::endl;
+    if (timings[0]->clients > 1) {
+        std::cout << "Mem KB   : ";
+        for (auto t : timings) std::cout << std::setw(14) << t->memoryKb << "  ";
+        std::cout << std::endl;
+        std::cout << "KB/client: ";
+        for (auto t : timings) std::cout << std::setw(14) << (double)t->memoryKb/t->clients << "  ";
+        std::cout << std::endl;
+    }
+
+    for (int i = 0; i < timings.size(); i++) {
+        if (timings.size() > 1) std::cout << names[i] << ":\n";
+        timings[i]->latencies.printPercentiles(std::cout);
+        timings[i]->latencies.printDistribution(std::cout);
+        printSamples(std::cout, timings[i]->samples);
     }
-    delete []request;
-    checkstat(
-        nn_shutdown(socket, endpoint),
-        "could not shutdown req endpoint"
-    );
-    checkstat(
-        nn_close(socket),
-        "Could not close req socket."
-    );
 }
 
-/*
-   replier - handles requests.
+// Record mode with the placement, if any, appended.
 
-   @param socket - socket we send/receive on.
-   @param nreq - Number of requests to handle.
-   @param size   Size of the reply.
+static std::string
+modeName(const std::string& mode, const Placement& placement) {
+    return placement.name.empty() ? mode : mode + "/" + placement.name;
+}
+
+/**
+ * clients
+ *    Time nclients clients with a thread each and, if threads isn't 0, as coroutines on
+ * that many threads, for both the big reply and big request cases.
+ */
+static void
+clients(
+    const std::string& uri, const PhaseSpec& phases, size_t msgsize, size_t nclients,
+    size_t threads, const Placement& placement, RecordWriter* writer
+) {
+    std::vector<size_t> kinds = {0};
+    if (threads) kinds.push_back(threads);
+    std::vector<std::string> names;
+    std::vector<Timing*> brtimings;
+    std::vector<Timing*> srtimings;
+    for (auto k : kinds) {
+        names.push_back(k ? "coroutine" + std::to_string(k) : std::string("threads"));
+        brtimings.push_back(new Timing);
+        runClients(uri, phases, 1, msgsize, nclients, k, placement, *brtimings.back());
+        srtimings.push_back(new Timing);
+        runClients(uri, phases, msgsize, 1, nclients, k, placement, *srtimings.back());
+    }
+    if (writer) {
+        for (int i = 0; i < kinds.size(); i++) {
+            std::string name = modeName(names[i], placement);
+            writer->write(reqrepRecord("reqrep-clients-bigreply", name, uri, msgsize, msgsize + 1, *brtimings[i]));
+            writer->write(reqrepRecord("reqrep-clients-bigrequest", name, uri, msgsize, msgsize + 1, *srtimings[i]));
+        }
+    } else {
+        std::cout << nclients << " clients" << std::endl;
+        report("Small requests big replies", names, brtimings, msgsize);
+        report("Big requests small replies", names, srtimings, msgsize);
+    }
+    for (auto t : brtimings) delete t;
+    for (auto t : srtimings) delete t;
+}
 
-*/
+/**
+ * pipelined
+ *    Run the window sweep for both the big reply and big request cases
+ * and output a table for each (or records if writer is not null).
+ */
 static void
-replier(int socket, size_t nreq, size_t size) {
-    char* reply  = new char[size];
-    void* request;
-    for (int i =0; i < nreq; i++) {
-        request = nullptr;
-        checkstat(
-            nn_recv(socket, &request, NN_MSG, 0),
-            "Failed to get  a request"
-        );
-        nn_freemsg(request);
-
-        checkstat(
-            nn_send(socket, reply, size, 0),
-            "Failed to send a reply"
-        );
+pipelined(
+    const std::string& uri, const PhaseSpec& phases, size_t msgsize, size_t maxWindow,
+    const Placement& placement, RecordWriter* writer
+) {
+    const char* benchmarks[2] = {"reqrep-pipelined-bigreply", "reqrep-pipelined-bigrequest"};
+    const char* titles[2] = {"Pipelined small requests big replies", "Pipelined big requests small replies"};
+    size_t reqSizes[2] = {1, msgsize};
+    size_t repSizes[2] = {msgsize, 1};
+    for (int c = 0; c < 2; c++) {
+        if (!writer) std::cout << titles[c] << std::endl;
+        if (!writer) std::cout << "window       Time       Mesg/sec         KB/sec    p50(us)    p99(us)  p99.9(us)  unmatched\n";
+        // Doubling, but the last window is maxWindow even if it isn't a power of two.
+
+        for (size_t window = 1; window <= maxWindow;
+             window = window < maxWindow ? std::min(2*window, maxWindow) : 2*window) {
+            Timing timing;
+            runWindowed(uri, phases, reqSizes[c], repSizes[c], window, placement, timing);
+            if (writer) {
+                writer->write(reqrepRecord(benchmarks[c], modeName("window" + std::to_string(window), placement),
+                    uri, msgsize, reqSizes[c] + repSizes[c], timing));
+                continue;
+            }
+            std::cout << std::setw(6) << window << " "
+                << std::setw(10) << timing.seconds << " "
+                << std::setw(14) << (double)timing.messages/timing.seconds << " "
+                << std::setw(14) << (double)(timing.messages*msgsize)/(timing.seconds * 1024.0) << " "
+                << std::setw(10) << timing.latencies.valueAtPercentile(50.0)/1000.0 << " "
+                << std::setw(10) << timing.latencies.valueAtPercentile(99.0)/1000.0 << " "
+                << std::setw(10) << timing.latencies.valueAtPercentile(99.9)/1000.0 << " "
+                << std::setw(10) << timing.unmatched << std::endl;
+        }
     }
-    delete []reply;
 }
 
 // entry point.
@@ -120,78 +201,73 @@ replier(int socket, size_t nreq, size_t size) {
 int main(int argc, char** argv) {
     // get parameters, not production:
 
-    std::string uri(argv[1]);
-    size_t nmsg = atoi(argv[2]);
-    size_t msgsize = atoi(argv[3]);
-
-    // set up the req listener.
-
-    int socket = checkstat(
-        nn_socket(AF_SP, NN_REP),
-        "Failed to open the reply socket"
-    );
-    int endpoint = checkstat(
-        nn_bind(socket, uri.c_str()),
-        "Failed to bind reply socket."
-    );
-    // Small req, big replies.
-    
-    std::thread req(requestThread, uri, nmsg, 1);
-
-    // --------------------------  Timing.
-
-    auto brstart = std::chrono::high_resolution_clock::now();
-    replier(socket, nmsg, msgsize);
-    req.join();
-    auto brend =  std::chrono::high_resolution_clock::now();
-    // ----------------------------- done.
-
-    // big requests small replies.
-
-    std::thread reqb(requestThread, uri, nmsg, msgsize);
-
-    //--------------------- timing
-    auto srstart = std::chrono::high_resolution_clock::now();
-    replier(socket, nmsg, 1);
-    reqb.join();
-    auto srend = std::chrono::high_resolution_clock::now();
-
-    // Shutdown the socket.
-
-    checkstat(
-        nn_shutdown(socket, endpoint),
-        "Failed to shutdown reply socket"
-    );
-    checkstat(
-        nn_close(socket),
-        "Failed to close reply socket."
-    );
+    Options options(argc, argv);
+    std::string uri(options[0]);
+    size_t nmsg = atoi(options[1].c_str());
+    size_t msgsize = atoi(options[2].c_str());
+    auto   modes = requestedModes(options);
+    auto   recvModes = requestedRecvModes(options);
+    PhaseSpec phases = PhaseSpec::fromOptions(options, nmsg);
+    long nclients = options.number("clients", 1);
+    if (options.flag("clients") && nclients <= 0) {
+        std::cerr << "--clients needs at least one client\n";
+        exit(EXIT_FAILURE);
+    }
+    OutputFormat format = parseFormat(options.value("format"));
+    RecordWriter* writer = format == OutputFormat::TEXT ? nullptr : new RecordWriter(std::cout, format);
 
-    /// Report timigs.
+    for (auto& layout : Placement::requested(options)) {
+        Placement placement = Placement::fromOptions(options, layout, "requester", "replier", 1, 1);
+        if (!writer && !placement.name.empty()) {
+            std::cout << "Placement: " << placement.name << std::endl;
+        }
+        if (options.flag("pipelined")) {
+            pipelined(uri, phases, msgsize, options.number("pipelined", 256), placement, writer);
+            continue;
+        }
+        if (options.flag("clients")) {
+            size_t threads = options.flag("coroutines") ? options.number("coroutines", 4) : 0;
+            clients(uri, phases, msgsize, nclients, threads, placement, writer);
+            continue;
+        }
 
-    auto brequestduration = brend - brstart;
-    double brtiming = (double)std::chrono::duration_cast<std::chrono::milliseconds>(brequestduration).count()/1000.0;
+        // Small req, big replies then big requests small replies;  copy and,
+        // if requested, zero copy, concat/gather, pooled and fixed buffer receives.
 
-    double brmsgTiming = (double)nmsg / brtiming;
-    double brxferrate  = (double)(nmsg* msgsize)/(brtiming * 1024.0);
+        std::vector<std::string> names;
+        std::vector<Timing*> brtimings;
+        std::vector<Timing*> srtimings;
+        for (auto mode : modes) {
+            for (auto recvMode : recvModes) {
+                if (recvMode == RecvMode::FIXED && !receivesChunks(mode)) continue;
+                names.push_back(sendRecvName(mode, recvMode));
+                brtimings.push_back(new Timing);
+                runExchange(uri, phases, 1, msgsize, mode, recvMode, placement, *brtimings.back());
 
-    std::cout << "Big request small replies\n";
-    std::cout << "Time     : " << brtiming << std::endl;
-    std::cout << "Mesg/sec : " << brmsgTiming << std::endl;
-    std::cout << "KB/sec   : " << brxferrate << std::endl;
+                srtimings.push_back(new Timing);
+                runExchange(uri, phases, msgsize, 1, mode, recvMode, placement, *srtimings.back());
+            }
+        }
 
-    auto smrequestduration = srend - srstart;
-    auto srtiming = (double)std::chrono::duration_cast<std::chrono::milliseconds>(smrequestduration).count()/1000.0;
-    double srmsgTiming = (double)nmsg/srtiming;
-    double srxferrate = (double)(nmsg*msgsize)/(srtiming * 1024.0);
+        /// Report timigs.
 
-    std::cout << "Small request big reqplies: \n";
-    std::cout << "Time     : " << srtiming << std::endl;
-    std::cout << "msg/seq  : " << srmsgTiming << std::endl;
-    std::cout << "KB/sec   : " << srxferrate << std::endl;
+        if (writer) {
+            for (int i = 0; i < names.size(); i++) {
+                std::string name = modeName(names[i], placement);
+                writer->write(reqrepRecord("reqrep-bigreply", name, uri, msgsize, msgsize + 1, *brtimings[i]));
+                writer->write(reqrepRecord("reqrep-bigrequest", name, uri, msgsize, msgsize + 1, *srtimings[i]));
+            }
+        } else {
+            report("Big request small replies", names, brtimings, msgsize);
+            report("Small request big reqplies: ", names, srtimings, msgsize);
+        }
 
+        for (auto t : brtimings) delete t;
+        for (auto t : srtimings) delete t;
+    }
+    delete writer;
 
     return EXIT_SUCCESS;
 
 
-}
\ No newline at end of file
+}
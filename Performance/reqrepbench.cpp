@@ -0,0 +1,773 @@
+/**
+ * The REQ/REP timing code.  This is used by the reqrep program and the sweep
+ * driver.  See reqrep.cpp for a description of what's timed.
+ */
+#include <thread>
+#include <nanomsg/nn.h>
+#include <nanomsg/reqrep.h>
+#include <stdlib.h>
+#include <iostream>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <string.h>
+#include <latch>
+#include <chrono>
+#include <vector>
+#include <iomanip>
+#include <utility>
+#include <arpa/inet.h>
+#include "reqrepbench.h"
+#include "chunkpool.h"
+#include "framing.h"
+#include "record.h"
+#include "msgpool.h"
+#include "allocount.h"
+#include "../nnpp.h"
+#include "../nncoro.h"
+
+/**
+ * Send a message either by copying it from a user buffer or, if a pool is
+ * supplied, zero copy from a pool chunk or, if a frame is supplied, as a header
+ * and payload (see framing.h) or, if pooled, by copying it from a MessagePool buffer.
+ * 
+ * @param socket - socket to send on.
+ * @param buffer - User buffer (copy sends).
+ * @param size   - message size.
+ * @param pool   - If not null, the chunk pool for zero copy sends.
+ * @param frame  - If not null, the header and payload for framed sends.
+ * @param pooled - Send from a MessagePool buffer (see msgpool.h).
+ * @param msg    - Error message if the send fails.
+ */
+static int
+sendMessage(
+    int socket, const char* buffer, size_t size, ChunkPool* pool, FramedMessage* frame,
+    bool pooled, const char* msg
+) {
+    if (frame) {
+        return checkstat(frame->send(socket, 0), msg);
+    }
+    if (pooled) {
+        void* message = MessagePool::get(size);
+        int stat = nn_send(socket, message, size, 0);
+        MessagePool::put(message, size);
+        return checkstat(stat, msg);
+    }
+    if (!pool) {
+        return checkstat(nn_send(socket, buffer, size, 0), msg);
+    }
+    void* chunk = pool->get();
+    void* p     = chunk;                 // nn_send wants a pointer to the pointer.
+    int stat = nn_send(socket, &p, NN_MSG, 0);
+    if (stat < 0) {
+        pool->putBack(chunk);            // Nanomsg did not take it.
+    }
+    return checkstat(stat, msg);
+}
+
+/**
+ * Receive a message - into the frame's header and payload if there is one, into a
+ * MessagePool buffer for messages up to pooled bytes if that's not 0, into the fixed
+ * buffer if there is one (a message that doesn't fit is an error), otherwise
+ * we take nanomsg's chunk and free it.
+ * 
+ * @return the size of the message.
+ */
+static int
+receiveMessage(
+    int socket, FramedMessage* frame, size_t pooled, FixedBuffer* fixed, const char* msg
+) {
+    if (frame) {
+        return checkstat(frame->recv(socket, 0), msg);
+    }
+    if (fixed) {
+        return checkstat(fixed->recv(socket, 0), msg);
+    }
+    if (pooled) {
+        void* message = MessagePool::get(pooled);
+        int n = nn_recv(socket, message, MessagePool::capacity(pooled), 0);
+        MessagePool::put(message, pooled);
+        return checkstat(n, msg);
+    }
+    void* chunk(nullptr);
+    int n = checkstat(nn_recv(socket, &chunk, NN_MSG, 0), msg);
+    nn_freemsg(chunk);
+    return n;
+}
+
+// Frame for messages of size in a framed mode, else nullptr.
+
+static FramedMessage*
+makeFrame(SendMode mode, size_t size) {
+    return isFramed(mode) ? new FramedMessage(size, mode == SendMode::GATHER) : nullptr;
+}
+// Buffer for FIXED receives of messages up to size, nullptr if they take chunks.
+
+static FixedBuffer*
+makeFixed(SendMode mode, RecvMode recvMode, size_t size) {
+    return recvMode == RecvMode::FIXED && receivesChunks(mode) ? new FixedBuffer(size) : nullptr;
+}
+
+/**
+ *  requestor thread:
+ *     Makes requests until the clock says the measurement phase is done, then
+ *  sends a zero length request to tell the replier to stop.
+ * @param uri  - uri to connect to the replier with.
+ * @param phases - Warmup and measurement phases.
+ * @param size - Size of the request
+ * @param repSize - Size of the reply (framed modes receive into a buffer this big).
+ * @param timing - Receives the measured time, count, samples and round trip times (ns).
+ * @param mode  - How requests are sent (and, if framed or pooled, replies received).
+ * @param recvMode - How copy/zero copy replies are received.
+ * @param placement - CPUs/NUMA node for this thread.
+ */
+static void
+requestThread(
+    std::string uri, PhaseSpec phases, size_t size, size_t repSize, Timing* timing, SendMode mode,
+    RecvMode recvMode, ThreadPlacement placement
+) {
+    placement.apply();
+    char* request = new char[size];    // Recycle the req buffer.
+    ChunkPool* pool = mode == SendMode::ZEROCOPY ? new ChunkPool(size, ChunkPool::depthFor(size)) : nullptr;
+    FramedMessage* framedRequest = makeFrame(mode, size);
+    FramedMessage* framedReply   = makeFrame(mode, repSize);
+    FixedBuffer* fixedReply      = makeFixed(mode, recvMode, repSize);
+    bool pooled = mode == SendMode::POOLED;
+    PhaseClock clock(phases);
+
+    // set up the requstor
+
+    Socket requestor(AF_SP, NN_REQ, "Failed to open the request socket.");
+    Endpoint endpoint = requestor.connect(uri, "Failed to connect to the replier.");
+    int socket = requestor.fd();
+
+    char* reply(nullptr);
+    long switches = contextSwitches();
+    uint64_t allocs = allocatorCalls();
+    clock.start();
+    while (clock.phase() != PhaseClock::DONE) {
+        auto sent = std::chrono::steady_clock::now();
+        sendMessage(socket, request, size, pool, framedRequest, pooled, "Failed to make a request");
+        receiveMessage(
+            socket, framedReply, pooled ? repSize : 0, fixedReply, "Failed to receive a reply"
+        );
+        auto received = std::chrono::steady_clock::now();
+        if (clock.measuring()) {
+            timing->latencies.record(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(received - sent).count()
+            );
+        }
+        clock.tick();
+    }
+    timing->seconds    = clock.seconds();
+    timing->cpuSeconds = clock.cpuEnd() - clock.cpuStart();
+    timing->messages   = clock.measured();
+    timing->samples    = clock.samples();
+    timing->allocatorCalls  = allocatorCalls() - allocs;
+    timing->contextSwitches = contextSwitches() - switches;
+    timing->allocsPerTrip = (double)timing->allocatorCalls/(clock.warmedUp() + clock.measured());
+
+    // Stop the replier:
+
+    checkstat(nn_send(socket, request, 0, 0), "Failed to send the stop request");
+    reply = nullptr;
+    checkstat(nn_recv(socket, &reply, NN_MSG, 0), "Failed to receive the stop reply");
+    nn_freemsg(reply);
+
+    delete []request;
+    delete pool;
+    delete framedRequest;
+    delete framedReply;
+    delete fixedReply;
+    endpoint.shutdown("could not shutdown req endpoint");
+    requestor.close("Could not close req socket.");
+}
+
+/*
+   replier - handles requests until it gets a zero length one.
+
+   @param socket - socket we send/receive on.
+   @param size   Size of the reply.
+   @param reqSize Size of the requests (framed modes receive into a buffer this big).
+   @param mode - How replies are sent (and, if framed or pooled, requests received).
+   @param recvMode - How copy/zero copy requests are received.
+   @param stops - Zero length requests to wait for (one per requestor).
+
+*/
+static void
+replier(
+    int socket, size_t size, size_t reqSize, SendMode mode, RecvMode recvMode, size_t stops = 1
+) {
+    char* reply  = new char[size];
+    ChunkPool* pool = mode == SendMode::ZEROCOPY ? new ChunkPool(size, ChunkPool::depthFor(size)) : nullptr;
+    FramedMessage* framedRequest = makeFrame(mode, reqSize);
+    FramedMessage* framedReply   = makeFrame(mode, size);
+    FixedBuffer* fixedRequest    = makeFixed(mode, recvMode, reqSize);
+    bool pooled = mode == SendMode::POOLED;
+    while (stops) {
+        int n = receiveMessage(
+            socket, framedRequest, pooled ? reqSize : 0, fixedRequest, "Failed to get  a request"
+        );
+        if (n == 0) stops--;
+
+        sendMessage(socket, reply, size, pool, framedReply, pooled, "Failed to send a reply");
+    }
+    delete []reply;
+    delete pool;
+    delete framedRequest;
+    delete framedReply;
+    delete fixedRequest;
+}
+
+/**
+ * timeExchange
+ *    Run a requestor thread against the replier.  The requestor does the timing.
+ * 
+ * @param socket - bound reply socket.
+ * @param uri    - URI the requestor connects to.
+ * @param phases - Warmup and measurement phases.
+ * @param reqSize - Size of each request.
+ * @param repSize - Size of each reply.
+ * @param mode - How messages are sent.
+ * @param recvMode - How both ends receive copy and zero copy messages.
+ * @param placement - Where the requestor and replier (this thread) run.
+ * @param[out] timing - Receives the elapsed time and round trip latencies.
+ */
+static void
+timeExchange(
+    int socket, const std::string& uri, const PhaseSpec& phases, size_t reqSize, size_t repSize,
+    SendMode mode, RecvMode recvMode, const Placement& placement, Timing& timing
+) {
+    std::thread req(
+        requestThread, uri, phases, reqSize, repSize, &timing, mode, recvMode, placement.sender(0)
+    );
+    {
+        PlacementScope pin(placement.receiver(0));
+        replier(socket, repSize, reqSize, mode, recvMode);
+    }
+    req.join();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Many clients.
+//
+// Each client has its own REQ socket and PhaseClock and does lock-step round trips
+// (copy sends, NN_MSG receives) against the one replier.  They run either a thread
+// each or as coroutines (../nncoro.h) spread over a few executor threads.  The clients
+// connect and then wait on a latch so the memory they need can be measured before any
+// of them start.  The clocks and histograms are the measurement's, not the clients',
+// so they're allocated before that;  a histogram is shared by the coroutines of an
+// executor thread.
+
+// Round trip time from sent to now, if we're measuring.
+
+static void
+recordTrip(
+    PhaseClock* clock, LatencyHistogram* latencies, std::chrono::steady_clock::time_point sent
+) {
+    if (clock->measuring()) {
+        latencies->record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - sent
+        ).count());
+    }
+    clock->tick();
+}
+
+// A client's REQ socket and its connection to the replier.
+
+static std::pair<Socket, Endpoint>
+connectClient(const std::string& uri) {
+    Socket socket(AF_SP, NN_REQ, "Failed to open a client socket.");
+    Endpoint endpoint = socket.connect(uri, "Client failed to connect to the replier.");
+    return std::pair<Socket, Endpoint>(std::move(socket), std::move(endpoint));
+}
+static void
+closeClient(std::pair<Socket, Endpoint>& client) {
+    client.second.shutdown("Could not shutdown a client endpoint.");
+    client.first.close("Could not close a client socket.");
+}
+
+/**
+ * clientThread
+ *    A client with a thread of its own.
+ * 
+ * @param uri - The replier.
+ * @param size - Request size.
+ * @param clock - Our clock, set to our share of the phases.
+ * @param latencies - Our round trip times (ns).
+ * @param ready - Counted down once we're connected.
+ * @param go - Wait on this before the first request.
+ * @param placement - CPUs/NUMA node for this thread.
+ */
+static void
+clientThread(
+    std::string uri, size_t size, PhaseClock* clock, LatencyHistogram* latencies,
+    std::latch* ready, std::latch* go, ThreadPlacement placement
+) {
+    placement.apply();
+    std::vector<char> request(size, 'x');
+    auto client = connectClient(uri);
+    int socket = client.first.fd();
+    ready->count_down();
+    go->wait();
+
+    clock->start();
+    while (clock->phase() != PhaseClock::DONE) {
+        auto sent = std::chrono::steady_clock::now();
+        checkstat(nn_send(socket, request.data(), size, 0), "Client failed to make a request");
+        void* reply(nullptr);
+        checkstat(nn_recv(socket, &reply, NN_MSG, 0), "Client failed to receive a reply");
+        nn_freemsg(reply);
+        recordTrip(clock, latencies, sent);
+    }
+    checkstat(nn_send(socket, request.data(), 0, 0), "Client failed to send the stop request");
+    void* reply(nullptr);
+    checkstat(nn_recv(socket, &reply, NN_MSG, 0), "Client failed to receive the stop reply");
+    nn_freemsg(reply);
+    closeClient(client);
+}
+
+/**
+ * clientTask
+ *    clientThread as a coroutine.  request is shared by the executor's clients.
+ */
+static Task
+clientTask(
+    Executor& executor, int socket, const char* request, size_t size, PhaseClock* clock,
+    LatencyHistogram* latencies
+) {
+    clock->start();
+    while (clock->phase() != PhaseClock::DONE) {
+        auto sent = std::chrono::steady_clock::now();
+        checkstat(
+            co_await asyncSend(executor, socket, request, size), "Client failed to make a request"
+        );
+        void* reply(nullptr);
+        checkstat(
+            co_await asyncRecv(executor, socket, &reply, NN_MSG), "Client failed to receive a reply"
+        );
+        nn_freemsg(reply);
+        recordTrip(clock, latencies, sent);
+    }
+    checkstat(
+        co_await asyncSend(executor, socket, request, 0), "Client failed to send the stop request"
+    );
+    void* reply(nullptr);
+    checkstat(
+        co_await asyncRecv(executor, socket, &reply, NN_MSG), "Client failed to receive the stop reply"
+    );
+    nn_freemsg(reply);
+    executor.forget(socket);
+}
+
+/**
+ * executorThread
+ *    Runs a clientTask for each of clocks on one thread.
+ * 
+ * @param latencies - Shared by all of our clients.
+ * @param ready - Counted down once per client when they're all connected.
+ * Other parameters are as for clientThread.
+ */
+static void
+executorThread(
+    std::string uri, size_t size, std::vector<PhaseClock*> clocks, LatencyHistogram* latencies,
+    std::latch* ready, std::latch* go, ThreadPlacement placement
+) {
+    placement.apply();
+    std::vector<char> request(size, 'x');
+    std::vector<std::pair<Socket, Endpoint>> sockets;
+    Executor executor;
+    for (auto clock : clocks) {
+        sockets.push_back(connectClient(uri));
+        executor.spawn(clientTask(
+            executor, sockets.back().first.fd(), request.data(), size, clock, latencies
+        ));
+    }
+    ready->count_down(clocks.size());
+    go->wait();
+
+    executor.run();
+    for (auto& client : sockets) {
+        closeClient(client);
+    }
+}
+
+/**
+ * timeClients
+ *    Run the clients against the replier (this thread) and combine their timings:
+ * from the first client's measurement start to the last one's end.
+ * 
+ * @param threads - 0 for a thread per client, else the executor threads.
+ * Other parameters are as for runClients.
+ */
+static void
+timeClients(
+    int socket, const std::string& uri, const PhaseSpec& phases, size_t reqSize, size_t repSize,
+    size_t clients, size_t threads, const Placement& placement, Timing& timing
+) {
+    std::vector<PhaseClock> clocks;
+    for (size_t i = 0; i < clients; i++) clocks.emplace_back(phases.share(i, clients));
+    std::vector<LatencyHistogram> latencies(threads ? threads : clients);
+    std::latch ready(clients);
+    std::latch go(1);
+
+    long memory = residentKb();
+    std::vector<std::thread*> workers;
+    if (!threads) {
+        for (size_t i = 0; i < clients; i++) {
+            workers.push_back(new std::thread(
+                clientThread, uri, reqSize, &clocks[i], &latencies[i], &ready, &go,
+                placement.sender(i)
+            ));
+        }
+    } else {
+        std::vector<std::vector<PhaseClock*>> shares(threads);
+        for (size_t i = 0; i < clients; i++) {
+            shares[i % threads].push_back(&clocks[i]);
+        }
+        for (size_t t = 0; t < threads; t++) {
+            workers.push_back(new std::thread(
+                executorThread, uri, reqSize, shares[t], &latencies[t], &ready, &go,
+                placement.sender(t)
+            ));
+        }
+    }
+    ready.wait();
+    timing.memoryKb = residentKb() - memory;
+    long switches = contextSwitches();
+    uint64_t allocs = allocatorCalls();
+    go.count_down();
+    {
+        PlacementScope pin(placement.receiver(0));
+        replier(socket, repSize, reqSize, SendMode::COPY, RecvMode::CHUNK, clients);
+    }
+    for (auto w : workers) {
+        w->join();
+        delete w;
+    }
+    allocs = allocatorCalls() - allocs;
+    timing.contextSwitches = contextSwitches() - switches;
+    timing.allocatorCalls  = allocs;
+    size_t trips(0);
+
+    auto start = clocks[0].measureStart();
+    auto end   = clocks[0].measureEnd();
+    double cpuStart = clocks[0].cpuStart();
+    double cpuEnd   = clocks[0].cpuEnd();
+    timing.messages = 0;
+    timing.samples.clear();
+    timing.latencies.reset();
+    for (auto& c : clocks) {
+        start    = std::min(start, c.measureStart());
+        end      = std::max(end, c.measureEnd());
+        cpuStart = std::min(cpuStart, c.cpuStart());
+        cpuEnd   = std::max(cpuEnd, c.cpuEnd());
+        timing.messages += c.measured();
+        trips           += c.warmedUp() + c.measured();
+        mergeSamples(timing.samples, c.samples());
+    }
+    for (auto& l : latencies) timing.latencies.add(l);
+    timing.seconds    = std::chrono::duration<double>(end - start).count();
+    timing.cpuSeconds = cpuEnd - cpuStart;
+    timing.clients    = clients;
+    timing.allocsPerTrip = (double)allocs/trips;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Pipelined (windowed) REQ/REP.
+//
+// Raw REQ/REP sockets don't enforce lock-step.  The SP header travels in the
+// control data of nn_sendmsg/nn_recvmsg as a PROTO_SP/SP_HDR message whose data is
+// a size_t header length followed by the header.  For REQ the header is a 32 bit
+// big endian request ID with the top bit set.  The raw REP side echoes back whatever header came with the request
+// so the replier never needs to look inside it.
+
+/**
+ * rawReplier
+ *    Handle requests on a raw REP socket until a zero length one arrives.  The request
+ * header (control data) is passed back with the reply, just like nn_device would.
+ * 
+ * @param socket - AF_SP_RAW NN_REP socket.
+ * @param size   - Reply size.
+ */
+static void
+rawReplier(int socket, size_t size) {
+    char* reply = new char[size];
+    bool done(false);
+    while (!done) {
+        void* request(nullptr);
+        void* control(nullptr);
+        nn_iovec iov = {&request, NN_MSG};
+        nn_msghdr hdr = {&iov, 1, &control, NN_MSG};
+        int n = checkstat(
+            nn_recvmsg(socket, &hdr, 0),
+            "Raw replier failed to get a request"
+        );
+        nn_freemsg(request);
+        done = n == 0;
+
+        // Send the reply with the request's header - nanomsg takes the control chunk.
+
+        nn_iovec riov = {reply, size};
+        nn_msghdr rhdr = {&riov, 1, &control, NN_MSG};
+        int stat = nn_sendmsg(socket, &rhdr, 0);
+        if (stat < 0) nn_freemsg(control);
+        checkstat(stat, "Raw replier failed to send a reply");
+    }
+    delete []reply;
+}
+
+/**
+ * requestId
+ *    Pull the request ID out of the SP header in a received message's control data.
+ * @return the ID or -1 if there's no header.
+ */
+static long
+requestId(nn_msghdr* hdr) {
+    for (nn_cmsghdr* cmsg = NN_CMSG_FIRSTHDR(hdr); cmsg; cmsg = NN_CMSG_NXTHDR(hdr, cmsg)) {
+        if (cmsg->cmsg_level == PROTO_SP && cmsg->cmsg_type == SP_HDR) {
+            unsigned char* data = NN_CMSG_DATA(cmsg);
+            size_t hdrSize;
+            memcpy(&hdrSize, data, sizeof(hdrSize));
+            if (hdrSize < sizeof(uint32_t)) return -1;
+            uint32_t id;                              // Last element of the header.
+            memcpy(&id, data + sizeof(size_t) + hdrSize - sizeof(id), sizeof(id));
+            return ntohl(id) & 0x7fffffff;
+        }
+    }
+    return -1;
+}
+
+/**
+ * windowedRequestThread
+ *    Keep window requests outstanding on a raw REQ socket until the clock says
+ * the measurement phase is done.  The round trip latency of each measured reply is
+ * recorded.  Outstanding replies are then drained and a zero length request stops
+ * the replier.
+ * 
+ * @param uri  - Where the raw replier is.
+ * @param phases - Warmup and measurement phases (counted in replies).
+ * @param size - Request size.
+ * @param window - Maximum number of outstanding requests.
+ * @param timing - Receives the measured time, count, samples, round trip times (ns)
+ *                 and the number of replies we could not match to a request.
+ * @param placement - CPUs/NUMA node for this thread.
+ */
+static void
+windowedRequestThread(
+    std::string uri, PhaseSpec phases, size_t size, size_t window, Timing* timing,
+    ThreadPlacement placement
+) {
+    placement.apply();
+    char* request = new char[size];
+    PhaseClock clock(phases);
+    Socket requestor(AF_SP_RAW, NN_REQ, "Failed to open the raw request socket.");
+    Endpoint endpoint = requestor.connect(uri, "Failed to connect to the raw replier.");
+    int socket = requestor.fd();
+
+    // Send times are kept in a ring indexed by request id.  The ring is bigger than
+    // the window so an ID only maps to one outstanding request.
+
+    size_t slots = 1;
+    while (slots < 4*window) slots <<= 1;
+    std::vector<std::chrono::steady_clock::time_point> sendTimes(slots);
+    std::vector<long> slotIds(slots, -1);
+
+    // Control buffer for the outgoing SP header:
+
+    alignas(nn_cmsghdr) char control[NN_CMSG_SPACE(sizeof(size_t) + sizeof(uint32_t))];
+    nn_cmsghdr* cmsg = reinterpret_cast<nn_cmsghdr*>(control);
+    cmsg->cmsg_len   = NN_CMSG_LEN(sizeof(size_t) + sizeof(uint32_t));
+    cmsg->cmsg_level = PROTO_SP;
+    cmsg->cmsg_type  = SP_HDR;
+    size_t hdrSize   = sizeof(uint32_t);
+    memcpy(NN_CMSG_DATA(cmsg), &hdrSize, sizeof(hdrSize));
+
+    size_t nsent(0), nreceived(0);
+    auto sendRequest = [&](size_t bytes) {
+        uint32_t id  = nsent & 0x7fffffff;
+        uint32_t hdrId = htonl(id | 0x80000000);
+        memcpy(NN_CMSG_DATA(cmsg) + sizeof(size_t), &hdrId, sizeof(hdrId));
+        nn_iovec iov = {request, bytes};
+        nn_msghdr hdr = {&iov, 1, control, sizeof(control)};
+        sendTimes[id & (slots-1)] = std::chrono::steady_clock::now();
+        slotIds[id & (slots-1)]   = id;
+        checkstat(
+            nn_sendmsg(socket, &hdr, 0),
+            "Failed to send a windowed request"
+        );
+        nsent++;
+    };
+    // Get a reply and match it up;  returns the id or -1.
+
+    auto receiveReply = [&]() {
+        void* reply(nullptr);
+        void* rcontrol(nullptr);
+        nn_iovec iov = {&reply, NN_MSG};
+        nn_msghdr hdr = {&iov, 1, &rcontrol, NN_MSG};
+        checkstat(
+            nn_recvmsg(socket, &hdr, 0),
+            "Failed to receive a windowed reply"
+        );
+        auto received = std::chrono::steady_clock::now();
+        long id = requestId(&hdr);
+        nn_freemsg(reply);
+        nn_freemsg(rcontrol);
+        if (id >= 0 && slotIds[id & (slots-1)] == id) {
+            if (clock.measuring()) {
+                timing->latencies.record(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        received - sendTimes[id & (slots-1)]
+                    ).count()
+                );
+            }
+            slotIds[id & (slots-1)] = -1;
+        } else {
+            timing->unmatched++;
+        }
+        nreceived++;
+    };
+
+    timing->unmatched = 0;
+    clock.start();
+    while (clock.phase() != PhaseClock::DONE) {
+        // Top up the window:
+
+        while ((nsent - nreceived) < window) {
+            sendRequest(size);
+        }
+        receiveReply();
+        clock.tick();
+    }
+    timing->seconds    = clock.seconds();
+    timing->cpuSeconds = clock.cpuEnd() - clock.cpuStart();
+    timing->messages   = clock.measured();
+    timing->samples    = clock.samples();
+
+    // Drain what's outstanding and stop the replier:
+
+    while (nreceived < nsent) {
+        receiveReply();
+    }
+    sendRequest(0);
+    receiveReply();
+
+    delete []request;
+    endpoint.shutdown("could not shutdown raw req endpoint");
+    requestor.close("Could not close raw req socket.");
+}
+
+/**
+ * timeWindowed
+ *    Time one window size.  The requestor does the timing.
+ * 
+ * @param socket - bound raw reply socket.
+ * @param uri - URI the requestor connects to.
+ * @param phases - Warmup and measurement phases.
+ * @param reqSize - request size.
+ * @param repSize - reply size.
+ * @param window  - Number of outstanding requests.
+ * @param placement - Where the requestor and replier (this thread) run.
+ * @param[out] timing - time, latencies and unmatched replies.
+ */
+static void
+timeWindowed(
+    int socket, const std::string& uri, const PhaseSpec& phases, size_t reqSize, size_t repSize,
+    size_t window, const Placement& placement, Timing& timing
+) {
+    std::thread req(
+        windowedRequestThread, uri, phases, reqSize, window, &timing, placement.sender(0)
+    );
+    {
+        PlacementScope pin(placement.receiver(0));
+        rawReplier(socket, repSize);
+    }
+    req.join();
+}
+
+/**
+ * runExchange
+ *    Time a lock-step REQ/REP exchange.  The reply socket is bound for the run
+ * and closed afterwards.
+ */
+void
+runExchange(
+    const std::string& uri, const PhaseSpec& phases, size_t reqSize, size_t repSize, SendMode mode,
+    RecvMode recvMode, const Placement& placement, Timing& timing
+) {
+    Socket socket(AF_SP, NN_REP, "Failed to open the reply socket");
+    Endpoint endpoint = socket.bind(uri, "Failed to bind reply socket.");
+    timeExchange(socket.fd(), uri, phases, reqSize, repSize, mode, recvMode, placement, timing);
+    timing.unmatched = 0;
+    endpoint.shutdown("Failed to shutdown reply socket");
+    socket.close("Failed to close reply socket.");
+}
+/**
+ * runClients
+ *    Time many clients against one replier.  The reply socket is bound for the run
+ * and closed afterwards.
+ */
+void
+runClients(
+    const std::string& uri, const PhaseSpec& phases, size_t reqSize, size_t repSize,
+    size_t clients, size_t threads, const Placement& placement, Timing& timing
+) {
+    Socket socket(AF_SP, NN_REP, "Failed to open the reply socket");
+    Endpoint endpoint = socket.bind(uri, "Failed to bind reply socket.");
+    timeClients(socket.fd(), uri, phases, reqSize, repSize, clients, threads, placement, timing);
+    timing.unmatched = 0;
+    endpoint.shutdown("Failed to shutdown reply socket");
+    socket.close("Failed to close reply socket.");
+}
+/**
+ * runWindowed
+ *    Time a pipelined exchange with window requests outstanding using
+ * raw sockets.
+ */
+void
+runWindowed(
+    const std::string& uri, const PhaseSpec& phases, size_t reqSize, size_t repSize, size_t window,
+    const Placement& placement, Timing& timing
+) {
+    Socket socket(AF_SP_RAW, NN_REP, "Failed to open the raw reply socket");
+    Endpoint endpoint = socket.bind(uri, "Failed to bind raw reply socket.");
+    timeWindowed(socket.fd(), uri, phases, reqSize, repSize, window, placement, timing);
+    endpoint.shutdown("Failed to shutdown raw reply socket");
+    socket.close("Failed to close raw reply socket.");
+}
+
+/**
+ * reqrepRecord
+ *    Turn a timing into a record for csv/json output.
+ * 
+ * @param benchmark - benchmark name.
+ * @param mode   - e.g. copy/zerocopy/gather.
+ * @param uri    - endpoint.
+ * @param msgsize - Size of the big message.
+ * @param bytesPerTrip - request + reply bytes.
+ * @param timing - the measurements.
+ */
+RunRecord
+reqrepRecord(
+    const std::string& benchmark, const std::string& mode, const std::string& uri,
+    size_t msgsize, size_t bytesPerTrip, const Timing& timing
+) {
+    RunRecord record;
+    record.benchmark  = benchmark;
+    record.mode       = mode;
+    record.uri        = uri;
+    record.msgsize    = msgsize;
+    record.senders    = timing.clients;
+    record.receivers  = 1;
+    record.messages   = timing.messages;
+    record.bytes      = (uint64_t)timing.messages * bytesPerTrip;
+    record.durationNs = timing.seconds * 1.0e9;
+    record.cpuSec     = timing.cpuSeconds;
+    record.p50us      = timing.latencies.valueAtPercentile(50.0)/1000.0;
+    record.p99us      = timing.latencies.valueAtPercentile(99.0)/1000.0;
+    record.p999us     = timing.latencies.valueAtPercentile(99.9)/1000.0;
+    record.contextSwitches = timing.contextSwitches;
+    record.allocatorCalls  = timing.allocatorCalls;
+    record.memoryKb        = timing.memoryKb;
+    return record;
+}
@@ -0,0 +1,65 @@
+/**
+ * REQ/REP timing interface.
+ *
+ * runExchange times lock-step REQ/REP, runClients the same with many requestors and
+ * runWindowed the pipelined (raw socket) version.  They're used by the reqrep program and by the sweep driver.  Each run binds
+ * the reply socket on uri, runs a requestor thread against it and closes the socket.
+ * The requestor's PhaseClock decides the warmup and measurement phases (see phases.h)
+ * and ends the run with a zero length request.
+ */
+#ifndef REQREPBENCH_H
+#define REQREPBENCH_H
+
+#include <string>
+#include <stddef.h>
+#include <vector>
+#include "histogram.h"
+#include "phases.h"
+#include "affinity.h"
+#include "framing.h"
+
+// Timings of one exchange:
+
+struct Timing {
+    double           seconds;      // Of the measurement phase.
+    double           cpuSeconds;   // Process CPU time during the measurement phase.
+    size_t           messages;     // Round trips measured.
+    size_t           unmatched;    // Windowed replies that didn't match a request.
+    LatencyHistogram latencies;    // Round trip times in ns (measurement phase only).
+    std::vector<ThroughputSample> samples;   // With an interval.
+    double           allocsPerTrip = 0;   // Allocator calls (whole process) per round trip.
+    uint64_t         allocatorCalls = 0;  // Over the run (warmup too), whole process.
+    long             contextSwitches = 0; // Likewise.
+    size_t           clients = 1;  // Requestors.
+    long             memoryKb = 0; // runClients:  resident growth connecting the clients.
+};
+
+// The placement's sender is the requestor, its receiver the replier.  mode is how the
+// messages are sent and recvMode how copy/zero copy ones are received (see framing.h).
+
+void runExchange(
+    const std::string& uri, const PhaseSpec& phases, size_t reqSize, size_t repSize, SendMode mode,
+    RecvMode recvMode, const Placement& placement, Timing& timing
+);
+
+// clients REQ sockets, a thread each if threads is 0 else coroutines (../nncoro.h) on
+// that many threads, share the phases.  Copy sends only.
+
+void runClients(
+    const std::string& uri, const PhaseSpec& phases, size_t reqSize, size_t repSize,
+    size_t clients, size_t threads, const Placement& placement, Timing& timing
+);
+void runWindowed(
+    const std::string& uri, const PhaseSpec& phases, size_t reqSize, size_t repSize, size_t window,
+    const Placement& placement, Timing& timing
+);
+
+// The csv/json record for a run, bytesPerTrip is the request + reply size.
+
+struct RunRecord;
+RunRecord reqrepRecord(
+    const std::string& benchmark, const std::string& mode, const std::string& uri,
+    size_t msgsize, size_t bytesPerTrip, const Timing& timing
+);
+
+#endif
@@ -0,0 +1,352 @@
+/**
+ * This program times nanomsg surveys as the number of respondents grows.
+ *
+ * The surveyrespond example (../surveyrespond.cpp) runs four surveys of 10 responders.
+ * We use surveys for cluster wide health checks across hundreds of peers;  this times
+ * how long a survey takes to complete, how complete it is and how many surveys a second
+ * we can do as the number of respondents grows.
+ *
+ * Usage:
+ *    survey uri nrespondents nsurveys [--deadline=time] [--rate=surveys/sec]
+ *           [--quorum=fraction | --expect=n] [--protocol=binary|string|both]
+ *           [--format=text|csv|json]
+ * Where:
+ *    * uri - URI the surveyor listens on and the respondents connect to.
+ *    * nrespondents - Number of respondent threads, or a comma separated list
+ *      (e.g. 10,100,500) to time each in turn.
+ *    * nsurveys - Number of surveys timed.
+ *    * --deadline - NN_SURVEYOR_DEADLINE e.g. 100ms (the default), 1s.
+ *    * --rate - Surveys per second to start, default 0 which is back to back.
+ *    * --quorum - End each survey as soon as this fraction of the respondents has answered
+ *      rather than at the deadline.
+ *    * --expect - End each survey as soon as n responses have arrived.
+ *    * --protocol - binary (default) surveys and responses (../survey.h) read in place, or
+ *      string ones built and compared the way the original surveyrespond example did
+ *      ("ALL", "EXIT" and "<id> Responding to ALL" via std::stringstream).  both times each.
+ *    * --format - text (default) or one csv/json record per respondent count (see record.h).
+ *
+ * Each respondent is a thread with its own NN_RESPONDENT socket.  Before timing, the
+ * surveyor repeats PING surveys until one is answered by everyone (so all respondents
+ * are connected).  A survey is over when the deadline expires (nn_recv fails with
+ * ETIMEDOUT) or, with --quorum/--expect, as soon as enough responses are in;  the next
+ * survey cancels it and the surveyor socket drops any late responses.  At the end the
+ * surveyor repeats EXIT surveys until every respondent has gone.
+ *
+ * Output for each number of respondents:
+ *    * Surveys/sec.
+ *    * Completeness - how many surveys got a response from everyone within the deadline
+ *      and the mean fraction of respondents that answered.
+ *    * Completion latency percentiles - time from sending the survey until the last
+ *      response that arrived.
+ *    * Round trip latency percentiles - time from sending the survey until the first response.
+ *    * Heap allocations (operator new, all threads) per survey.
+ *    * The respondents that missed surveys and how many.
+ */
+#include <thread>
+#include <nanomsg/nn.h>
+#include <nanomsg/survey.h>
+#include <stdlib.h>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <string.h>
+#include <errno.h>
+#include <chrono>
+#include <atomic>
+#include <vector>
+#include <math.h>
+#include <new>
+#include "../survey.h"
+#include "histogram.h"
+#include "options.h"
+#include "phases.h"
+#include "record.h"
+#include "../nnpp.h"
+
+// Count heap allocations so the protocols can be compared.  nanomsg's own (malloc)
+// allocations are the same for both and aren't counted.
+
+static std::atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size) {
+    allocations++;
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+enum class Protocol { BINARY, STRING };
+
+static const char*
+protocolName(Protocol protocol) {
+    return protocol == Protocol::BINARY ? "binary" : "string";
+}
+
+static uint64_t
+nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+/**
+ * respondent thread:
+ *    Answer surveys until EXIT.
+ * @param uri - surveyor's URI.
+ * @param id  - our number.
+ * @param exited - counted up when we're done.
+ * @param protocol - how surveys and responses are encoded.
+ */
+static void
+respondent(std::string uri, uint32_t id, std::atomic<int>* exited, Protocol protocol) {
+    Socket respondentSocket(AF_SP, NN_RESPONDENT, "Unable to open respondent socket.");
+    Endpoint endpoint = respondentSocket.connect(uri, "Respondent failed to connect to the surveyor.");
+    int socket = respondentSocket.fd();
+    bool done(false);
+    while (!done) {
+        void* survey(nullptr);
+        int n = nn_recv(socket, &survey, NN_MSG, 0);
+        if (n < 0 && nn_errno() == EINTR) continue;
+        checkstat(n, "Failed to receive a survey");
+        if (protocol == Protocol::BINARY) {
+            const SurveyRequest* request = decodeSurvey(survey, n);
+            if (request) {
+                SurveyResponse response = makeResponse(*request, id);
+                done = request->opcode == SURVEY_EXIT;
+                nn_send(socket, &response, sizeof(response), 0);   // Surveys that are over are EFSM.
+            }
+        } else {
+            std::string request(static_cast<char*>(survey), strnlen(static_cast<char*>(survey), n));
+            if (request == "ALL" || request == "EXIT") {
+                std::stringstream strresponse;
+                strresponse << id << " Responding to " << request;
+                std::string response(strresponse.str());
+                nn_send(socket, response.c_str(), response.size() + 1, 0);
+            }
+            done = request == "EXIT";
+        }
+        nn_freemsg(survey);
+    }
+    (*exited)++;
+    endpoint.shutdown("Failed to shutdown respondent endpoint");
+    respondentSocket.close("Failed to close respondent socket");
+}
+
+// What one survey got:
+
+struct SurveyResult {
+    size_t   responses;
+    uint64_t firstNs;         // Survey start to the first response (0 if none).
+    uint64_t lastNs;          // Survey start to the last response (0 if none).
+};
+
+/**
+ * runSurvey
+ *    Conduct a survey and take responses until the deadline or we have enough.
+ * @param wanted - Responses that end the survey early, 0 to wait for the deadline.
+ * @param answered - If not null, set true for each respondent that answers.
+ */
+static SurveyResult
+runSurvey(
+    int socket, Protocol protocol, uint64_t number, SurveyOpcode op, size_t wanted,
+    std::vector<bool>* answered = nullptr
+) {
+    SurveyRequest survey = makeSurvey(op, SURVEY_ALL_GROUPS, number);
+    const char* request = op == SURVEY_EXIT ? "EXIT" : "ALL";
+    uint64_t start = nowNs();
+    if (protocol == Protocol::BINARY) {
+        checkstat(nn_send(socket, &survey, sizeof(survey), 0), "Failed to start a survey");
+    } else {
+        checkstat(nn_send(socket, request, strlen(request) + 1, 0), "Failed to start a survey");
+    }
+    SurveyResult result = {0, 0, 0};
+    while (true) {
+        void* response(nullptr);
+        int n = nn_recv(socket, &response, NN_MSG, 0);
+        if (n < 0) {
+            if (nn_errno() == ETIMEDOUT) break;           // Survey over.
+            if (nn_errno() == EINTR) continue;
+            checkstat(n, "Failed to get a survey response");
+        }
+        // The surveyor socket drops responses to earlier surveys for us.
+
+        long id(-1);
+        if (protocol == Protocol::BINARY) {
+            const SurveyResponse* r = decodeResponse(response, n);
+            if (r && r->survey == number) id = r->respondent;
+        } else if (n > 0) {
+            id = atol(static_cast<char*>(response));
+        }
+        if (id >= 0) {
+            result.responses++;
+            result.lastNs = nowNs() - start;
+            if (result.responses == 1) result.firstNs = result.lastNs;
+            if (answered && id < answered->size()) (*answered)[id] = true;
+        }
+        nn_freemsg(response);
+        if (wanted && result.responses >= wanted) break;
+    }
+    return result;
+}
+
+// The results for one number of respondents:
+
+struct SurveyTiming {
+    double           seconds;
+    size_t           complete;      // Surveys everyone answered.
+    size_t           responses;     // Total.
+    LatencyHistogram completion;    // ns to the last response.
+    LatencyHistogram roundTrip;     // ns to the first response.
+    uint64_t         allocations;   // operator new calls while surveying.
+    std::vector<size_t> missed;     // Per respondent, surveys it didn't answer.
+};
+
+/**
+ * timeSurveys
+ *    Start the respondents, survey nsurveys times, stop them.
+ */
+static SurveyTiming
+timeSurveys(
+    const std::string& uri, Protocol protocol, int nresp, size_t nsurveys, int deadlineMs,
+    double rate, size_t wanted
+) {
+    Socket surveyor(AF_SP, NN_SURVEYOR, "Unable to open surveyor socket.");
+    surveyor.setOption(NN_SURVEYOR, NN_SURVEYOR_DEADLINE, deadlineMs, "Failed to set the survey deadline");
+    Endpoint endpoint = surveyor.bind(uri, "Unable to advertise surveyor.");
+    int socket = surveyor.fd();
+
+    std::atomic<int> exited(0);
+    std::vector<std::thread*> respondents;
+    for (int i = 0; i < nresp; i++) {
+        respondents.push_back(new std::thread(respondent, uri, i, &exited, protocol));
+    }
+    uint64_t number(0);
+    while (runSurvey(socket, protocol, number++, SURVEY_REPORT, nresp).responses < nresp)
+        ;
+
+    SurveyTiming timing;
+    timing.complete = timing.responses = 0;
+    timing.missed.resize(nresp, 0);
+    std::vector<bool> answered(nresp);
+    uint64_t interval = rate > 0 ? (uint64_t)(1.0e9/rate) : 0;
+    uint64_t allocStart = allocations;
+    uint64_t start = nowNs();
+    uint64_t next  = start;
+    for (size_t i = 0; i < nsurveys; i++) {
+        if (interval) {
+            while (nowNs() < next) {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(next - nowNs()));
+            }
+            next += interval;
+        }
+        std::fill(answered.begin(), answered.end(), false);
+        SurveyResult r = runSurvey(socket, protocol, number++, SURVEY_REPORT, wanted, &answered);
+        for (int j = 0; j < nresp; j++) {
+            if (!answered[j]) timing.missed[j]++;
+        }
+        timing.responses += r.responses;
+        if (r.responses == nresp) timing.complete++;
+        if (r.responses) {
+            timing.completion.record(r.lastNs);
+            timing.roundTrip.record(r.firstNs);
+        }
+    }
+    timing.seconds = (nowNs() - start)/1.0e9;
+    timing.allocations = allocations - allocStart;
+
+    while (exited < nresp) {
+        runSurvey(socket, protocol, number++, SURVEY_EXIT, nresp - exited);
+    }
+    for (auto p : respondents) {
+        p->join();
+        delete p;
+    }
+    endpoint.shutdown("Failed to shutdown survey endpoint");
+    surveyor.close("failed to close survey socket.");
+    return timing;
+}
+
+// entry point
+
+int main(int argc, char** argv) {
+    // Get the parameters, not production code:
+
+    Options options(argc, argv);
+    std::string uri(options[0]);
+    std::vector<int> counts;
+    std::stringstream countList(options[1]);
+    std::string item;
+    while (std::getline(countList, item, ',')) {
+        if (!item.empty()) counts.push_back(atoi(item.c_str()));
+    }
+    size_t nsurveys = atol(options[2].c_str());
+    int deadlineMs  = PhaseSpec::parseTime(options.value("deadline", "100ms"))/1000000;
+    double rate     = atof(options.value("rate", "0").c_str());
+    double quorum   = atof(options.value("quorum", "0").c_str());
+    size_t expect   = options.number("expect", 0);
+    std::string protocolOption = options.value("protocol", "binary");
+    OutputFormat format = parseFormat(options.value("format"));
+    RecordWriter* writer = format == OutputFormat::TEXT ? nullptr : new RecordWriter(std::cout, format);
+    if (deadlineMs < 1) deadlineMs = 1;
+    std::vector<Protocol> protocols;
+    if (protocolOption != "string") protocols.push_back(Protocol::BINARY);
+    if (protocolOption != "binary") protocols.push_back(Protocol::STRING);
+
+    for (auto protocol : protocols) {
+        for (int nresp : counts) {
+            size_t wanted = expect ? expect : (size_t)ceil(quorum * nresp);
+            double cpuStart = cpuSeconds();
+            SurveyTiming t = timeSurveys(uri, protocol, nresp, nsurveys, deadlineMs, rate, wanted);
+            size_t msgsize = protocol == Protocol::BINARY ? sizeof(SurveyRequest) : strlen("ALL") + 1;
+            double cpu = cpuSeconds() - cpuStart;
+
+            if (writer) {
+                RunRecord record;
+                record.benchmark  = "survey";
+                record.mode       = std::string(protocolName(protocol)) + "/deadline" +
+                    std::to_string(deadlineMs) + "ms" +
+                    (wanted ? "/first" + std::to_string(wanted) : "");
+                record.uri        = uri;
+                record.msgsize    = msgsize;
+                record.senders    = 1;
+                record.receivers  = nresp;
+                record.messages   = nsurveys;
+                record.bytes      = (uint64_t)nsurveys * msgsize;
+                record.durationNs = t.seconds * 1.0e9;
+                record.cpuSec     = cpu;
+                record.p50us      = t.completion.valueAtPercentile(50.0)/1000.0;
+                record.p99us      = t.completion.valueAtPercentile(99.0)/1000.0;
+                record.p999us     = t.completion.valueAtPercentile(99.9)/1000.0;
+                writer->write(record);
+            } else {
+                std::cout << "Protocol    : " << protocolName(protocol) << std::endl;
+                std::cout << "Respondents : " << nresp << " Surveys : " << nsurveys
+                          << " Deadline : " << deadlineMs << " ms";
+                if (wanted) std::cout << " Done after : " << wanted << " responses";
+                std::cout << std::endl;
+                std::cout << "Time        : " << t.seconds << std::endl;
+                std::cout << "Surveys/sec : " << nsurveys/t.seconds << std::endl;
+                std::cout << "Complete    : " << t.complete << " of " << nsurveys << " surveys ("
+                          << (nsurveys ? 100.0*t.complete/nsurveys : 0.0) << "%)  mean responses : "
+                          << (nsurveys ? 100.0*t.responses/((double)nsurveys*nresp) : 0.0) << "%\n";
+                std::cout << "Allocations : " << (nsurveys ? (double)t.allocations/nsurveys : 0.0)
+                          << " per survey\n";
+                std::cout << "Completion latency (to the last response):\n";
+                t.completion.printPercentiles(std::cout);
+                std::cout << "Round trip latency (to the first response):\n";
+                t.roundTrip.printPercentiles(std::cout);
+                for (int i = 0; i < nresp; i++) {
+                    if (t.missed[i]) {
+                        std::cout << "respondent " << std::setw(4) << i << " missed : "
+                                  << t.missed[i] << " surveys\n";
+                    }
+                }
+            }
+        }
+    }
+    delete writer;
+    return EXIT_SUCCESS;
+}
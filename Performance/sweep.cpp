@@ -0,0 +1,183 @@
+/**
+ * Sweep driver for the pipeline and reqrep timings.
+ *
+ * Runs the whole matrix of transports x message sizes (x number of pullers for the
+ * pipeline) in this process and writes one record per timed run to a single CSV or
+ * JSON lines result file (see record.h).  This replaces the old pipelinetimings.sh
+ * and reqreptimings.sh scripts and their free form logs.
+ *
+ * Usage:
+ *    sweep [--output=file] [--format=csv|json] [--nmsg=n] [--transports=tcp,ipc,inproc]
+ *          [--sizes=s1,s2...] [--pullers=n1,n2...] [--benchmarks=pipeline,reqrep]
+ *          [--zerocopy] [--gather] [--pool] [--fixed-recv] [--reactor[=n]] [--epoll] [--coroutines]
+ *          [--exact] [--trials=n] [--warmup=n|time] [--duration=time]
+ * Where:
+ *    * --output - result file, default sweep.csv or sweep.json depending on the format.
+ *    * --format - csv (default) or json.
+ *    * --nmsg  - messages (REQ/REP pairs) per run, default 100000.
+ *    * --transports - Transports to time, default all three.
+ *    * --sizes - message sizes, default 1024 doubling to 1048576.
+ *    * --pullers - pipeline receiver counts, default 1,2,3,4,5.
+ *    * --benchmarks - Which benchmarks to run, default both.
+ *    * --zerocopy - Time the zero copy modes as well as copy.
+ *    * --gather - Time header + payload sends concatenated and with nn_sendmsg iovecs
+ *      (see framing.h) as well.
+ *    * --pool - Time sends from and receives into MessagePool buffers (see msgpool.h) as well.
+ *    * --fixed-recv - Also time the copy and zero copy modes receiving into one reused buffer
+ *      (see framing.h) rather than nanomsg's chunks.  The pipeline does this without --exact.
+ *    * --reactor - Also time each pipeline with its puller sockets served by n (default 4)
+ *      nn_poll reactor threads (see pipeline.cpp).  Not with --exact.
+ *    * --epoll - Also time each pipeline with epoll reactor threads (implies --reactor).
+ *    * --coroutines - Also time each pipeline with a coroutine per puller socket on the
+ *      reactor threads (see ../nncoro.h).  Copy and zero copy chunk receives only.
+ *    * --exact - Use the exact count pipeline mode.
+ *    * --trials - Number of times each configuration is run, default 1.  Each trial is
+ *      its own record;  compare uses the repeated trials to compute medians and
+ *      confidence intervals.
+ *    * --warmup, --duration - Warmup and measurement phases of each run (see phases.h).
+ *
+ * Progress is written to stderr.
+ *
+ * The broker benchmark is not part of the sweep:  it shuts down with nn_term which
+ * can only be done once per process.  Run broker with --format=csv|json for that.
+ */
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "options.h"
+#include "pipelinebench.h"
+#include "reqrepbench.h"
+#include "record.h"
+
+// Split a comma separated list.
+
+static std::vector<std::string>
+split(const std::string& list) {
+    std::vector<std::string> result;
+    std::stringstream s(list);
+    std::string item;
+    while (std::getline(s, item, ',')) {
+        if (!item.empty()) result.push_back(item);
+    }
+    return result;
+}
+static std::vector<size_t>
+numbers(const std::string& list) {
+    std::vector<size_t> result;
+    for (auto& item : split(list)) {
+        result.push_back(atol(item.c_str()));
+    }
+    return result;
+}
+
+/**
+ * uriFor
+ *    The endpoint for a transport and benchmark - the same ones the
+ * old scripts used.
+ */
+static std::string
+uriFor(const std::string& transport, const std::string& benchmark) {
+    if (transport == "tcp")    return "tcp://127.0.0.1:3000";
+    if (transport == "ipc")    return "ipc:///tmp/" + benchmark;
+    if (transport == "inproc") return "inproc://" + benchmark;
+    std::cerr << "Unknown transport " << transport << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+// entry point
+
+int main(int argc, char** argv) {
+    Options options(argc, argv);
+    std::string formatName = options.value("format", "csv");
+    OutputFormat format = parseFormat(formatName);
+    if (format == OutputFormat::TEXT) {
+        std::cerr << "--format must be csv or json\n";
+        exit(EXIT_FAILURE);
+    }
+    std::string output = options.value("output", "sweep." + formatName);
+    size_t nmsg = options.number("nmsg", 100000);
+    auto transports = split(options.value("transports", "tcp,ipc,inproc"));
+    auto sizes      = numbers(options.value(
+        "sizes", "1024,2048,4096,8192,16384,32768,65536,131072,262144,524288,1048576"
+    ));
+    auto pullers    = numbers(options.value("pullers", "1,2,3,4,5"));
+    auto benchmarks = split(options.value("benchmarks", "pipeline,reqrep"));
+    bool exact      = options.flag("exact");
+    std::vector<PullerKind> kinds = {PullerKind::THREAD};
+    if (!exact) {
+        if (options.flag("reactor") || options.flag("epoll")) {    // --epoll implies --reactor.
+            kinds.push_back(PullerKind::POLL);
+        }
+        if (options.flag("epoll"))      kinds.push_back(PullerKind::EPOLL);
+        if (options.flag("coroutines")) kinds.push_back(PullerKind::COROUTINE);
+    }
+    size_t reactors   = options.number("reactor", 4);
+    size_t trials   = options.number("trials", 1);
+    PhaseSpec phases = PhaseSpec::fromOptions(options, nmsg);
+
+    auto modes      = requestedModes(options);
+    auto recvModes  = requestedRecvModes(options);
+
+    std::ofstream out(output);
+    if (!out) {
+        std::cerr << "Unable to open " << output << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    RecordWriter writer(out, format);
+
+    bool doPipeline = std::find(benchmarks.begin(), benchmarks.end(), "pipeline") != benchmarks.end();
+    bool doReqrep   = std::find(benchmarks.begin(), benchmarks.end(), "reqrep") != benchmarks.end();
+
+    for (size_t trial = 0; trial < trials; trial++) {
+        for (auto& transport : transports) {
+            for (auto size : sizes) {
+                for (auto sendMode : modes) {
+                    for (auto recvMode : recvModes) {
+                        if (recvMode == RecvMode::FIXED && !receivesChunks(sendMode)) continue;
+                        std::string mode = sendRecvName(sendMode, recvMode);
+                        if (doPipeline) {
+                            for (auto n : pullers) {
+                                std::cerr << "trial " << trial << " pipeline " << transport << " size " << size
+                                    << " pullers " << n << " " << mode << std::endl;
+                                PipelineConfig config;
+                                config.uri        = uriFor(transport, "pipeline");
+                                config.nmsg       = nmsg;
+                                config.msgsize    = size;
+                                config.nreceivers = n;
+                                config.mode       = sendMode;
+                                config.recv       = recvMode;
+                                config.exact      = exact;
+                                config.phases     = phases;
+                                config.reactors   = reactors;
+                                for (auto kind : kinds) {
+                                    if (recvMode == RecvMode::FIXED && exact) continue;
+                                    if (kind == PullerKind::COROUTINE &&
+                                        (!receivesChunks(sendMode) || recvMode == RecvMode::FIXED)) {
+                                        continue;        // Coroutines only take the chunk.
+                                    }
+                                    config.pullers = kind;
+                                    writer.write(pipelineRecord(config, runPipeline(config)));
+                                }
+                            }
+                        }
+                        if (doReqrep) {
+                            std::string uri = uriFor(transport, "reqrep");
+                            std::cerr << "trial " << trial << " reqrep " << transport << " size " << size << " " << mode << std::endl;
+                            Timing br;
+                            runExchange(uri, phases, 1, size, sendMode, recvMode, Placement(), br);
+                            writer.write(reqrepRecord("reqrep-bigreply", mode, uri, size, size + 1, br));
+                            Timing sr;
+                            runExchange(uri, phases, size, 1, sendMode, recvMode, Placement(), sr);
+                            writer.write(reqrepRecord("reqrep-bigrequest", mode, uri, size, size + 1, sr));
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,136 @@
+/**
+ * Measure the cost of the C++ wrappers in ../nnpp.h against the raw nanomsg calls.
+ *
+ * A single thread sends a message over an inproc pair and receives it back on the other
+ * end, nmsg times, once with the C calls and once with the wrappers.  This is done both
+ * copying (user buffers) and zero copy (nn_allocmsg chunks sent and received with NN_MSG).
+ * The raw and wrapped runs are interleaved, trials times, and the fastest of each is kept
+ * so that scheduling noise doesn't count as overhead.
+ *
+ * Usage:
+ *    wrapper nmsg msgsize [--trials=n]
+ * Where:
+ *    * nmsg    - messages per trial.
+ *    * msgsize - message size in bytes.
+ *    * --trials - number of interleaved trials of each, default 5.
+ *
+ * Output is ns/message for each and the wrapper overhead in percent.  The Makefile builds
+ * this with optimization as the wrappers depend on inlining.
+ */
+#include <nanomsg/nn.h>
+#include <nanomsg/pair.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "options.h"
+#include "../nnpp.h"
+
+static const char* uri = "inproc://wrapper";
+
+// Time nmsg iterations of body and return ns/message.
+
+template <class Body>
+static double
+timeLoop(int nmsg, Body body) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < nmsg; i++) {
+        body();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / nmsg;
+}
+
+static double
+rawCopy(int sender, int receiver, int nmsg, size_t msgsize) {
+    std::vector<char> out(msgsize, 'x');
+    std::vector<char> in(msgsize);
+    return timeLoop(nmsg, [&]() {
+        checkstat(nn_send(sender, out.data(), msgsize, 0), "Raw send failed.");
+        checkstat(nn_recv(receiver, in.data(), msgsize, 0), "Raw receive failed.");
+    });
+}
+static double
+wrappedCopy(Socket& sender, Socket& receiver, int nmsg, size_t msgsize) {
+    std::vector<char> out(msgsize, 'x');
+    std::vector<char> in(msgsize);
+    return timeLoop(nmsg, [&]() {
+        checkstat(sender.send(out.data(), msgsize), "Wrapped send failed.");
+        checkstat(receiver.recv(in.data(), msgsize), "Wrapped receive failed.");
+    });
+}
+static double
+rawZeroCopy(int sender, int receiver, int nmsg, size_t msgsize) {
+    return timeLoop(nmsg, [&]() {
+        void* msg = nn_allocmsg(msgsize, 0);
+        if (!msg) checkstat(-1, "Raw allocation failed.");
+        memset(msg, 'x', msgsize < 16 ? msgsize : 16);
+        checkstat(nn_send(sender, &msg, NN_MSG, 0), "Raw send failed.");
+        void* reply(nullptr);
+        checkstat(nn_recv(receiver, &reply, NN_MSG, 0), "Raw receive failed.");
+        nn_freemsg(reply);
+    });
+}
+static double
+wrappedZeroCopy(Socket& sender, Socket& receiver, int nmsg, size_t msgsize) {
+    return timeLoop(nmsg, [&]() {
+        Message msg(msgsize);
+        memset(msg.data(), 'x', msgsize < 16 ? msgsize : 16);
+        checkstat(sender.send(msg), "Wrapped send failed.");
+        Message reply;
+        checkstat(receiver.recv(reply), "Wrapped receive failed.");
+    });
+}
+
+static void
+report(const char* mode, double raw, double wrapped) {
+    std::cout << std::left << std::setw(10) << mode << std::right
+              << std::fixed << std::setprecision(1)
+              << " raw " << std::setw(9) << raw << " ns/msg"
+              << "  wrapped " << std::setw(9) << wrapped << " ns/msg"
+              << "  overhead " << std::setprecision(2) << std::showpos
+              << (wrapped - raw) * 100.0 / raw << "%" << std::noshowpos << std::endl;
+}
+
+int main(int argc, char** argv) {
+    Options options(argc, argv);
+    if (options.size() != 2) {
+        std::cerr << "Usage:\n   wrapper nmsg msgsize [--trials=n]\n";
+        exit(EXIT_FAILURE);
+    }
+    int    nmsg    = atoi(options[0].c_str());
+    size_t msgsize = atol(options[1].c_str());
+    int    trials  = options.number("trials", 5);
+    if (nmsg <= 0 || msgsize == 0 || trials <= 0) {
+        std::cerr << "nmsg, msgsize and trials must be positive\n";
+        exit(EXIT_FAILURE);
+    }
+
+    // The same sockets serve both so only the calls differ.
+
+    Socket receiver(AF_SP, NN_PAIR, "Unable to open the receiving socket.");
+    Socket sender(AF_SP, NN_PAIR, "Unable to open the sending socket.");
+    Endpoint bound = receiver.bind(uri, "Unable to bind.");
+    Endpoint connected = sender.connect(uri, "Unable to connect.");
+
+    // Warm up the allocator and the pipe:
+
+    rawCopy(sender.fd(), receiver.fd(), nmsg / 10 + 1, msgsize);
+
+    double rawCopyNs(1e30), wrappedCopyNs(1e30), rawZeroNs(1e30), wrappedZeroNs(1e30);
+    for (int t = 0; t < trials; t++) {
+        rawCopyNs     = std::min(rawCopyNs, rawCopy(sender.fd(), receiver.fd(), nmsg, msgsize));
+        wrappedCopyNs = std::min(wrappedCopyNs, wrappedCopy(sender, receiver, nmsg, msgsize));
+        rawZeroNs     = std::min(rawZeroNs, rawZeroCopy(sender.fd(), receiver.fd(), nmsg, msgsize));
+        wrappedZeroNs = std::min(wrappedZeroNs, wrappedZeroCopy(sender, receiver, nmsg, msgsize));
+    }
+    std::cout << nmsg << " messages of " << msgsize << " bytes, best of " << trials
+              << " trials" << std::endl;
+    report("copy", rawCopyNs, wrappedCopyNs);
+    report("zerocopy", rawZeroNs, wrappedZeroNs);
+
+    return EXIT_SUCCESS;
+}
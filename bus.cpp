@@ -9,9 +9,11 @@
  * What we'll do is 
  * 1.  Set upt the bus so that the main thread is participant 0 and the remaining
  * n-1 threads are the other positions on the bus.
- * 2. Each participant will send one message to the bus.
- * 3. The particpants will receive (with wait) one message and then enter a loop
- * using nn_poll to determine when 
+ * 2. Everyone binds (a latch makes sure all have before anyone connects), connects
+ * and then runs the handshake in bus.h which confirms the connections are live.
+ * 3. Each participant will send one message to the bus.
+ * 4. The particpants use nn_poll and receive until they have one message from
+ * every other participant.
  */
 
 
@@ -26,129 +28,42 @@
 #include <string.h>
 #include <sstream>
 #include <vector>
+#include <latch>
+#include <utility>
+#include "bus.h"
 
 
-static const int timeout=1000;     // Ms for poll timeout.
-
-// Useful error checking method:
-// Returns int since e.g. socket returns the socket on ok.
-// else output an error and exists with failure status.
-static int
-checkstat(int status, const char* msg) {
-    if (status < 0) {
-        std::cerr << msg << nn_strerror(nn_errno()) << std::endl;
-        exit(EXIT_FAILURE);
-    }
-    return status;
-}
-
-
-/**
- * Generate uris
- *   Given the uri template and a bus size returns a vector of strings that are the URIS for the
- * bus.  Element i of the vector is the URI position i on the bus should listen on.
- * 
- * 
- */
-static std::vector<std::string>
-generateUris(const std::string& base, size_t size) {
-    std::vector<std::string> result;
-    const char* format = base.c_str();     // For snprintf.
-    char  uriBuffer[100];                  // sb big enough.
-    for (int i =0; i < size; i++)  {
-        int nchars = snprintf(uriBuffer, sizeof(uriBuffer), format, i);
-        if (nchars >= sizeof(uriBuffer)) {
-            std::cerr << "URI Buffer overflow in generateUris\n";
-            exit(EXIT_FAILURE);
-        }
-        result.push_back(std::string(uriBuffer));
-    }
-
-    return result;
-}
-
-// Creates the bus socket and listens on the bus.
-// Returns the socket and the endpoint position
-//
-static std::pair<int, int>   // socket/endpoint
-createBusSocket(const std::vector<std::string>& busUris, int position) {
-    int socket = checkstat(
-        nn_socket(AF_SP, NN_BUS),
-        "Failed to open bus socket"
-    );
-    int endpoint = checkstat(
-        nn_bind(socket, busUris[position].c_str()),
-        "Failed to bind bus socket"
-    );
-    return std::pair<int, int>(socket, endpoint);
-}
-
-
-// Connect to the other members of the bus as appropriate for our position.
-// Returns the vector of endpoint ids.
-static std::vector<int>
-connectToBus(int socket, const std::vector<std::string>& busUris, int position) {
-    std::vector<int> endpoints;
-
-    auto start = busUris.begin() + (position+1);   // Next URI after me.
-    // 0 connects to everyone but the last one:
-
-    if (position == 0) {
-        auto end = busUris.end() - 1;     // Just past next to last:
-
-        for (auto p = start; p!= end; p++) {
-            int endpt = checkstat(
-                nn_connect(socket, p->c_str()),
-                "Failed to connect to the bus."
-            );
-            endpoints.push_back(endpt);
-        }
-    } else if (start != busUris.end()) {
-        // All but the first and last one connecect to the subsequent ones.
-
-        for (auto p = start; p != busUris.end(); p++) {
-            int endpt = checkstat(
-                nn_connect(socket, p->c_str()),
-                "Failed to connect to the bus"
-            );
-            endpoints.push_back(endpt);
-        }
-
-    }
-    else {
-        // Last connects to the first.
-
-        int endpt = checkstat(
-            nn_connect(socket, busUris[0].c_str()),
-            "Failed to close the connection loop"
-        );
-    }
-
-    return endpoints;
-}
+static const int stallTimeout=5000;     // Ms with nothing arriving before we give up.
 
 // This is the business end of a bus member:
 // We get the uri template, the size of the bus and position.
-// Setup the bus with appropriate delays then
+// Setup the bus then
 // - Send a message.
-// - Recieve a messages.
-// - Receive more messages until we timeout.
+// - Receive messages until we have one from every other member.
+//
+// bound is a latch everyone arrives at once they've bound so no one connects to
+// a URI that's not there yet.  finished is one we arrive at before closing so we don't
+// close our socket while our message is still on its way to someone.
 //
-static void busMember(std::string uriTemplate, int size, int position) {
+static void busMember(
+    std::string uriTemplate, int size, int position, std::latch* bound, std::latch* finished
+) {
     auto busUris = generateUris(uriTemplate, size);
 
-    // Start listening and wait for everyone to start -- could use a barrier here but...
-    // we'll just sleep.
+    // Start listening and wait for everyone to start:
 
     auto socketAndEndpoint = createBusSocket(busUris, position);
-    int socket = socketAndEndpoint.first;
-    sleep(2);
+    Socket& socket = socketAndEndpoint.first;
+    bound->arrive_and_wait();
 
     auto endpoints = connectToBus(socket, busUris, position);
-    endpoints.push_back(socketAndEndpoint.second);      // Will need to shutdown that one too:
-    sleep(2);
+    endpoints.push_back(std::move(socketAndEndpoint.second));   // Will need to shutdown that one too:
+
+    // The handshake returns when all connections are live.  Messages from
+    // members that got there first may have come in already.
+
+    auto early = busHandshake(socket.fd(), size - 1, position);
 
-    // By now everyone's rocking.
     // Format and send our message:
 
     std::stringstream strMessage;
@@ -156,41 +71,44 @@ static void busMember(std::string uriTemplate, int size, int position) {
     std::string message(strMessage.str());
 
     checkstat(
-        nn_send(socket, message.c_str(), message.size()+1, 0),
+        socket.send(message.c_str(), message.size()+1),
         "Bus member failed to send message"
     );
 
-    char* recvMsg(nullptr);                   // To point ot received messages.
+    // We expect exactly one message from every other member:
 
-    // Get the first message - we'll always get at least one.
+    int expected = size - 1;
+    int received(0);
+    for (auto& msg : early) {
+        std::cerr << position << " Received : " << static_cast<char*>(msg.msg) << std::endl;
+        freeBusMessage(msg);
+        received++;
+    }
 
-    int nRecv = checkstat(
-        nn_recv(socket, &recvMsg, NN_MSG, 0),
-        "Failed to receive first message"
-    );
-    std::cerr << position << " Received : " << recvMsg << std::endl;
-    nn_freemsg(recvMsg);
     // Set up to poll:
 
     nn_pollfd poller = {
-        fd: socket,
+        fd: socket.fd(),
         events: NN_POLLIN,
         revents: 0
     };
 
-    bool done(false);
-    while (!done) {
-        int nfds = nn_poll(&poller, 1, timeout);
+    while (received < expected) {
+        int nfds = nn_poll(&poller, 1, stallTimeout);
         if (nfds > 0) {
-            recvMsg = nullptr;                    // recvMsg fills this in.
-            checkstat(
-                nn_recv(socket, &recvMsg, NN_MSG, 0),
-                "Failed to receive subsequent message"
+            Message recvMsg;                      // Freed when it goes out of scope.
+            int nRecv = checkstat(
+                socket.recv(recvMsg),
+                "Failed to receive a message"
             );
-            std::cerr << position << " Received : " << recvMsg << std::endl;
-            nn_freemsg(recvMsg);
+            if (!isBusControl(recvMsg.data(), nRecv)) {     // Late handshake messages don't count.
+                std::cerr << position << " Received : " << recvMsg.as<char>() << std::endl;
+                received++;
+            }
         } else if (nfds == 0) {
-            done = true;                 // timed out.
+            std::cerr << position << " Gave up waiting for " << expected - received
+                      << " messages\n";
+            break;
         } else {
             if (nn_errno() != EINTR) {
                 // Something bad happended:
@@ -199,19 +117,12 @@ static void busMember(std::string uriTemplate, int size, int position) {
             }
         }
     }
-    // We get here if the message poll times out which means we have all the messages
-    // Yeah, I know I could have counted them too but I wanted to play with nn_poll.
-
-    for (auto ept: endpoints) {
-        checkstat(
-            nn_shutdown(socket, ept),
-            "Failed to shutdown an endpoint."
-        );
+    finished->arrive_and_wait();
+
+    for (auto& ept: endpoints) {
+        ept.shutdown("Failed to shutdown an endpoint.");
     }
-    checkstat(
-        nn_close(socket),
-        "Failed to close the socket"
-    );
+    socket.close("Failed to close the socket");
 
 }
 int main(int argc, char** argv) {
@@ -220,16 +131,18 @@ int main(int argc, char** argv) {
     std::string uriTemplate(argv[1]);
     size_t busSize = atoi(argv[2]);
 
-    // In this case we start the threads first, then run busMember for location 0.  The
-    // delays should be sufficient.
+    // In this case we start the threads first, then run busMember for location 0.
+    // The latches and the handshake take care of the timing.
 
+    std::latch bound(busSize);
+    std::latch finished(busSize);
     std::vector<std::thread*> bus;
     for (int pos = 1; pos < busSize; pos++) {
-        bus.push_back(new std::thread(busMember, uriTemplate, busSize, pos));
+        bus.push_back(new std::thread(busMember, uriTemplate, busSize, pos, &bound, &finished));
     }
     // Now run position 0:
 
-    busMember(uriTemplate, busSize, 0);
+    busMember(uriTemplate, busSize, 0, &bound, &finished);
 
     // When it returns the threads should be joinable and deletable.:
 
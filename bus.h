@@ -0,0 +1,402 @@
+/**
+ * Bus setup helpers shared by the bus example and the bus performance program
+ * (Performance/bus.cpp).
+ *
+ * A bus of size n has n members.  Each member binds its own URI (the template with %d
+ * replaced by its position) and then connects to other members as its BusTopology says.
+ * By default (MeshTopology) every member is directly connected to every other one.
+ * nanomsg busses don't forward messages so a member only hears from the members it's
+ * directly connected to;  the sparser topologies relay (see busRelay).
+ *
+ * nn_connect returns before the connection is up and the bus drops messages for peers it
+ * isn't connected to yet, so after binding (everyone) and connecting, members run
+ * busHandshake which returns once every connection is known to be live.
+ */
+#ifndef BUS_H
+#define BUS_H
+
+#include <nanomsg/nn.h>
+#include <nanomsg/bus.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <utility>
+#include <set>
+#include <atomic>
+#include <string.h>
+#include <errno.h>
+#include "nnpp.h"
+
+/**
+ * Generate uris
+ *   Given the uri template and a bus size returns a vector of strings that are the URIS for the
+ * bus.  Element i of the vector is the URI position i on the bus should listen on.
+ * 
+ * 
+ */
+static std::vector<std::string>
+generateUris(const std::string& base, size_t size) {
+    std::vector<std::string> result;
+    const char* format = base.c_str();     // For snprintf.
+    char  uriBuffer[100];                  // sb big enough.
+    for (int i =0; i < size; i++)  {
+        int nchars = snprintf(uriBuffer, sizeof(uriBuffer), format, i);
+        if (nchars >= sizeof(uriBuffer)) {
+            std::cerr << "URI Buffer overflow in generateUris\n";
+            exit(EXIT_FAILURE);
+        }
+        result.push_back(std::string(uriBuffer));
+    }
+
+    return result;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Topologies.
+//
+// A BusTopology decides who connects to whom.  nanomsg busses don't forward, so in the
+// sparse topologies (ring, tree) members relay what they receive on to their other
+// neighbours (see busRelay).  Relaying needs raw (AF_SP_RAW) sockets:  the header of
+// a received message identifies the pipe it came in on and sending it back out with
+// that header goes to every pipe but that one.  In the star every member connects to
+// a hub (URI position size) that does the same thing for everyone (see busHub).
+//
+// Relayed messages must start with a uint32_t hop count that the publisher sets to 1.
+
+class BusTopology {
+public:
+    virtual ~BusTopology() {}
+    virtual std::string name() const = 0;
+
+    // Positions position connects to (size is the hub).
+
+    virtual std::vector<int> connections(int position, int size) const = 0;
+
+    // Number of members position hears from during the handshake.
+
+    virtual int neighbours(int position, int size) const = 0;
+
+    virtual bool binds() const { return true; }           // Do members bind their URI?
+    virtual bool relays() const { return false; }         // Do members relay?
+    virtual uint32_t maxHops(int size) const { return 0; } // Relay limit, 0 is none.
+    virtual bool hasHub() const { return false; }
+
+    // Total connections for a bus of size members.
+
+    int connectionCount(int size) const {
+        int result(0);
+        for (int i = 0; i < size; i++) result += connections(i, size).size();
+        return result;
+    }
+};
+
+// The original wiring: every member is connected to every other one (n(n-1)/2 connections).
+// 0 connects to all but the last, the middle members connect to all the later ones
+// and the last connects back to 0.
+
+class MeshTopology : public BusTopology {
+public:
+    std::string name() const { return "mesh"; }
+    std::vector<int> connections(int position, int size) const {
+        std::vector<int> result;
+        if (position == 0) {
+            for (int i = 1; i < size - 1; i++) result.push_back(i);
+        } else if (position < size - 1) {
+            for (int i = position + 1; i < size; i++) result.push_back(i);
+        } else {
+            result.push_back(0);
+        }
+        return result;
+    }
+    int neighbours(int position, int size) const { return size - 1; }
+};
+
+// Each member connects to the next (n connections).  A message goes both ways round
+// and stops half way so the member opposite the publisher in an even sized ring gets it twice.
+
+class RingTopology : public BusTopology {
+public:
+    std::string name() const { return "ring"; }
+    std::vector<int> connections(int position, int size) const {
+        std::vector<int> result;
+        if (size > 2 || (size == 2 && position == 0)) result.push_back((position + 1) % size);
+        return result;
+    }
+    int neighbours(int position, int size) const { return size > 2 ? 2 : size - 1; }
+    bool relays() const { return true; }
+    uint32_t maxHops(int size) const { return size/2; }
+};
+
+// Every member connects to a hub (n connections) that sends everything it gets to
+// everyone else.
+
+class StarTopology : public BusTopology {
+public:
+    std::string name() const { return "star"; }
+    std::vector<int> connections(int position, int size) const {
+        return std::vector<int>(1, size);
+    }
+    int neighbours(int position, int size) const { return size - 1; }
+    bool binds() const { return false; }
+    bool hasHub() const { return true; }
+};
+
+// k-ary tree:  member i connects to its parent (i-1)/k (n-1 connections).  No cycles
+// so relays don't need a hop limit.
+
+class TreeTopology : public BusTopology {
+    int m_arity;
+public:
+    TreeTopology(int arity) : m_arity(arity < 1 ? 1 : arity) {}
+    std::string name() const { return "tree" + std::to_string(m_arity); }
+    std::vector<int> connections(int position, int size) const {
+        std::vector<int> result;
+        if (position > 0) result.push_back((position - 1)/m_arity);
+        return result;
+    }
+    int neighbours(int position, int size) const {
+        int children(0);
+        for (int c = m_arity*position + 1; c <= m_arity*position + m_arity && c < size; c++) {
+            children++;
+        }
+        return (position > 0 ? 1 : 0) + children;
+    }
+    bool relays() const { return true; }
+};
+
+/**
+ * makeTopology
+ *    @param name - mesh, ring, star or tree[:k] (k defaults to 2).
+ *    @return new topology (caller deletes).
+ */
+static BusTopology*
+makeTopology(const std::string& name) {
+    if (name == "mesh") return new MeshTopology;
+    if (name == "ring") return new RingTopology;
+    if (name == "star") return new StarTopology;
+    if (name.substr(0, 4) == "tree") {
+        auto colon = name.find(':');
+        return new TreeTopology(colon == std::string::npos ? 2 : atoi(name.c_str() + colon + 1));
+    }
+    std::cerr << "Unknown bus topology " << name << " must be mesh, ring, star or tree[:k]\n";
+    exit(EXIT_FAILURE);
+}
+
+static const MeshTopology meshTopology;
+
+// Creates the bus socket and listens on the bus (if the topology has members listen).
+// Returns the socket and the endpoint (empty if not bound).
+//
+static std::pair<Socket, Endpoint>
+createBusSocket(
+    const std::vector<std::string>& busUris, int position,
+    const BusTopology& topology = meshTopology
+) {
+    Socket socket(topology.relays() ? AF_SP_RAW : AF_SP, NN_BUS, "Failed to open bus socket");
+    Endpoint endpoint;
+    if (topology.binds()) {
+        endpoint = socket.bind(busUris[position], "Failed to bind bus socket");
+    }
+    return std::pair<Socket, Endpoint>(std::move(socket), std::move(endpoint));
+}
+
+
+// Connect to the other members of the bus (or the hub) as appropriate for our position.
+// Returns the endpoints.
+static std::vector<Endpoint>
+connectToBus(
+    Socket& socket, const std::vector<std::string>& busUris, int position,
+    const BusTopology& topology = meshTopology
+) {
+    std::vector<Endpoint> endpoints;
+    int size = topology.hasHub() ? busUris.size() - 1 : busUris.size();
+    for (int peer : topology.connections(position, size)) {
+        endpoints.push_back(socket.connect(busUris[peer], "Failed to connect to the bus."));
+    }
+
+    return endpoints;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Start up handshake.
+//
+// Each member repeats HELLO until it has heard from every other member, at which
+// point all of its connections are live.  It then repeats READY until every other
+// member is READY too.  Handshake messages are BusControl structs and start with
+// BUS_CONTROL_MAGIC so receivers can tell them from data (stray READYs can arrive
+// after the handshake is over).
+
+static const uint32_t BUS_CONTROL_MAGIC = 0x43535542;    // "BUSC"
+static const int      BUS_HANDSHAKE_INTERVAL = 10;        // ms between repeats.
+
+enum BusControlType : uint32_t {
+    BUS_CONTROL_HELLO = 1,
+    BUS_CONTROL_READY = 2
+};
+struct BusControl {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t member;
+};
+
+// Is a received message one of the handshake messages?
+
+static bool
+isBusControl(const void* msg, int size) {
+    return size == sizeof(BusControl) &&
+        reinterpret_cast<const BusControl*>(msg)->magic == BUS_CONTROL_MAGIC;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Receiving and relaying.
+
+// A received message and, from raw sockets, its header.
+
+struct BusMessage {
+    void* msg;
+    int   size;
+    void* control;    // nullptr if none.
+};
+
+static void
+freeBusMessage(BusMessage& m) {
+    if (m.msg)     nn_freemsg(m.msg);
+    if (m.control) nn_freemsg(m.control);
+    m.msg = m.control = nullptr;
+}
+
+// nn_recv that keeps the header.  Returns the size or -1 (see nn_errno).
+
+static int
+busReceive(int socket, BusMessage& m, int flags) {
+    m.msg = m.control = nullptr;
+    nn_iovec iov = {&m.msg, NN_MSG};
+    nn_msghdr hdr = {&iov, 1, &m.control, NN_MSG};
+    m.size = nn_recvmsg(socket, &hdr, flags);
+    return m.size;
+}
+
+// Send a message on to every pipe but the one it came in on.  Consumes m.control.
+
+static void
+busForward(int socket, BusMessage& m, void* msg) {
+    nn_iovec iov = {&msg, NN_MSG};
+    nn_msghdr hdr = {&iov, 1, &m.control, NN_MSG};
+    if (nn_sendmsg(socket, &hdr, NN_DONTWAIT) < 0) {   // Dropped like any bus send.
+        nn_freemsg(msg);
+        nn_freemsg(m.control);
+    }
+    m.control = nullptr;
+}
+
+/**
+ * busRelay
+ *    In the relaying topologies pass a received data message on to our other
+ * neighbours with its hop count bumped.  Does nothing for handshake messages, other
+ * topologies or messages that have gone far enough.  The caller still owns m.msg.
+ *
+ * @param socket - our (raw) bus socket.
+ * @param m      - the message as received by busReceive.
+ * @param topology, size - the bus.
+ */
+static void
+busRelay(int socket, BusMessage& m, const BusTopology& topology, int size) {
+    if (!topology.relays() || !m.control || m.size < (int)sizeof(uint32_t) ||
+        isBusControl(m.msg, m.size)) {
+        return;
+    }
+    uint32_t hops = *static_cast<uint32_t*>(m.msg);
+    uint32_t limit = topology.maxHops(size);
+    if (limit && hops >= limit) return;
+
+    void* copy = nn_allocmsg(m.size, 0);
+    if (!copy) return;
+    memcpy(copy, m.msg, m.size);
+    *static_cast<uint32_t*>(copy) = hops + 1;
+    busForward(socket, m, copy);
+}
+
+/**
+ * The star's hub:  a raw bus socket bound to uri that sends whatever it gets to everyone
+ * else (what nn_device does given one bus socket).  It's our own loop rather than
+ * nn_device because nn_device only stops when the library is terminated, and that
+ * can only happen once per process.
+ */
+static std::pair<Socket, Endpoint>
+createBusHub(const std::string& uri) {
+    Socket socket(AF_SP_RAW, NN_BUS, "Failed to open the hub socket");
+    Endpoint endpoint = socket.bind(uri, "Failed to bind the hub socket");
+    return std::pair<Socket, Endpoint>(std::move(socket), std::move(endpoint));
+}
+
+// Runs until *stop.
+
+static void
+busHub(int socket, const std::atomic<bool>* stop) {
+    nn_pollfd poller = {socket, NN_POLLIN, 0};
+    while (!*stop) {
+        int nfds = nn_poll(&poller, 1, 10);
+        if (nfds < 0 && nn_errno() != EINTR) checkstat(nfds, "Bus hub failed to poll");
+        BusMessage m;
+        while (busReceive(socket, m, NN_DONTWAIT) >= 0) {
+            busForward(socket, m, m.msg);
+        }
+        if (nn_errno() != EAGAIN) checkstat(-1, "Bus hub failed to receive");
+    }
+}
+
+/**
+ * busHandshake
+ *    Wait until all of our connections on the bus are live and all of our neighbours
+ * know that of their connections too.  Takes time proportional to the bus size
+ * rather than a fixed delay.
+ *
+ * @param socket - bus socket, bound and connected.
+ * @param neighbours - Number of members we hear from (BusTopology::neighbours).
+ * @param position - Ours.
+ * @return Data messages that arrived during the handshake (members that finish
+ *         first start sending).  The caller owns them (freeBusMessage) and relays them
+ *         if the topology needs that.
+ */
+static std::vector<BusMessage>
+busHandshake(int socket, int neighbours, int position) {
+    std::vector<BusMessage> early;
+    std::set<uint32_t> heard, ready;
+    nn_pollfd poller = {socket, NN_POLLIN, 0};
+    while (ready.size() < neighbours) {
+        BusControl hello = {
+            BUS_CONTROL_MAGIC,
+            heard.size() < neighbours ? BUS_CONTROL_HELLO : BUS_CONTROL_READY,
+            (uint32_t)position
+        };
+        nn_send(socket, &hello, sizeof(hello), NN_DONTWAIT);    // Dropped is fine, we repeat.
+
+        int nfds = nn_poll(&poller, 1, BUS_HANDSHAKE_INTERVAL);
+        if (nfds < 0 && nn_errno() != EINTR) checkstat(nfds, "Bus member failed to poll");
+        while (true) {
+            BusMessage m;
+            int n = busReceive(socket, m, NN_DONTWAIT);
+            if (n < 0) {
+                if (nn_errno() == EAGAIN) break;
+                checkstat(n, "Bus member failed to receive during the handshake");
+            }
+            if (isBusControl(m.msg, n)) {
+                BusControl* control = reinterpret_cast<BusControl*>(m.msg);
+                heard.insert(control->member);
+                if (control->type == BUS_CONTROL_READY) ready.insert(control->member);
+                freeBusMessage(m);
+            } else {
+                early.push_back(m);
+            }
+        }
+    }
+    // Everyone may have been READY before we got to say so:
+
+    BusControl done = {BUS_CONTROL_MAGIC, BUS_CONTROL_READY, (uint32_t)position};
+    nn_send(socket, &done, sizeof(done), NN_DONTWAIT);
+    return early;
+}
+
+#endif
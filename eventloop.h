@@ -0,0 +1,154 @@
+/**
+ * An epoll event loop for nanomsg sockets.
+ *
+ * nn_poll builds a poll set (getting each socket's file descriptor) on every call.  Here
+ * each socket's NN_RCVFD (readable) and/or NN_SNDFD (writable) descriptor is added to one
+ * epoll instance once, next to any other descriptors a program waits on, and a handler is
+ * called when the socket becomes ready.
+ *
+ * The descriptors are registered edge triggered:  there's one event when a socket becomes
+ * readable (or writable) and no more until it has stopped being so.  So a handler must
+ * either keep receiving (sending) with NN_DONTWAIT until it gets EAGAIN and return false,
+ * or, if it stops early (e.g. it only takes a batch of messages at a time so one busy
+ * socket can't starve the others), return true.  The loop then calls it again on the next
+ * pass without waiting for another event.  Never read or write the descriptors themselves;
+ * they belong to nanomsg.
+ *
+ * Handlers can add and remove sockets (including their own) while the loop is
+ * dispatching.  Not thread safe:  a loop belongs to one thread.
+ */
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <nanomsg/nn.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+#include "nnpp.h"
+
+class EventLoop {
+public:
+    // Called with the socket;  returns true if it stopped before EAGAIN.
+
+    typedef std::function<bool(int socket)> Handler;
+private:
+    struct Watch {
+        int     socket;
+        int     fd;
+        Handler handler;
+        bool    queued;                    // In m_ready.
+        bool    active;                    // Not removed.
+    };
+    int                                  m_epoll;
+    std::map<int, std::unique_ptr<Watch>> m_watches;   // By descriptor.
+    std::vector<Watch*>                  m_ready;     // To call on the next pass.
+    std::vector<std::unique_ptr<Watch>>  m_removed;   // Freed once dispatching is done.
+    bool                                 m_stop;
+public:
+    EventLoop() :
+        m_epoll(checkstat(epoll_create1(EPOLL_CLOEXEC), "Unable to create an epoll instance")),
+        m_stop(false) {}
+    ~EventLoop() {
+        close(m_epoll);
+    }
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Call handler when socket is readable/writable.
+
+    void onReadable(int socket, Handler handler) {
+        watch(socket, socketFd(socket, NN_RCVFD), std::move(handler));
+    }
+    void onWritable(int socket, Handler handler) {
+        watch(socket, socketFd(socket, NN_SNDFD), std::move(handler));
+    }
+    // Stop watching a socket (both directions).
+
+    void remove(int socket) {
+        for (auto p = m_watches.begin(); p != m_watches.end(); ) {
+            if (p->second->socket == socket) {
+                epoll_ctl(m_epoll, EPOLL_CTL_DEL, p->first, nullptr);
+                p->second->active = false;
+                m_removed.push_back(std::move(p->second));
+                p = m_watches.erase(p);
+            } else {
+                ++p;
+            }
+        }
+    }
+    size_t size() const { return m_watches.size(); }
+
+    /**
+     * runOnce
+     *    Wait up to timeout ms (-1 forever) for something to be ready - not at all if a
+     * handler has more to do - and call the handlers.
+     * @return the number of handlers called.
+     */
+    int runOnce(int timeout) {
+        epoll_event events[64];
+        int n = epoll_wait(m_epoll, events, 64, m_ready.empty() ? timeout : 0);
+        if (n < 0) {
+            if (errno != EINTR) checkstat(n, "epoll_wait failed");
+            n = 0;
+        }
+        for (int i = 0; i < n; i++) {
+            Watch* w = static_cast<Watch*>(events[i].data.ptr);
+            if (w->active && !w->queued) {
+                w->queued = true;
+                m_ready.push_back(w);
+            }
+        }
+        std::vector<Watch*> ready;
+        ready.swap(m_ready);
+        int called(0);
+        for (auto w : ready) {
+            w->queued = false;
+            if (!w->active) continue;
+            called++;
+            if (w->handler(w->socket) && w->active && !w->queued) {
+                w->queued = true;
+                m_ready.push_back(w);
+            }
+        }
+        m_ready.erase(
+            std::remove_if(m_ready.begin(), m_ready.end(), [](Watch* w) { return !w->active; }),
+            m_ready.end()
+        );
+        m_removed.clear();
+        return called;
+    }
+    // Dispatch until stop() or there's nothing left to watch.
+
+    void run() {
+        m_stop = false;
+        while (!m_stop && !m_watches.empty()) {
+            runOnce(-1);
+        }
+    }
+    void stop() { m_stop = true; }
+private:
+    static int socketFd(int socket, int option) {
+        int fd(-1);
+        size_t size(sizeof(fd));
+        checkstat(
+            nn_getsockopt(socket, NN_SOL_SOCKET, option, &fd, &size),
+            "Unable to get a socket's file descriptor"
+        );
+        return fd;
+    }
+    void watch(int socket, int fd, Handler handler) {
+        std::unique_ptr<Watch> w(new Watch{socket, fd, std::move(handler), false, true});
+        epoll_event event = {};
+        event.events   = EPOLLIN | EPOLLET;    // Both descriptors signal by becoming readable.
+        event.data.ptr = w.get();
+        checkstat(epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event), "Unable to add a socket to epoll");
+        m_watches[fd] = std::move(w);
+    }
+};
+
+#endif
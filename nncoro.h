@@ -0,0 +1,221 @@
+/**
+ * C++20 coroutines for nanomsg sockets.
+ *
+ * A Task is a coroutine that an Executor runs.  Inside one,
+ *
+ *     int n = co_await asyncRecv(executor, socket, &msg, NN_MSG);
+ *     co_await asyncSend(executor, socket, buffer, size);
+ *
+ * return what nn_recv/nn_send would (-1 with nn_errno() set on failure) but, rather than
+ * blocking the thread, suspend the coroutine until the socket is ready.  So one thread can
+ * run thousands of coroutines, each with its own socket, where we'd otherwise need a
+ * thread each.
+ *
+ * An operation is first tried with NN_DONTWAIT and only suspends on EAGAIN, so a socket that
+ * is ready costs no trip through the executor.  Suspended operations wait in the socket's
+ * queue;  the Executor's EventLoop (eventloop.h) watches the socket's NN_RCVFD/NN_SNDFD and,
+ * when it's ready, retries the queued operations in order until one gets EAGAIN again (which
+ * is what the loop's edge triggering needs) and resumes the ones that completed.  If they all
+ * complete, the handler asks the loop to call it again on its next pass, after the resumed
+ * coroutines have run:  by then any that went back to the socket have either succeeded or
+ * seen EAGAIN and queued, so nothing is left for an edge that won't come.
+ *
+ * An Executor and its tasks belong to one thread.  Call forget(socket) before closing a
+ * socket a task waited on.
+ */
+#ifndef NNCORO_H
+#define NNCORO_H
+
+#include <nanomsg/nn.h>
+#include <coroutine>
+#include <exception>
+#include <deque>
+#include <map>
+#include <errno.h>
+#include "eventloop.h"
+
+class Executor;
+
+/**
+ * Task
+ *    A coroutine returning nothing.  It starts when it's spawned on an Executor and its
+ * frame is freed when it finishes.
+ */
+struct Task {
+    struct promise_type {
+        Executor* executor = nullptr;
+
+        Task get_return_object() {
+            return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never  final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+        ~promise_type();
+    };
+    std::coroutine_handle<promise_type> handle;
+};
+
+/**
+ * Operation
+ *    What's common to the awaitable sends and receives.
+ */
+class Operation {
+protected:
+    Executor&               m_executor;
+    int                     m_socket;
+    int                     m_result;
+    int                     m_errno;
+    std::coroutine_handle<> m_waiter;
+
+    Operation(Executor& executor, int socket) :
+        m_executor(executor), m_socket(socket), m_result(-1), m_errno(0) {}
+    virtual ~Operation() {}
+
+    // The nanomsg call with NN_DONTWAIT.
+
+    virtual int attempt() = 0;
+    virtual bool sending() const = 0;
+public:
+    // Try it;  false if it would have blocked.
+
+    bool tryOnce() {
+        m_result = attempt();
+        if (m_result < 0) {
+            m_errno = nn_errno();
+            return m_errno != EAGAIN;
+        }
+        return true;
+    }
+    std::coroutine_handle<> waiter() const { return m_waiter; }
+
+    bool await_ready() { return tryOnce(); }
+    void await_suspend(std::coroutine_handle<> waiter);
+    int await_resume() {
+        if (m_result < 0) errno = m_errno;     // For nn_errno().
+        return m_result;
+    }
+};
+
+class RecvOperation : public Operation {
+    void*  m_buf;
+    size_t m_len;
+    int    m_flags;
+public:
+    RecvOperation(Executor& executor, int socket, void* buf, size_t len, int flags) :
+        Operation(executor, socket), m_buf(buf), m_len(len), m_flags(flags) {}
+protected:
+    int attempt() override { return nn_recv(m_socket, m_buf, m_len, m_flags | NN_DONTWAIT); }
+    bool sending() const override { return false; }
+};
+
+class SendOperation : public Operation {
+    const void* m_buf;
+    size_t      m_len;
+    int         m_flags;
+public:
+    SendOperation(Executor& executor, int socket, const void* buf, size_t len, int flags) :
+        Operation(executor, socket), m_buf(buf), m_len(len), m_flags(flags) {}
+protected:
+    int attempt() override { return nn_send(m_socket, m_buf, m_len, m_flags | NN_DONTWAIT); }
+    bool sending() const override { return true; }
+};
+
+/**
+ * Executor
+ *    Runs tasks on the calling thread, resuming them as their sockets become ready.
+ */
+class Executor {
+private:
+    struct Waiters {
+        std::deque<Operation*> queue[2];       // Receives, sends.
+        bool                   watched[2] = {false, false};
+    };
+    EventLoop                           m_loop;
+    std::deque<std::coroutine_handle<>> m_runnable;
+    std::map<int, Waiters>              m_sockets;
+    size_t                              m_live;
+public:
+    Executor() : m_live(0) {}
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    // Queue a task to start on the next run.
+
+    void spawn(Task task) {
+        task.handle.promise().executor = this;
+        m_live++;
+        m_runnable.push_back(task.handle);
+    }
+    // Run until every task has finished.
+
+    void run() {
+        while (m_live) {
+            while (!m_runnable.empty()) {
+                auto task = m_runnable.front();
+                m_runnable.pop_front();
+                task.resume();
+            }
+            if (m_live) m_loop.runOnce(m_runnable.empty() ? -1 : 0);
+        }
+    }
+    size_t live() const { return m_live; }
+
+    // No longer watch a socket (before closing it).  It must have no operations waiting.
+
+    void forget(int socket) {
+        m_loop.remove(socket);
+        m_sockets.erase(socket);
+    }
+private:
+    friend class Operation;
+    friend struct Task::promise_type;
+
+    void finished() { m_live--; }
+
+    void wait(int socket, Operation* op, bool send) {
+        Waiters& w = m_sockets[socket];
+        w.queue[send].push_back(op);
+        if (!w.watched[send]) {
+            w.watched[send] = true;
+            auto ready = [this, socket, send](int) {
+                auto& queue = m_sockets[socket].queue[send];
+                if (queue.empty()) return false;    // A new operation tries before queueing.
+                while (!queue.empty()) {
+                    if (!queue.front()->tryOnce()) return false;    // Wait for the next edge.
+                    m_runnable.push_back(queue.front()->waiter());
+                    queue.pop_front();
+                }
+                return true;     // No EAGAIN yet:  look again once the waiters have run.
+            };
+            if (send) {
+                m_loop.onWritable(socket, ready);
+            } else {
+                m_loop.onReadable(socket, ready);
+            }
+        }
+    }
+};
+
+inline Task::promise_type::~promise_type() {
+    if (executor) executor->finished();
+}
+inline void
+Operation::await_suspend(std::coroutine_handle<> waiter) {
+    m_waiter = waiter;
+    m_executor.wait(m_socket, this, sending());
+}
+
+// co_await these:
+
+inline RecvOperation
+asyncRecv(Executor& executor, int socket, void* buf, size_t len, int flags = 0) {
+    return RecvOperation(executor, socket, buf, len, flags);
+}
+inline SendOperation
+asyncSend(Executor& executor, int socket, const void* buf, size_t len, int flags = 0) {
+    return SendOperation(executor, socket, buf, len, flags);
+}
+
+#endif
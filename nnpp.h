@@ -0,0 +1,223 @@
+/**
+ * Small C++ wrappers for the nanomsg C API shared by the examples and the performance
+ * programs (Performance/).
+ *
+ * *  checkstat - the error check every program used to carry its own copy of.
+ * *  Message   - owns an nn_allocmsg chunk (ours or one nn_recv handed us) and frees it
+ *                unless it was sent.
+ * *  Endpoint  - a bound or connected endpoint of a socket;  shut down when destroyed.
+ * *  Socket    - owns a socket;  closed when destroyed.
+ *
+ * Socket and Message are move only.  Declare endpoints after their socket so they go
+ * first (an endpoint must not outlive its socket).
+ *
+ * Set up calls (opening, binding, options) report failures with checkstat and exit
+ * like the rest of the code here.  The send and receive calls are on the hot path:
+ * they return what the C calls do (-1 with nn_errno set on failure, e.g. EAGAIN) and
+ * are inline one liners over them, so they cost nothing more (see Performance/wrapper.cpp).
+ * Zero copy is send(Message&) - nanomsg takes the chunk - and recv(Message&).
+ */
+#ifndef NNPP_H
+#define NNPP_H
+
+#include <nanomsg/nn.h>
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+
+// Useful error checking method:
+// Returns int since e.g. socket returns the socket on ok.
+// else output an error and exits with failure status.
+static inline int
+checkstat(int status, const char* msg) {
+    if (status < 0) {
+        std::cerr << msg << " " << nn_strerror(nn_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return status;
+}
+
+/**
+ * Message
+ *    An nn_allocmsg chunk and the size of the message in it.
+ */
+class Message {
+    void*  m_data;
+    size_t m_size;
+public:
+    Message() noexcept : m_data(nullptr), m_size(0) {}
+
+    // Allocate a chunk to build a message in for a zero copy send.
+
+    explicit Message(size_t size, int type = 0) : m_data(nn_allocmsg(size, type)), m_size(size) {
+        if (!m_data) checkstat(-1, "Unable to allocate a message");
+    }
+    // Take ownership of a chunk.
+
+    Message(void* data, size_t size) noexcept : m_data(data), m_size(size) {}
+    ~Message() {
+        if (m_data) nn_freemsg(m_data);
+    }
+    Message(Message&& rhs) noexcept : m_data(rhs.m_data), m_size(rhs.m_size) {
+        rhs.m_data = nullptr;
+        rhs.m_size = 0;
+    }
+    Message& operator=(Message&& rhs) noexcept {
+        if (this != &rhs) {
+            reset(rhs.m_data, rhs.m_size);
+            rhs.m_data = nullptr;
+            rhs.m_size = 0;
+        }
+        return *this;
+    }
+    Message(const Message&) = delete;
+    Message& operator=(const Message&) = delete;
+
+    void*  data() const noexcept { return m_data; }
+    size_t size() const noexcept { return m_size; }
+    template <class T> T* as() const noexcept { return static_cast<T*>(m_data); }
+    explicit operator bool() const noexcept { return m_data != nullptr; }
+
+    // Give up the chunk without freeing it (e.g. nanomsg took it).
+
+    void* release() noexcept {
+        void* result = m_data;
+        m_data = nullptr;
+        m_size = 0;
+        return result;
+    }
+    // Free what we have and own data instead.
+
+    void reset(void* data = nullptr, size_t size = 0) noexcept {
+        if (m_data) nn_freemsg(m_data);
+        m_data = data;
+        m_size = size;
+    }
+};
+
+/**
+ * Endpoint
+ *    Endpoint id of a socket from bind/connect.
+ */
+class Endpoint {
+    int m_socket;
+    int m_id;
+public:
+    Endpoint() noexcept : m_socket(-1), m_id(-1) {}
+    Endpoint(int socket, int id) noexcept : m_socket(socket), m_id(id) {}
+    ~Endpoint() {
+        if (m_id >= 0) nn_shutdown(m_socket, m_id);
+    }
+    Endpoint(Endpoint&& rhs) noexcept : m_socket(rhs.m_socket), m_id(rhs.m_id) {
+        rhs.m_id = -1;
+    }
+    Endpoint& operator=(Endpoint&& rhs) noexcept {
+        if (this != &rhs) {
+            if (m_id >= 0) nn_shutdown(m_socket, m_id);
+            m_socket = rhs.m_socket;
+            m_id     = rhs.m_id;
+            rhs.m_id = -1;
+        }
+        return *this;
+    }
+    Endpoint(const Endpoint&) = delete;
+    Endpoint& operator=(const Endpoint&) = delete;
+
+    int id() const noexcept { return m_id; }
+
+    // Shut down now, checking for errors.
+
+    void shutdown(const char* msg = "Failed to shutdown an endpoint.") {
+        if (m_id >= 0) checkstat(nn_shutdown(m_socket, m_id), msg);
+        m_id = -1;
+    }
+};
+
+/**
+ * Socket
+ *    A nanomsg socket.
+ */
+class Socket {
+    int m_fd;
+public:
+    Socket() noexcept : m_fd(-1) {}
+    Socket(int domain, int protocol, const char* msg = "Unable to open a socket.") :
+        m_fd(checkstat(nn_socket(domain, protocol), msg)) {}
+    ~Socket() {
+        if (m_fd >= 0) nn_close(m_fd);
+    }
+    Socket(Socket&& rhs) noexcept : m_fd(rhs.m_fd) {
+        rhs.m_fd = -1;
+    }
+    Socket& operator=(Socket&& rhs) noexcept {
+        if (this != &rhs) {
+            if (m_fd >= 0) nn_close(m_fd);
+            m_fd = rhs.m_fd;
+            rhs.m_fd = -1;
+        }
+        return *this;
+    }
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+
+    int fd() const noexcept { return m_fd; }
+
+    // Close now, checking for errors.
+
+    void close(const char* msg = "Failed to close a socket.") {
+        if (m_fd >= 0) checkstat(nn_close(m_fd), msg);
+        m_fd = -1;
+    }
+
+    Endpoint bind(const std::string& uri, const char* msg = "Failed to bind.") {
+        return Endpoint(m_fd, checkstat(nn_bind(m_fd, uri.c_str()), msg));
+    }
+    Endpoint connect(const std::string& uri, const char* msg = "Failed to connect.") {
+        return Endpoint(m_fd, checkstat(nn_connect(m_fd, uri.c_str()), msg));
+    }
+
+    template <class T>
+    void setOption(int level, int option, const T& value, const char* msg = "Failed to set a socket option.") {
+        checkstat(nn_setsockopt(m_fd, level, option, &value, sizeof(value)), msg);
+    }
+    void setOption(int level, int option, const std::string& value, const char* msg = "Failed to set a socket option.") {
+        checkstat(nn_setsockopt(m_fd, level, option, value.data(), value.size()), msg);
+    }
+    template <class T>
+    T getOption(int level, int option, const char* msg = "Failed to get a socket option.") const {
+        T value;
+        size_t size(sizeof(value));
+        checkstat(nn_getsockopt(m_fd, level, option, &value, &size), msg);
+        return value;
+    }
+
+    // Hot path - return values are nn_send/nn_recv's.
+
+    int send(const void* buf, size_t len, int flags = 0) noexcept {
+        return nn_send(m_fd, buf, len, flags);
+    }
+    // Zero copy:  on success nanomsg owns the chunk and msg is empty.
+
+    int send(Message& msg, int flags = 0) noexcept {
+        void* chunk = msg.data();
+        int n = nn_send(m_fd, &chunk, NN_MSG, flags);
+        if (n >= 0) msg.release();
+        return n;
+    }
+    int recv(void* buf, size_t len, int flags = 0) noexcept {
+        return nn_recv(m_fd, buf, len, flags);
+    }
+    // Zero copy:  msg gets the chunk nanomsg allocated.
+
+    int recv(Message& msg, int flags = 0) noexcept {
+        void* chunk(nullptr);
+        int n = nn_recv(m_fd, &chunk, NN_MSG, flags);
+        if (n >= 0) msg.reset(chunk, n);
+        return n;
+    }
+};
+
+static_assert(sizeof(Socket) == sizeof(int), "Socket is just the descriptor");
+static_assert(sizeof(Message) == sizeof(void*) + sizeof(size_t), "Message is just the chunk");
+
+#endif
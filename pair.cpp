@@ -18,39 +18,25 @@
 #include <string>
 #include <string.h>
 #include <sstream>
-
-
-// Useful error checking method:
-// Returns int since e.g. socket returns the socket on ok.
-// else output an error and exists with failure status.
-static int
-checkstat(int status, const char* msg) {
-    if (status < 0) {
-        std::cerr << msg << nn_strerror(nn_errno()) << std::endl;
-        exit(EXIT_FAILURE);
-    }
-    return status;
-}
-
+#include "nnpp.h"
 
 // Thing that does the communication; per Dr. Suess.
 static void
-thing(int socket, const char* name) {
+thing(Socket& socket, const char* name) {
     std::stringstream strmessage;
     strmessage << name << " says hi";
     std::string msg(strmessage.str());
     checkstat(
-        nn_send(socket, msg.c_str(), msg.size()+1, 0),
+        socket.send(msg.c_str(), msg.size()+1),
         "Thing failed to send a message"
     );
 
-    char* buf(nullptr);
+    Message buf;
     checkstat(
-        nn_recv(socket, &buf, NN_MSG, 0),
+        socket.recv(buf),
         "THing failed to receive emssage"
     );
-    std::cerr << name << " got " << buf << std::endl;;
-    nn_freemsg(buf);
+    std::cerr << name << " got " << buf.as<char>() << std::endl;;
 }
 
 /**
@@ -59,26 +45,13 @@ thing(int socket, const char* name) {
  */
 static void
 thing2(std::string uri) {
-    int socket = checkstat(
-        nn_socket(AF_SP, NN_PAIR),
-        "Failed to open thing2 socket."
-    );
-    int endpoint = checkstat(
-        nn_connect(socket, uri.c_str()),
-        "Failed to connect to pair uri"
-    );
+    Socket socket(AF_SP, NN_PAIR, "Failed to open thing2 socket.");
+    Endpoint endpoint = socket.connect(uri, "Failed to connect to pair uri");
 
     thing(socket, "thing2");  // Do the communication.
 
-    checkstat(
-        nn_shutdown(socket, endpoint),
-        "Failed to shutdown thing 2 endpoint"
-    );
-
-    checkstat(
-        nn_close(socket),
-        "Failed to close thing2 socket"
-    );
+    endpoint.shutdown("Failed to shutdown thing 2 endpoint");
+    socket.close("Failed to close thing2 socket");
 }
 
 // entry point  is thing 2:
@@ -88,14 +61,8 @@ int main(int argc, char** argv) {
 
     // set up the listner.
 
-    int socket = checkstat(
-        nn_socket(AF_SP, NN_PAIR),
-        "Failed to open thing 1 socket"
-    );
-    int endpoint = checkstat(
-        nn_bind(socket, uri.c_str()),
-        "Failed to bind thing1 socket"
-    );
+    Socket socket(AF_SP, NN_PAIR, "Failed to open thing 1 socket");
+    Endpoint endpoint = socket.bind(uri, "Failed to bind thing1 socket");
 
     // Now we can start thing2:
 
@@ -107,14 +74,8 @@ int main(int argc, char** argv) {
     partner.join();
 
 
-    checkstat(
-        nn_shutdown(socket, endpoint),
-        "Failed to shutdownn thing1 end point"
-    );
-    checkstat(
-        nn_close(socket),
-        "failed to close thing1 socket."
-    );
+    endpoint.shutdown("Failed to shutdownn thing1 end point");
+    socket.close("failed to close thing1 socket.");
 
     exit(EXIT_SUCCESS);
-}
\ No newline at end of file
+}
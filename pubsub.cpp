@@ -16,18 +16,7 @@
 #include <string>
 #include <string.h>
 #include <sstream>
-
-// Useful error checking method:
-// Returns int since e.g. socket returns the socket on ok.
-// else output an error and exists with failure status.
-static int
-checkstat(int status, const char* msg) {
-    if (status < 0) {
-        std::cerr << msg << nn_strerror(nn_errno()) << std::endl;
-        exit(EXIT_FAILURE);
-    }
-    return status;
-}
+#include "nnpp.h"
 
 
 /**
@@ -37,39 +26,22 @@ checkstat(int status, const char* msg) {
 static void subscriber(std::string uri) {
 
     // Open the socket set the subscription and connect.
-    int socket = checkstat(
-        nn_socket(AF_SP, NN_SUB),
-        "Could not open subscriber socket."
-    );
-    const char* subscription="EXIT";
-    checkstat(
-        nn_setsockopt(socket, NN_SUB, NN_SUB_SUBSCRIBE, subscription, strlen(subscription)),
-        "Could not set subscription string."
-    );
-    int endpoint = checkstat(
-        nn_connect(socket, uri.c_str()),
-        "Failed to connect to publisher."
-    );
+    Socket socket(AF_SP, NN_SUB, "Could not open subscriber socket.");
+    socket.setOption(NN_SUB, NN_SUB_SUBSCRIBE, std::string("EXIT"), "Could not set subscription string.");
+    Endpoint endpoint = socket.connect(uri, "Failed to connect to publisher.");
 
     // Get our message:
 
-    char* pMsg(nullptr);
+    Message msg;
     checkstat(
-        nn_recv(socket, &pMsg, NN_MSG, 0),
+        socket.recv(msg),
         "Could not receive message"
     );
 
-    std::cout << "Subscriber got " << pMsg << std::endl;
-    nn_freemsg(pMsg);
+    std::cout << "Subscriber got " << msg.as<char>() << std::endl;
 
-    checkstat(
-        nn_shutdown(socket, endpoint),
-        "Failed to shutdown subscriber endpoint"
-    );
-    checkstat(
-        nn_close(socket),
-        "Failed to close subscriber socket."
-    );
+    endpoint.shutdown("Failed to shutdown subscriber endpoint");
+    socket.close("Failed to close subscriber socket.");
 }
 
 // Entry point:
@@ -79,14 +51,8 @@ int main(int argc, char** argv) {
 
     // Set up the publisher before starting the subscdriber.
 
-    int socket = checkstat(
-        nn_socket(AF_SP, NN_PUB),
-        "Could not create publisher socket."
-    );
-    int endpoint =  checkstat(
-        nn_bind(socket, uri.c_str()), 
-        "Publisher bind failed."
-    );
+    Socket socket(AF_SP, NN_PUB, "Could not create publisher socket.");
+    Endpoint endpoint = socket.bind(uri, "Publisher bind failed.");
 
     // start the subscsriber:
 
@@ -103,21 +69,15 @@ int main(int argc, char** argv) {
     for (int i =0; i < 3; i++) {
         std::cout << "Publishing : " << pMessage[i] << std::endl;
         checkstat(
-            nn_send(socket, pMessage[i], strlen(pMessage[i]), 0),
+            socket.send(pMessage[i], strlen(pMessage[i])),
             "Failed to publish a message"
         );
     }
 
     subscriberThread.join();                     // Should exit right:
 
-    checkstat(
-        nn_shutdown(socket, endpoint),
-        "Failed to shutdown publisher endpoint"
-    );
-    checkstat(
-        nn_close(socket),
-        "Failed to close publisher socket."
-    );
+    endpoint.shutdown("Failed to shutdown publisher endpoint");
+    socket.close("Failed to close publisher socket.");
 
     return EXIT_SUCCESS;
 }
\ No newline at end of file
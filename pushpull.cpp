@@ -16,17 +16,7 @@
 #include <unistd.h>
 #include <string>
 #include <string.h>
-
-// Useful error checking method:
-// Returns int since e.g. socket returns the socket on ok.
-static int
-checkstat(int status, const char* msg) {
-    if (status < 0) {
-        std::cerr << msg << nn_strerror(nn_errno()) << std::endl;
-        exit(EXIT_FAILURE);
-    }
-    return status;
-}
+#include "nnpp.h"
 
 
 /** Puller thread:
@@ -34,48 +24,31 @@ checkstat(int status, const char* msg) {
  */
 static void
 puller(std::string uri) {
-    int socket = checkstat(
-        nn_socket(AF_SP, NN_PULL),
-        "Failed to open pull socket."
-    );
-    int endpoint = checkstat(
-        nn_connect(socket, uri.c_str()),
-        "Failed to connect to pusher."
-    );
+    Socket socket(AF_SP, NN_PULL, "Failed to open pull socket.");
+    Endpoint endpoint = socket.connect(uri, "Failed to connect to pusher.");
+
     // Lets' get nanomsg to allocated the message:
 
-    char* buf(nullptr);
-    int recvbytes = checkstat(
-        nn_recv(socket, &buf, NN_MSG, 0),
+    Message msg;
+    checkstat(
+        socket.recv(msg),
         "Failed to receive pushed message."
 
     );
     // We assume the message is a string:
 
-    std::cout << "Pulled " << buf << std::endl;
-    nn_freemsg(buf);
-    checkstat(
-        nn_shutdown(socket, endpoint),
-        "Puller failed to shutdown endpoint"
-    );
-    checkstat(
-        nn_close(socket),
-        "Puller failed to close socket."
-    );
+    std::cout << "Pulled " << msg.as<char>() << std::endl;
+
+    endpoint.shutdown("Puller failed to shutdown endpoint");
+    socket.close("Puller failed to close socket.");
 }
 
 int main(int argc, char** argv) {
     std::string uri(argv[1]);     // So we can use all transports.
 
-    int socket = checkstat(
-        nn_socket(AF_SP, NN_PUSH),
-        "Failed to open push socket"
-    );
+    Socket socket(AF_SP, NN_PUSH, "Failed to open push socket");
+    Endpoint endpoint = socket.bind(uri, "Failed to bind pusher.");
 
-    int endpoint = checkstat(
-        nn_bind(socket, uri.c_str()),
-        "Failed to bind pusher."
-    );
     // Start the puller and wait abit for it to get started.
     // We could get clever and use a barrier promise/future but that's too complicated.
 
@@ -84,7 +57,7 @@ int main(int argc, char** argv) {
 
     const char* message="This is a pushed mesage";
     checkstat(
-        nn_send(socket, message ,strlen(message) +1, 0),
+        socket.send(message ,strlen(message) +1),
         "Unable to push a message"
     );
 
@@ -94,13 +67,8 @@ int main(int argc, char** argv) {
 
     // Shutdown our end:
 
-    checkstat(nn_shutdown(socket, endpoint),
-        "Unable to shutdownt he pusher's endpoint"
-    );
-    checkstat(
-        nn_close(socket),
-        "Unable to shutdown the push socket"
-    );
+    endpoint.shutdown("Unable to shutdownt he pusher's endpoint");
+    socket.close("Unable to shutdown the push socket");
 
     exit(EXIT_SUCCESS);
 }
\ No newline at end of file
@@ -0,0 +1,81 @@
+/**
+ * Binary survey wire format shared by the survey respond example and the survey
+ * performance program (Performance/survey.cpp).
+ *
+ * Surveys and responses are fixed size structs that are read in place from the NN_MSG
+ * buffer nn_recv hands back;  nothing is parsed or copied and no strings are built.
+ *
+ * A survey carries an opcode and a bitmask of the respondent groups it's addressed to.
+ * Each respondent belongs to one or more groups (in the example, group 0 is the even
+ * numbered responders and group 1 the odd ones) and answers only surveys whose mask
+ * includes one of them.  Fields are in host byte order:  both ends are on the same machine.
+ */
+#ifndef SURVEY_H
+#define SURVEY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+static const uint32_t SURVEY_MAGIC   = 0x59565253;    // "SRVY"
+static const uint16_t SURVEY_VERSION = 1;
+
+enum SurveyOpcode : uint16_t {
+    SURVEY_REPORT = 1,          // Respond with our id.
+    SURVEY_EXIT   = 2           // Respond and then exit.
+};
+
+static const uint64_t SURVEY_ALL_GROUPS = ~0ULL;
+
+struct SurveyRequest {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t opcode;
+    uint64_t groups;            // Respondent groups addressed.
+    uint64_t survey;            // Sequence number of the survey.
+};
+
+struct SurveyResponse {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t opcode;            // The survey's.
+    uint32_t respondent;
+    uint32_t reserved;
+    uint64_t survey;
+};
+
+// Fill in a survey/response.
+
+inline SurveyRequest
+makeSurvey(SurveyOpcode opcode, uint64_t groups, uint64_t survey) {
+    return SurveyRequest{SURVEY_MAGIC, SURVEY_VERSION, opcode, groups, survey};
+}
+inline SurveyResponse
+makeResponse(const SurveyRequest& request, uint32_t respondent) {
+    return SurveyResponse{
+        SURVEY_MAGIC, SURVEY_VERSION, request.opcode, respondent, 0, request.survey
+    };
+}
+
+// View a received buffer as a survey/response - nullptr if it isn't one.
+
+inline const SurveyRequest*
+decodeSurvey(const void* msg, int size) {
+    const SurveyRequest* p = static_cast<const SurveyRequest*>(msg);
+    return (size >= (int)sizeof(SurveyRequest) && p->magic == SURVEY_MAGIC &&
+            p->version == SURVEY_VERSION) ? p : nullptr;
+}
+inline const SurveyResponse*
+decodeResponse(const void* msg, int size) {
+    const SurveyResponse* p = static_cast<const SurveyResponse*>(msg);
+    return (size >= (int)sizeof(SurveyResponse) && p->magic == SURVEY_MAGIC &&
+            p->version == SURVEY_VERSION) ? p : nullptr;
+}
+
+// Is a survey addressed to a respondent in groups?
+
+inline bool
+surveyIncludes(const SurveyRequest& request, uint64_t groups) {
+    return (request.groups & groups) != 0;
+}
+
+#endif
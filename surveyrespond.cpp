@@ -14,10 +14,22 @@
  * *   EVEN - only even threads respond with their ids.
  * *   ODD  - Only odd threads respond with their ids.
  * *   EXIT - Like ALL but threads exit after responding.
+ *
+ * Surveys and responses use the binary format in survey.h:  the opcode says whether
+ * it's EXIT and the group mask who should answer (even threads are in EVEN_GROUP,
+ * odd ones in ODD_GROUP).  Responders look at the received buffer in place.
  * 
  *  THe main thread sends an ALL, EVEN ODD and then EXIT surveys.
  *    *  Indicates the survey it's about to perform.
  *    * Outputs the responses received.
+ *    * Outputs the responders that should have answered but didn't.
+ *
+ * Usage:
+ *    surveyrespond uri [quorum]
+ * A survey is over once quorum (a fraction, default 1 - everyone) of the responders that
+ * should answer it have, or at the deadline.  With a quorum of 0 every survey waits out
+ * the deadline.  Responses that come in after we've moved on are dropped by the surveyor
+ * socket (a new survey cancels the old one).
  * The survey timout is set to something pretty small like 250ms so the program won't hang too
  * long on survey responses.   There is a default survey time but we're too lazy to fetch it
  * to see if its reasonable.
@@ -34,17 +46,19 @@
 #include <string.h>
 #include <sstream>
 #include <vector>
+#include <set>
+#include <math.h>
+#include "survey.h"
+#include "nnpp.h"
 
-// Useful error checking method:
-// Returns int since e.g. socket returns the socket on ok.
-// else output an error and exists with failure status.
-static int
-checkstat(int status, const char* msg) {
-    if (status < 0) {
-        std::cerr << msg << " "  << nn_strerror(nn_errno()) << std::endl;
-        exit(EXIT_FAILURE);
-    }
-    return status;
+// Respondent groups:
+
+static const uint64_t EVEN_GROUP = 1;
+static const uint64_t ODD_GROUP  = 2;
+
+static uint64_t
+responderGroups(int id) {
+    return (id % 2) == 0 ? EVEN_GROUP : ODD_GROUP;
 }
 
 // A responder thread: 
@@ -52,72 +66,69 @@ checkstat(int status, const char* msg) {
 static void
 responder(std::string uri, int id) {
 
-    int socket = checkstat(
-        nn_socket(AF_SP, NN_RESPONDENT),
-        "Unable to open respondent socket."
-    );
-    int endpoint = checkstat(
-        nn_connect(socket, uri.c_str()),
-        "Respondent failed to connect to the surveyor."
-    );
+    Socket socket(AF_SP, NN_RESPONDENT, "Unable to open respondent socket.");
+    Endpoint endpoint = socket.connect(uri, "Respondent failed to connect to the surveyor.");
     std::cerr << "Thread " << id << " ready for surveys\n";
     // Process surveys (or not).
     bool done = false;
     while (!done) {
-        char* pBuf(nullptr);
-        checkstat(
-            nn_recv(socket, &pBuf, NN_MSG, 0),
+        Message pBuf;                     // Freed at the end of each pass.
+        int nRecv = checkstat(
+            socket.recv(pBuf),
             "Failed to receive a survey"
         );
-        std::string survey(pBuf);
-        nn_freemsg(pBuf);
-        pBuf = nullptr;
-        if (survey == "ALL" ||            // everyone responds
-            survey == "EXIT" ||           // respond and exit.
-            (survey == "ODD" && (id % 2) != 0) || // Odd and we're odd.
-            (survey =="EVEN" && (id %2) == 0)) { // even and we're even.
-
-            std::stringstream strresponse;
-            strresponse << id << " Responding to " << survey;
-            std::string response(strresponse.str());
-
+        const SurveyRequest* survey = decodeSurvey(pBuf.data(), nRecv);
+        if (survey && surveyIncludes(*survey, responderGroups(id))) {
+            SurveyResponse response = makeResponse(*survey, id);
             checkstat(
-                nn_send(socket, response.c_str(), response.size()+1, 0),
+                socket.send(&response, sizeof(response)),
                 "Failed to respond to a survey"
             );
-
         }
-        if (survey == "EXIT") done = true; // Exit if requested to.
+        if (survey && survey->opcode == SURVEY_EXIT) done = true; // Exit if requested to.
     }
 
-    checkstat(
-        nn_shutdown(socket, endpoint),
-        "Failed to shutdown responder endpoint"
-    );
-    checkstat(
-        nn_close(socket),
-        "Failed to close responcder socket"
-    );
+    endpoint.shutdown("Failed to shutdown responder endpoint");
+    socket.close("Failed to close responcder socket");
 
     // Exit thread.
 }
-// Conduct a survey and get the replies:
 
-static void 
-survey (int socket, const char* request) {
-    std::cout << "Survey: " << request << std::endl;
+// The responders that should answer a survey:
+
+static std::set<int>
+expectedResponders(const SurveyRequest& request, int nResponders) {
+    std::set<int> result;
+    for (int id = 0; id < nResponders; id++) {
+        if (surveyIncludes(request, responderGroups(id))) result.insert(id);
+    }
+    return result;
+}
+
+// Conduct a survey and get the replies.
+// The survey is over when quorum (fraction) of the expected responders have answered
+// or the deadline passes.  quorum == 0 means always wait for the deadline.
+// Returns the responders that didn't answer.
+
+static std::set<int>
+survey (
+    Socket& socket, const char* name, const SurveyRequest& request, const std::set<int>& expected,
+    double quorum
+) {
+    std::cout << "Survey: " << name << std::endl;
     // send the survey:
 
     checkstat(
-        nn_send(socket, request, strlen(request) + 1, 0),   // +1 for null terminator.
+        socket.send(&request, sizeof(request)),
         "failed to start a survey"
     );
-    char* pResponse(nullptr);
+    size_t wanted = quorum > 0 ? (size_t)ceil(quorum * expected.size()) : 0;
+    std::set<int> missing(expected);
     bool done = false;
-    int nRecv;
     std::cerr << "----------------------- start responses\n";
     while (!done) {
-        nRecv = nn_recv(socket, &pResponse, NN_MSG, 0);
+        Message pResponse;
+        int nRecv = socket.recv(pResponse);
         if ((nRecv <= 0) && (nn_errno() == ETIMEDOUT)) {
             std::cerr << "Survey timeout " << nRecv << std::endl;
             done = true;                         // Survey done
@@ -128,49 +139,66 @@ survey (int socket, const char* request) {
             );
             // response
 
-            std::cout << "Got response: " << pResponse << " " << std::endl;
-            nn_freemsg(pResponse);
-            pResponse = nullptr;
+            const SurveyResponse* response = decodeResponse(pResponse.data(), nRecv);
+            if (response) {
+                std::cout << "Got response: " << response->respondent << " Responding to "
+                          << name << std::endl;
+                missing.erase(response->respondent);
+            }
+            if (wanted && expected.size() - missing.size() >= wanted) {
+                done = true;                     // Quorum, no need to wait.
+            }
         }
     }
+    if (!missing.empty()) {
+        std::cout << "No response from:";
+        for (int id : missing) std::cout << " " << id;
+        std::cout << std::endl;
+    }
     std::cerr << "-------------------end responses\n";
+    return missing;
 }
 
 // entry point.
 int main(int argc,  char**argv) {
     std::string uri(argv[1]);    /// not production code.
+    double quorum = argc > 2 ? atof(argv[2]) : 1.0;
+    const int nResponders = 10;
 
     // setup the survey end of things:
 
-    int socket = checkstat(
-        nn_socket(AF_SP, NN_SURVEYOR),
-        "Unable to open surveyor socket."
-    );
-    int endpoint = checkstat(
-        nn_bind(socket, uri.c_str()),
-        "Unable to advertise surveyor."
-    );
+    Socket socket(AF_SP, NN_SURVEYOR, "Unable to open surveyor socket.");
+    Endpoint endpoint = socket.bind(uri, "Unable to advertise surveyor.");
     // Set the survey lifetime.
 #ifdef SETLIFE
     int lifetime =250;    /// milliseconds.
     //  Hope this works.  THe docs are not clear.
-    checkstat(
-        nn_setsockopt(socket, NN_SURVEYOR,  NN_SURVEYOR_DEADLINE,  &lifetime, sizeof(int)),
-        "Failed to set servuey lifetime"
-    );
+    socket.setOption(NN_SURVEYOR, NN_SURVEYOR_DEADLINE, lifetime, "Failed to set servuey lifetime");
 #endif
     std::vector<std::thread*>  responders;
-    for(int i=0; i < 10; i++) {
+    for(int i=0; i < nResponders; i++) {
         responders.push_back(new std::thread(responder, uri, i));
     }
     // Wait a bit for everything to work out:
 
     sleep(1);
 
-    survey(socket, "ALL");
-    survey(socket, "EVEN");
-    survey(socket, "ODD");
-    survey(socket, "EXIT");
+    struct {
+        const char*  name;
+        SurveyOpcode opcode;
+        uint64_t     groups;
+    } surveys[] = {
+        {"ALL",  SURVEY_REPORT, SURVEY_ALL_GROUPS},
+        {"EVEN", SURVEY_REPORT, EVEN_GROUP},
+        {"ODD",  SURVEY_REPORT, ODD_GROUP},
+        {"EXIT", SURVEY_EXIT,   SURVEY_ALL_GROUPS}
+    };
+    for (int i = 0; i < sizeof(surveys)/sizeof(surveys[0]); i++) {
+        SurveyRequest request = makeSurvey(surveys[i].opcode, surveys[i].groups, i);
+        survey(
+            socket, surveys[i].name, request, expectedResponders(request, nResponders), quorum
+        );
+    }
 
     // wait for the threads to all exit and  free them.
 
@@ -182,13 +210,7 @@ int main(int argc,  char**argv) {
 
     // Tear down the survey
 
-    checkstat(
-        nn_shutdown(socket, endpoint),
-        "Failed to shutdown survey endpoint"
-    );
-    checkstat(
-        nn_close(socket),
-        "failed to close survey socket."
-    );
+    endpoint.shutdown("Failed to shutdown survey endpoint");
+    socket.close("failed to close survey socket.");
     return EXIT_SUCCESS;
 }
\ No newline at end of file